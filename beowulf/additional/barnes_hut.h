@@ -0,0 +1,425 @@
+#ifndef BARNES_HUT_H
+#define BARNES_HUT_H
+
+/*
+ * Barnes-Hut quadtree for the galaxy programs (O(N log N) per step).
+ *
+ * Build (every rank builds the whole tree from the replicated positions,
+ * using its thread pool):
+ *   1. bounding square + 32-bit Morton key per star         (parallel)
+ *   2. LSD radix sort of the keys, copy bodies in key order  (serial sort)
+ *   3. the 4^BH_PAR_LEVEL top cells are independent subtrees,
+ *      built in parallel; the few levels above them are linked serially
+ *
+ * The tree is "compressed": a cell with a single non-empty child is
+ * replaced by that child, so every internal node has >= 2 children and the
+ * tree has fewer than 2N nodes (preallocated, allocated with an atomic
+ * counter by the build threads).
+ *
+ * Force law is the same as the direct loops in galaxy*.c:
+ *   a_i += G * m_i * m_j * d / max(|d|, 1)^3
+ * bh_accel returns sum_j m_j * d / max(|d|, 1)^3; the caller multiplies by
+ * G * m_i. A cell is used as a point mass when it does not contain the
+ * target and size / (distance - offset) < theta, where offset is how far its
+ * centre of mass sits from the cell centre. theta = 0 is the exact sum.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "thread_pool.h"
+
+#define BH_DEPTH     16   /* Morton levels (16 bits per axis) */
+#define BH_LEAF      8    /* max bodies in a leaf above BH_DEPTH */
+#define BH_PAR_LEVEL 3    /* 64 top cells built in parallel */
+#define BH_STACK     (4 * (BH_DEPTH + 4))
+
+typedef struct {
+    double cx, cy, mass;     /* centre of mass, total mass */
+    double x0, y0, size;     /* the cell square */
+    int first, count;        /* body range in sorted order */
+    int child[4];            /* -1 = empty; all -1 -> leaf */
+} bh_node_t;
+
+typedef struct {
+    int n, cap;              /* bodies, allocated body capacity */
+    uint32_t *key, *key_tmp;
+    int *idx, *idx_tmp;
+    double *sx, *sy, *sm;    /* bodies in Morton order */
+
+    bh_node_t *nodes;
+    int nnodes, root;
+    double x0, y0, size;     /* root square */
+
+    int top_root[1 << (2 * BH_PAR_LEVEL)];
+} bh_tree_t;
+
+static void bh_init(bh_tree_t *t) {
+    memset(t, 0, sizeof(*t));
+    t->root = -1;
+}
+
+static void bh_free(bh_tree_t *t) {
+    free(t->key); free(t->key_tmp);
+    free(t->idx); free(t->idx_tmp);
+    free(t->sx); free(t->sy); free(t->sm);
+    free(t->nodes);
+    bh_init(t);
+}
+
+static int bh_reserve(bh_tree_t *t, int n) {
+    if (n <= t->cap) return 0;
+    bh_free(t);
+    t->key     = (uint32_t *)malloc(n * sizeof(uint32_t));
+    t->key_tmp = (uint32_t *)malloc(n * sizeof(uint32_t));
+    t->idx     = (int *)malloc(n * sizeof(int));
+    t->idx_tmp = (int *)malloc(n * sizeof(int));
+    t->sx      = (double *)malloc(n * sizeof(double));
+    t->sy      = (double *)malloc(n * sizeof(double));
+    t->sm      = (double *)malloc(n * sizeof(double));
+    t->nodes   = (bh_node_t *)malloc((2 * (size_t)n + 1) * sizeof(bh_node_t));
+    if (!t->key || !t->key_tmp || !t->idx || !t->idx_tmp ||
+        !t->sx || !t->sy || !t->sm || !t->nodes) {
+        bh_free(t);
+        return -1;
+    }
+    t->cap = n;
+    return 0;
+}
+
+/* Spread the low 16 bits of v to the even bit positions */
+static uint32_t bh_spread(uint32_t v) {
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+/* Quadrant (bit0 = x half, bit1 = y half) of a key at a tree level */
+static int bh_digit(uint32_t key, int level) {
+    return (int)((key >> (2 * (BH_DEPTH - 1 - level))) & 3);
+}
+
+/* ---------------- parallel build pieces ---------------- */
+
+typedef struct {
+    bh_tree_t *t;
+    const double *x, *y, *m;
+    size_t stride;                       /* in doubles: 1 for SoA, 5 for Star */
+    double *bounds;                      /* per thread: min x, max x, min y, max y */
+} bh_build_job_t;
+
+static void bh_bounds_task(long lo, long hi, int tid, void *arg) {
+    bh_build_job_t *job = (bh_build_job_t *)arg;
+    double *b = job->bounds + 4 * (size_t)tid;
+    double x0 = b[0], x1 = b[1], y0 = b[2], y1 = b[3];
+    for (long i = lo; i < hi; i++) {
+        double x = job->x[i * job->stride], y = job->y[i * job->stride];
+        if (x < x0) x0 = x;
+        if (x > x1) x1 = x;
+        if (y < y0) y0 = y;
+        if (y > y1) y1 = y;
+    }
+    b[0] = x0; b[1] = x1; b[2] = y0; b[3] = y1;
+}
+
+static void bh_key_task(long lo, long hi, int tid, void *arg) {
+    bh_build_job_t *job = (bh_build_job_t *)arg;
+    bh_tree_t *t = job->t;
+    double scale = (double)(1u << BH_DEPTH) / t->size;
+    (void)tid;
+    for (long i = lo; i < hi; i++) {
+        double fx = (job->x[i * job->stride] - t->x0) * scale;
+        double fy = (job->y[i * job->stride] - t->y0) * scale;
+        uint32_t qx = fx <= 0 ? 0 : (fx >= 65535.0 ? 65535u : (uint32_t)fx);
+        uint32_t qy = fy <= 0 ? 0 : (fy >= 65535.0 ? 65535u : (uint32_t)fy);
+        t->key[i] = bh_spread(qx) | (bh_spread(qy) << 1);
+        t->idx[i] = (int)i;
+    }
+}
+
+static void bh_gather_task(long lo, long hi, int tid, void *arg) {
+    bh_build_job_t *job = (bh_build_job_t *)arg;
+    bh_tree_t *t = job->t;
+    (void)tid;
+    for (long i = lo; i < hi; i++) {
+        size_t s = (size_t)t->idx[i] * job->stride;
+        t->sx[i] = job->x[s];
+        t->sy[i] = job->y[s];
+        t->sm[i] = job->m[s];
+    }
+}
+
+/* LSD radix sort of (key, idx), 8 bits per pass */
+static void bh_radix_sort(bh_tree_t *t) {
+    for (int shift = 0; shift < 2 * BH_DEPTH; shift += 8) {
+        int count[257] = {0};
+        for (int i = 0; i < t->n; i++) count[((t->key[i] >> shift) & 0xFF) + 1]++;
+        for (int b = 0; b < 256; b++) count[b + 1] += count[b];
+        for (int i = 0; i < t->n; i++) {
+            int pos = count[(t->key[i] >> shift) & 0xFF]++;
+            t->key_tmp[pos] = t->key[i];
+            t->idx_tmp[pos] = t->idx[i];
+        }
+        uint32_t *k = t->key; t->key = t->key_tmp; t->key_tmp = k;
+        int *x = t->idx; t->idx = t->idx_tmp; t->idx_tmp = x;
+    }
+}
+
+/* First position in [lo, hi) whose key has quadrant >= d at this level */
+static int bh_lower_bound(const bh_tree_t *t, int lo, int hi, int level, int d) {
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (bh_digit(t->key[mid], level) < d) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int bh_alloc_node(bh_tree_t *t) {
+    return __atomic_fetch_add(&t->nnodes, 1, __ATOMIC_RELAXED);
+}
+
+/* Mass and centre of mass of a node from its children (or bodies) */
+static void bh_moments(bh_tree_t *t, bh_node_t *nd) {
+    double m = 0.0, mx = 0.0, my = 0.0;
+    int leaf = 1;
+    for (int c = 0; c < 4; c++) {
+        if (nd->child[c] < 0) continue;
+        const bh_node_t *ch = &t->nodes[nd->child[c]];
+        m += ch->mass; mx += ch->mass * ch->cx; my += ch->mass * ch->cy;
+        leaf = 0;
+    }
+    if (leaf) {
+        for (int p = nd->first; p < nd->first + nd->count; p++) {
+            m += t->sm[p]; mx += t->sm[p] * t->sx[p]; my += t->sm[p] * t->sy[p];
+        }
+    }
+    nd->mass = m;
+    if (m > 0.0) {
+        nd->cx = mx / m;
+        nd->cy = my / m;
+    } else {
+        /* Massless cell (masses may be 0): exerts no force anyway */
+        nd->cx = nd->x0 + 0.5 * nd->size;
+        nd->cy = nd->y0 + 0.5 * nd->size;
+    }
+}
+
+/* Build the subtree for sorted bodies [lo, hi) in the given cell */
+static int bh_build_node(bh_tree_t *t, int lo, int hi, int level,
+                         double x0, double y0, double size) {
+    /* Compress: skip levels where all bodies fall into one quadrant */
+    while (hi - lo > BH_LEAF && level < BH_DEPTH &&
+           bh_digit(t->key[lo], level) == bh_digit(t->key[hi - 1], level)) {
+        int d = bh_digit(t->key[lo], level);
+        size *= 0.5;
+        x0 += (d & 1) * size;
+        y0 += (d >> 1) * size;
+        level++;
+    }
+
+    int id = bh_alloc_node(t);
+    bh_node_t *nd = &t->nodes[id];
+    nd->x0 = x0; nd->y0 = y0; nd->size = size;
+    nd->first = lo; nd->count = hi - lo;
+    nd->child[0] = nd->child[1] = nd->child[2] = nd->child[3] = -1;
+
+    if (hi - lo > BH_LEAF && level < BH_DEPTH) {
+        double h = 0.5 * size;
+        int start = lo;
+        for (int d = 0; d < 4; d++) {
+            int end = (d == 3) ? hi : bh_lower_bound(t, start, hi, level, d + 1);
+            if (end > start) {
+                nd->child[d] = bh_build_node(t, start, end, level + 1,
+                                             x0 + (d & 1) * h, y0 + (d >> 1) * h, h);
+            }
+            start = end;
+        }
+    }
+    bh_moments(t, nd);
+    return id;
+}
+
+static void bh_top_task(long lo, long hi, int tid, void *arg) {
+    bh_build_job_t *job = (bh_build_job_t *)arg;
+    bh_tree_t *t = job->t;
+    const int shift = 2 * (BH_DEPTH - BH_PAR_LEVEL);
+    (void)tid;
+    for (long c = lo; c < hi; c++) {
+        /* Bodies whose key prefix is c: binary search on the sorted keys */
+        uint32_t kbeg = (uint32_t)c << shift;
+        int a = 0, b = t->n;
+        while (a < b) { int mid = a + (b - a) / 2; if (t->key[mid] < kbeg) a = mid + 1; else b = mid; }
+        int first = a;
+        b = t->n;
+        while (a < b) { int mid = a + (b - a) / 2; if ((t->key[mid] >> shift) <= (uint32_t)c) a = mid + 1; else b = mid; }
+        int last = a;
+
+        t->top_root[c] = -1;
+        if (last > first) {
+            /* De-interleave the prefix into the cell's corner */
+            double cs = t->size / (1 << BH_PAR_LEVEL);
+            int cx = 0, cy = 0;
+            for (int l = 0; l < BH_PAR_LEVEL; l++) {
+                cx |= (int)((c >> (2 * l)) & 1) << l;
+                cy |= (int)((c >> (2 * l + 1)) & 1) << l;
+            }
+            t->top_root[c] = bh_build_node(t, first, last, BH_PAR_LEVEL,
+                                           t->x0 + cx * cs, t->y0 + cy * cs, cs);
+        }
+    }
+}
+
+/* Link the levels above the parallel top cells (serial, <= 21 nodes) */
+static int bh_build_upper(bh_tree_t *t, int level, int prefix,
+                          double x0, double y0, double size) {
+    if (level == BH_PAR_LEVEL) return t->top_root[prefix];
+
+    int child[4], nonempty = 0, last = -1;
+    double h = 0.5 * size;
+    for (int d = 0; d < 4; d++) {
+        child[d] = bh_build_upper(t, level + 1, prefix * 4 + d,
+                                  x0 + (d & 1) * h, y0 + (d >> 1) * h, h);
+        if (child[d] >= 0) { nonempty++; last = child[d]; }
+    }
+    if (nonempty <= 1) return last;
+
+    int id = bh_alloc_node(t);
+    bh_node_t *nd = &t->nodes[id];
+    nd->x0 = x0; nd->y0 = y0; nd->size = size;
+    nd->first = 0; nd->count = 0;
+    int first = t->n, end = 0;
+    for (int d = 0; d < 4; d++) {
+        nd->child[d] = child[d];
+        if (child[d] < 0) continue;
+        const bh_node_t *ch = &t->nodes[child[d]];
+        if (ch->first < first) first = ch->first;
+        if (ch->first + ch->count > end) end = ch->first + ch->count;
+    }
+    nd->first = first;
+    nd->count = end - first;
+    bh_moments(t, nd);
+    return id;
+}
+
+/*
+ * Build the tree over n bodies. x/y/m point at the first body's fields and
+ * consecutive bodies are `stride` doubles apart. Returns 0, or -1 on OOM.
+ */
+static int bh_build(bh_tree_t *t, const double *x, const double *y, const double *m,
+                    size_t stride, int n, thread_pool_t *tp) {
+    if (bh_reserve(t, n) != 0) return -1;
+    t->n = n;
+    t->nnodes = 0;
+    t->root = -1;
+    if (n == 0) return 0;
+
+    int nt = tp_size(tp);
+    bh_build_job_t job_storage, *job = &job_storage;
+    job->t = t; job->x = x; job->y = y; job->m = m; job->stride = stride;
+    job->bounds = (double *)malloc(4 * (size_t)nt * sizeof(double));
+    if (!job->bounds) return -1;
+
+    for (int k = 0; k < nt; k++) {
+        job->bounds[4 * k + 0] = job->bounds[4 * k + 2] = HUGE_VAL;
+        job->bounds[4 * k + 1] = job->bounds[4 * k + 3] = -HUGE_VAL;
+    }
+    tp_parallel_for(tp, 0, n, 4096, bh_bounds_task, job);
+    double x0 = HUGE_VAL, x1 = -HUGE_VAL, y0 = HUGE_VAL, y1 = -HUGE_VAL;
+    for (int k = 0; k < nt; k++) {
+        const double *b = job->bounds + 4 * k;
+        if (b[0] < x0) x0 = b[0];
+        if (b[1] > x1) x1 = b[1];
+        if (b[2] < y0) y0 = b[2];
+        if (b[3] > y1) y1 = b[3];
+    }
+    double size = (x1 - x0 > y1 - y0) ? x1 - x0 : y1 - y0;
+    t->x0 = x0;
+    t->y0 = y0;
+    t->size = size > 0 ? size * (1.0 + 1e-9) : 1.0;
+
+    tp_parallel_for(tp, 0, n, 4096, bh_key_task, job);
+    bh_radix_sort(t);
+    tp_parallel_for(tp, 0, n, 4096, bh_gather_task, job);
+    tp_parallel_for(tp, 0, 1 << (2 * BH_PAR_LEVEL), 1, bh_top_task, job);
+    t->root = bh_build_upper(t, 0, 0, t->x0, t->y0, t->size);
+
+    free(job->bounds);
+    return 0;
+}
+
+/* sum_j m_j * d / max(|d|, 1)^3 at point (px, py); see top of file */
+static void bh_accel(const bh_tree_t *t, double px, double py, double theta,
+                     double *ax, double *ay) {
+    double sx = 0.0, sy = 0.0;
+    double th2 = theta * theta;
+    int stack[BH_STACK];
+    int sp = 0;
+    if (t->root >= 0) stack[sp++] = t->root;
+
+    while (sp > 0) {
+        const bh_node_t *nd = &t->nodes[stack[--sp]];
+        if (nd->child[0] < 0 && nd->child[1] < 0 && nd->child[2] < 0 && nd->child[3] < 0) {
+            for (int p = nd->first; p < nd->first + nd->count; p++) {
+                double dx = t->sx[p] - px, dy = t->sy[p] - py;
+                double r2 = dx * dx + dy * dy;
+                if (r2 < 1.0) r2 = 1.0;
+                double inv = 1.0 / sqrt(r2);
+                double w = t->sm[p] * inv * inv * inv;
+                sx += w * dx;
+                sy += w * dy;
+            }
+            continue;
+        }
+
+        double dx = nd->cx - px, dy = nd->cy - py;
+        double r2 = dx * dx + dy * dy;
+        int inside = px >= nd->x0 && px < nd->x0 + nd->size &&
+                     py >= nd->y0 && py < nd->y0 + nd->size;
+        /* Opening distance size/theta is measured from the cell centre and
+         * grown by the centre-of-mass offset, so lopsided cells open earlier */
+        double ox = nd->cx - (nd->x0 + 0.5 * nd->size);
+        double oy = nd->cy - (nd->y0 + 0.5 * nd->size);
+        double open = nd->size + theta * sqrt(ox * ox + oy * oy);
+        if (!inside && theta > 0.0 && open * open < th2 * r2) {
+            if (r2 < 1.0) r2 = 1.0;
+            double inv = 1.0 / sqrt(r2);
+            double w = nd->mass * inv * inv * inv;
+            sx += w * dx;
+            sy += w * dy;
+        } else {
+            for (int c = 0; c < 4; c++)
+                if (nd->child[c] >= 0) stack[sp++] = nd->child[c];
+        }
+    }
+    *ax = sx;
+    *ay = sy;
+}
+
+typedef struct {
+    const bh_tree_t *t;
+    const double *x, *y;
+    double theta;
+    double *ax, *ay;
+} bh_accel_job_t;
+
+static void bh_accel_task(long lo, long hi, int tid, void *arg) {
+    bh_accel_job_t *job = (bh_accel_job_t *)arg;
+    (void)tid;
+    for (long i = lo; i < hi; i++)
+        bh_accel(job->t, job->x[i], job->y[i], job->theta, &job->ax[i], &job->ay[i]);
+}
+
+/* bh_accel for n points (x[i], y[i]) into ax[i], ay[i], on the pool */
+static void bh_accel_all(const bh_tree_t *t, const double *x, const double *y, int n,
+                         double theta, double *ax, double *ay, thread_pool_t *tp) {
+    bh_accel_job_t job = { t, x, y, theta, ax, ay };
+    tp_parallel_for(tp, 0, n, 64, bh_accel_task, &job);
+}
+
+#endif /* BARNES_HUT_H */
@@ -0,0 +1,34 @@
+#ifndef CPU_KERNEL_H
+#define CPU_KERNEL_H
+
+/*
+ * Run-time choice between the SIMD variants of a kernel (gemm.h, nbody.h,
+ * rng.h, sha256.h). Each of those keeps a table of its kernels, widest
+ * first, whose entries start with `const char *name`, and a predicate that
+ * says whether this CPU can run the kernel of that name:
+ *
+ *   k = cpu_kernel_select(table, count, sizeof(table[0]), name, supported);
+ *
+ * name == NULL (or "auto") selects the first entry the CPU supports;
+ * otherwise the named kernel is returned if usable, else NULL.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+typedef int (*cpu_kernel_supported_fn)(const char *name);
+
+static inline const void *cpu_kernel_select(const void *table, int count, size_t size,
+                                            const char *name, cpu_kernel_supported_fn supported) {
+    int any = !name || strcmp(name, "auto") == 0;
+    for (int i = 0; i < count; i++) {
+        const void *k = (const char *)table + (size_t)i * size;
+        const char *k_name = *(const char *const *)k;
+        if (!any && strcmp(name, k_name) != 0) continue;
+        if (supported(k_name)) return k;
+        if (!any) return NULL;
+    }
+    return NULL;
+}
+
+#endif /* CPU_KERNEL_H */
@@ -1,16 +1,42 @@
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <string.h>
 #include <unistd.h>
 
-// Complexity simulator: Increase this to make the CPU work harder per hash
-#define DIFFICULTY_LOOP 500 
+#include "sha256.h"
+#include "nonce_ledger.h"
+
+// Real proof of work: every "hash" is a SHA-256d of an 80-byte block
+// header (the genesis block template in sha256.h) with one nonce, and a
+// Gold Nugget is a hash below the difficulty target: its top --difficulty
+// bits are zero (default 10, about 1 in 1000 as before). The hashing runs
+// 16 (AVX-512) or 8 (AVX2) nonces at a time, see sha256.h; --kernel
+// avx512|avx2|scalar forces one.
+//
+// --ledger FILE (run_miner.sh uses /cluster/nonce_ledger.txt) gives chunk C
+// its own range of nonces in a shared ledger and records every rank's
+// progress there about once a second (see nonce_ledger.h), so a chunk
+// that run_miner.sh retries after a timeout only hashes the part that was
+// not committed. Without a ledger chunk C searches C * 2^32 + [0,
+// iterations). Either way ranks split the work evenly, chunks never
+// overlap, and a retried chunk finds exactly the same gold.
+//
+// --first stops the whole chunk at the first Gold Nugget, like a real
+// block search: the finder raises a flag that the other ranks poll every
+// few thousand hashes (see search_stop.h). CHUNK_RESULT then also carries
+// the winning nonce and the seconds to find it (nonce=none if the chunk
+// has no winner); iters and found only count what was hashed.
+// Usage: crypto_miner [iterations] [--chunk-id C] [--ledger FILE]
+//                     [--difficulty BITS] [--kernel K] [--first]
 
 int main(int argc, char *argv[]) {
     int rank, size;
-    long long total_iters, my_iters, i;
+    long long total_iters, my_iters;
     long long local_found = 0, global_found = 0;
+    long chunk = 0;
+    int difficulty = 10, first_only = 0;
+    const char *kernel_name = NULL, *ledger_path = NULL;
     char hostname[MPI_MAX_PROCESSOR_NAME];
     int len;
 
@@ -20,48 +46,88 @@ int main(int argc, char *argv[]) {
     MPI_Get_processor_name(hostname, &len);
 
     // 1. Read Workload Size from Script
-    if (argc > 1) {
-        total_iters = atoll(argv[1]);
-    } else {
-        total_iters = 1000000;
+    total_iters = 1000000;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--chunk-id") == 0 && a + 1 < argc) chunk = atol(argv[++a]);
+        else if (strcmp(argv[a], "--difficulty") == 0 && a + 1 < argc) difficulty = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--kernel") == 0 && a + 1 < argc) kernel_name = argv[++a];
+        else if (strcmp(argv[a], "--ledger") == 0 && a + 1 < argc) ledger_path = argv[++a];
+        else if (strcmp(argv[a], "--first") == 0) first_only = 1;
+        else total_iters = atoll(argv[a]);
+    }
+    const sha256_kernel_t *kernel = sha256_select_kernel(kernel_name);
+    if (!kernel || difficulty < 0 || difficulty > 64 || total_iters < 0 || chunk < 0) {
+        if (rank == 0) fprintf(stderr, "Bad --kernel, --difficulty (0..64), --chunk-id or iterations\n");
+        MPI_Finalize();
+        return 1;
     }
 
-    // Distribute work
-    my_iters = total_iters / size;
-    
-    // Seed random based on rank so every node calculates different numbers
-    srand(rank + total_iters); 
+    // Distribute work: this rank's share of the chunk's nonces not yet
+    // committed by an earlier attempt
+    ledger_t ledger;
+    if (ledger_open(&ledger, ledger_path, chunk, (uint64_t)total_iters, MPI_COMM_WORLD) != 0 && rank == 0)
+        fprintf(stderr, "Chunk %ld is in the ledger with %llu hashes; using that\n", chunk,
+                (unsigned long long)ledger.count);
+    total_iters = (long long)ledger.count;
+    ledger_range_t *mine = (ledger_range_t *)malloc((ledger.nopen + 1) * sizeof(ledger_range_t));
+    int nmine = ledger_share(&ledger, rank, size, mine);
+    if (first_only && ledger.salvaged_found > 0) nmine = 0;   // solved by an earlier attempt
 
-    // 2. The Heavy Lifting (Mining Loop)
-    for (i = 0; i < my_iters; i++) {
-        // Simulate Hashing: Complex math operations
-        double val = (double)i;
-        for (int k = 0; k < DIFFICULTY_LOOP; k++) {
-            val = sin(val) * cos(val) + tan(sqrt(fabs(val)));
-        }
+    unsigned char header[80];
+    sha256_job_t job;
+    sha256_demo_header(header);
+    sha256_job_init(&job, header);
 
-        // 3. Check if we found a "Rare Block" (Gold Nugget)
-        // We look for a specific decimal pattern. Probability approx 1 in 1000
-        double decimal = val - floor(val);
-        if (decimal > 0.9990) {
-            local_found++;
-        }
-    }
+    // 2. The Heavy Lifting (Mining Loop)
+    uint64_t winner, hashed, solution = UINT64_MAX;
+    double solve_seconds = 0.0, stop_lag = 0.0;
+    search_stop_t stop;
+    if (first_only) search_stop_open(&stop, MPI_COMM_WORLD);
+    double t0 = MPI_Wtime();
+    local_found = (long long)ledger_mine(&ledger, mine, nmine, kernel, &job, difficulty,
+                                         first_only ? &stop : NULL, &hashed, &winner);
+    double seconds = MPI_Wtime() - t0;
+    my_iters = (long long)hashed;
+    if (first_only) search_stop_close(&stop, &solution, &solve_seconds, &stop_lag);
 
-    // 4. Print Node Status (For the script to grep)
+    // 3. Print Node Status (For the script to grep)
     // The script looks for lines starting with "[Node:"
-    printf("[Node: %s] Rank %d mined %lld hashes | Found %lld Gold Nuggets\n", 
-           hostname, rank, my_iters, local_found);
+    printf("[Node: %s] Rank %d mined %lld hashes | Found %lld Gold Nuggets | %.2f MH/s (%s)\n",
+           hostname, rank, my_iters, local_found, seconds > 0 ? my_iters / seconds / 1e6 : 0.0,
+           kernel->name);
+    fflush(stdout);
+    sha256_report_rate(MPI_COMM_WORLD, hostname, rank, (uint64_t)my_iters, seconds);
 
-    // 5. Aggregate Results
+    // 4. Aggregate Results
     MPI_Reduce(&local_found, &global_found, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (first_only) {
+        long long hashed_total = 0;
+        MPI_Reduce(&my_iters, &hashed_total, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        total_iters = hashed_total + (long long)ledger.salvaged;
+    }
 
-    // 6. Print Final Chunk Result (For the script to parse)
+    // 5. Print Final Chunk Result (For the script to parse)
     if (rank == 0) {
+        if (ledger.salvaged > 0)
+            printf("Salvaged %llu hashes (%llu Gold Nuggets) committed by earlier attempts\n",
+                   (unsigned long long)ledger.salvaged, (unsigned long long)ledger.salvaged_found);
+        global_found += (long long)ledger.salvaged_found;
         // Format matches script regex: "found" maps to the script's "inside" logic
-        printf("CHUNK_RESULT: iters=%lld found=%lld\n", total_iters, global_found);
+        if (!first_only) {
+            printf("CHUNK_RESULT: iters=%lld found=%lld\n", total_iters, global_found);
+        } else {
+            if (ledger.salvaged_found > 0 && ledger.salvaged_first < solution) solution = ledger.salvaged_first;
+            if (solution != UINT64_MAX)
+                printf("Solved: nonce %llu after %.6f s; all ranks stopped %.3f ms later\n",
+                       (unsigned long long)solution, solve_seconds, stop_lag * 1e3);
+            printf("CHUNK_RESULT: iters=%lld found=%lld nonce=", total_iters, global_found);
+            if (solution != UINT64_MAX) printf("%llu seconds=%.6f\n", (unsigned long long)solution, solve_seconds);
+            else printf("none seconds=%.6f\n", seconds);
+        }
     }
 
+    ledger_close(&ledger);
+    free(mine);
     MPI_Finalize();
     return 0;
 }
@@ -0,0 +1,196 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+/*
+ * Space-filling-curve domain decomposition for the galaxy programs.
+ * Include mpi.h before this header.
+ *
+ *   domain_rebalance(&local, cost, comm);   // cost[i] per local star, or NULL
+ *
+ * The stars are ordered along a Hilbert curve over the global bounding
+ * square, and the curve is cut into one contiguous piece per rank so that
+ * every piece carries the same total cost (not the same number of stars).
+ * Stars then migrate to their new owner with one Alltoallv, and each rank
+ * stores its stars in curve order: a rank owns a compact patch of the sky,
+ * and stars that are close in space are close in memory.
+ *
+ * The cut points are found to key resolution by a parallel binary search
+ * over the key range (33 rounds of one Allreduce of size - 1 partial sums),
+ * so no rank ever holds more than its own stars.
+ *
+ * Costs are whatever the caller measured; if any rank passes NULL or has
+ * zero total cost, every star counts as one unit (a plain count split).
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nbody.h"
+
+#define DOMAIN_BITS 16   /* key resolution per axis: 2^16 x 2^16 cells */
+
+typedef struct {
+    uint32_t key;
+    int idx;
+} domain_item_t;
+
+/* Index of cell (x, y) along the Hilbert curve through the 2^16 x 2^16 grid */
+static uint32_t domain_hilbert(uint32_t x, uint32_t y) {
+    const uint32_t n = 1u << DOMAIN_BITS;
+    uint32_t d = 0;
+    for (uint32_t s = n >> 1; s > 0; s >>= 1) {
+        uint32_t rx = (x & s) != 0, ry = (y & s) != 0;
+        d += s * s * ((3 * rx) ^ ry);
+        /* Rotate the quadrant so the sub-curve starts and ends where the parent's does */
+        if (ry == 0) {
+            if (rx == 1) { x = n - 1 - x; y = n - 1 - y; }
+            uint32_t t = x; x = y; y = t;
+        }
+    }
+    return d;
+}
+
+static int domain_item_cmp(const void *a, const void *b) {
+    const domain_item_t *p = (const domain_item_t *)a, *q = (const domain_item_t *)b;
+    if (p->key != q->key) return p->key < q->key ? -1 : 1;
+    return (p->idx > q->idx) - (p->idx < q->idx);
+}
+
+/* Curve keys of n points (x[i * stride], y[i * stride]) in the square
+ * [x0, x0 + side) x [y0, y0 + side), sorted by key */
+static void domain_sort(const double *x, const double *y, int stride, int n,
+                        double x0, double y0, double side, domain_item_t *items) {
+    const double cells = (double)(1u << DOMAIN_BITS);
+    double scale = cells / side;
+    for (int i = 0; i < n; i++) {
+        double fx = (x[(size_t)i * stride] - x0) * scale;
+        double fy = (y[(size_t)i * stride] - y0) * scale;
+        uint32_t qx = fx <= 0.0 ? 0 : fx >= cells - 1 ? (uint32_t)cells - 1 : (uint32_t)fx;
+        uint32_t qy = fy <= 0.0 ? 0 : fy >= cells - 1 ? (uint32_t)cells - 1 : (uint32_t)fy;
+        items[i].key = domain_hilbert(qx, qy);
+        items[i].idx = i;
+    }
+    qsort(items, n, sizeof(domain_item_t), domain_item_cmp);
+}
+
+/* Collective. Replaces *s with this rank's cost-balanced piece of the
+ * curve, in curve order. Returns 0, or -1 on allocation failure (other
+ * ranks may then be waiting in the exchange: the caller should abort). */
+static int domain_rebalance(stars_t *s, const double *cost, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int n = s->n;
+
+    /* Global bounding square: min x, min y, -max x, -max y */
+    double box[4] = { HUGE_VAL, HUGE_VAL, HUGE_VAL, HUGE_VAL };
+    for (int i = 0; i < n; i++) {
+        if (s->x[i] < box[0]) box[0] = s->x[i];
+        if (s->y[i] < box[1]) box[1] = s->y[i];
+        if (-s->x[i] < box[2]) box[2] = -s->x[i];
+        if (-s->y[i] < box[3]) box[3] = -s->y[i];
+    }
+    MPI_Allreduce(MPI_IN_PLACE, box, 4, MPI_DOUBLE, MPI_MIN, comm);
+    double side = fmax(-box[2] - box[0], -box[3] - box[1]);
+    if (!(side > 0.0) || !isfinite(side)) side = 1.0;
+    side *= 1.0 + 1e-9;   /* keep the largest coordinate inside the last cell */
+
+    domain_item_t *items = (domain_item_t *)malloc((n + 1) * sizeof(domain_item_t));
+    double *prefix = (double *)malloc((n + 1) * sizeof(double));
+    uint64_t *lo = (uint64_t *)malloc(2 * (size_t)size * sizeof(uint64_t));
+    double *part = (double *)malloc((size_t)size * sizeof(double));
+    int *counts = (int *)malloc(4 * (size_t)size * sizeof(int));
+    if (!items || !prefix || !lo || !part || !counts) goto fail;
+    uint64_t *hi = lo + size;
+    int *sdispls = counts + size, *rcounts = counts + 2 * size, *rdispls = counts + 3 * size;
+
+    domain_sort(s->x, s->y, 1, n, box[0], box[1], side, items);
+
+    /* Use the measured costs only if every rank has some */
+    double measured = 0.0;
+    if (cost)
+        for (int i = 0; i < n; i++) measured += cost[i];
+    int use_cost = cost != NULL && (n == 0 || measured > 0.0);
+    MPI_Allreduce(MPI_IN_PLACE, &use_cost, 1, MPI_INT, MPI_LAND, comm);
+
+    /* prefix[k] = cost of my first k stars along the curve */
+    prefix[0] = 0.0;
+    for (int k = 0; k < n; k++)
+        prefix[k + 1] = prefix[k] + (use_cost ? cost[items[k].idx] : 1.0);
+    double total = prefix[n];
+    MPI_Allreduce(MPI_IN_PLACE, &total, 1, MPI_DOUBLE, MPI_SUM, comm);
+
+    /* Cut p (between ranks p and p + 1) is the smallest key whose global
+     * cost below it reaches (p + 1) / size of the total */
+    for (int p = 0; p < size - 1; p++) { lo[p] = 0; hi[p] = (uint64_t)1 << (2 * DOMAIN_BITS); }
+    for (int round = 0; round <= 2 * DOMAIN_BITS; round++) {
+        for (int p = 0; p < size - 1; p++) {
+            uint64_t mid = lo[p] + (hi[p] - lo[p]) / 2;
+            int a = 0, b = n;
+            while (a < b) { int m = a + (b - a) / 2; if (items[m].key < mid) a = m + 1; else b = m; }
+            part[p] = prefix[a];
+        }
+        if (size > 1)
+            MPI_Allreduce(MPI_IN_PLACE, part, size - 1, MPI_DOUBLE, MPI_SUM, comm);
+        for (int p = 0; p < size - 1; p++) {
+            if (lo[p] >= hi[p]) continue;
+            uint64_t mid = lo[p] + (hi[p] - lo[p]) / 2;
+            if (part[p] >= total * (p + 1) / size) hi[p] = mid; else lo[p] = mid + 1;
+        }
+    }
+
+    /* My stars are sorted, so each destination gets one contiguous run */
+    memset(counts, 0, (size_t)size * sizeof(int));
+    for (int k = 0, dest = 0; k < n; k++) {
+        while (dest < size - 1 && items[k].key >= lo[dest]) dest++;
+        counts[dest]++;
+    }
+    MPI_Alltoall(counts, 1, MPI_INT, rcounts, 1, MPI_INT, comm);
+    int m = 0;
+    for (int p = 0; p < size; p++) {
+        sdispls[p] = p == 0 ? 0 : sdispls[p - 1] + counts[p - 1];
+        rdispls[p] = m;
+        m += rcounts[p];
+    }
+
+    /* Records of 5 doubles: x, y, mass, vx, vy */
+    double *sendbuf = (double *)malloc((5 * (size_t)n + 1) * sizeof(double));
+    double *recvbuf = (double *)malloc((5 * (size_t)m + 1) * sizeof(double));
+    domain_item_t *order = (domain_item_t *)malloc((m + 1) * sizeof(domain_item_t));
+    stars_t ns;
+    if (!sendbuf || !recvbuf || !order || stars_alloc(&ns, m) != 0) {
+        free(sendbuf); free(recvbuf); free(order);
+        goto fail;
+    }
+    for (int k = 0; k < n; k++) {
+        int i = items[k].idx;
+        double *r = sendbuf + 5 * (size_t)k;
+        r[0] = s->x[i]; r[1] = s->y[i]; r[2] = s->mass[i]; r[3] = s->vx[i]; r[4] = s->vy[i];
+    }
+    for (int p = 0; p < size; p++) {
+        counts[p] *= 5; sdispls[p] *= 5; rcounts[p] *= 5; rdispls[p] *= 5;
+    }
+    MPI_Alltoallv(sendbuf, counts, sdispls, MPI_DOUBLE,
+                  recvbuf, rcounts, rdispls, MPI_DOUBLE, comm);
+
+    /* Runs from different senders interleave along my piece: sort again */
+    domain_sort(recvbuf, recvbuf + 1, 5, m, box[0], box[1], side, order);
+    for (int k = 0; k < m; k++) {
+        const double *r = recvbuf + 5 * (size_t)order[k].idx;
+        ns.x[k] = r[0]; ns.y[k] = r[1]; ns.mass[k] = r[2]; ns.vx[k] = r[3]; ns.vy[k] = r[4];
+    }
+    stars_free(s);
+    *s = ns;
+
+    free(sendbuf); free(recvbuf); free(order);
+    free(items); free(prefix); free(lo); free(part); free(counts);
+    return 0;
+
+fail:
+    free(items); free(prefix); free(lo); free(part); free(counts);
+    return -1;
+}
+
+#endif /* DOMAIN_H */
@@ -1,116 +1,407 @@
 #include <mpi.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "task_journal.h"
+
 #define TOTAL_TASKS 50
-#define LOG_FILE "/cluster/task_log.txt"
-
-// Function to check if a task is already done
-int is_task_done(int task_id) {
-    if (access(LOG_FILE, F_OK) == -1) return 0;
-    
-    FILE *fp = fopen(LOG_FILE, "r");
-    int completed_id;
-    while (fscanf(fp, "%d", &completed_id) != EOF) {
-        if (completed_id == task_id) {
-            fclose(fp);
-            return 1;
+#define JOURNAL_FILE "/cluster/task_journal.bin"
+#define PREFETCH 4             // tasks queued per worker on its node
+#define DONE_RING 64           // finished task ids a worker can park for its sub-manager
+#define IDLE_US 50             // back-off while there is nothing to take
+#define SERVICE_US 1000        // sub-manager's own work between two rounds of chores
+
+#define TAG_TASKS 0            // manager -> sub-manager: [n, task ids...], n = -1: no more work
+#define TAG_REPORT 1           // sub-manager -> manager: [final, want, ndone, task ids...]
+
+// Finished tasks are kept in a bitmap on the manager and appended to a
+// binary journal (see task_journal.h) that is replayed once at startup, so
+// a restarted job skips them: restart is O(tasks) and each assignment is
+// O(1) instead of re-reading a text log from NFS for every task.
+//
+// TWO LEVELS: rank 0 only talks to one sub-manager per node (the lowest
+// worker rank there, split with MPI_Comm_split_type), so global traffic
+// grows with nodes, not ranks. A sub-manager keeps a queue of up to
+// K = --prefetch tasks per worker of its node in an MPI shared-memory
+// window. When the queue is down to half it reports the tasks its node
+// finished and asks rank 0 for a refill, and the node keeps working while
+// the answer is on its way. The node's ranks take tasks from the window
+// with atomic tickets and park finished ids in per-worker rings there, so
+// within a node nothing goes through the network stack. The sub-manager
+// takes tasks too, but runs them in slices of SERVICE_US with its chores
+// in between, so a long task never holds up the node's refills. Rank 0 keeps one
+// persistent receive and one persistent send per node and serves
+// whichever report arrives first with MPI_Waitany; it prints progress at
+// most once a second and the journal batches its writes.
+//
+// Usage: dynamic_manager [tasks] [--journal FILE] [--work-us US] [--prefetch K]
+// --work-us is the simulated work per task (default 1000000, 1 s). The
+// manager exits nonzero if any task went unreported. Stress test for the
+// queue (short tasks, many refills), which must report all 100000:
+//   mpirun -np 3 ./dynamic_manager 100000 --work-us 0 --prefetch 1 --journal j.bin
+
+// Node queue: int64_t words in a window on the sub-manager (node rank 0).
+// slot[i % cap] holds task id + 1 (0 = empty); ticket t may take a task
+// from slot t % cap once FILLED > t. Ring r holds worker r's finished ids
+// + 1 (0 = empty). Every access is an MPI atomic (Fetch_and_op).
+enum { Q_CLAIMED, Q_FILLED, Q_END, Q_FINISHED, Q_SLOTS };
+
+static int64_t q_op(MPI_Win q, int64_t value, MPI_Op op, int64_t index) {
+    int64_t old;
+    MPI_Fetch_and_op(&value, &old, MPI_INT64_T, 0, index, op, q);
+    MPI_Win_flush(0, q);
+    return old;
+}
+
+static int64_t q_read(MPI_Win q, int64_t index) {
+    return q_op(q, 0, MPI_NO_OP, index);
+}
+
+// Take the task for `ticket` if it is there: its id, or -1
+static int64_t q_take(MPI_Win q, int cap, int64_t ticket) {
+    if (q_read(q, Q_FILLED) <= ticket) return -1;
+    int64_t v = q_op(q, 0, MPI_REPLACE, Q_SLOTS + ticket % cap);
+    return v - 1;
+}
+
+// The ticket will never be served: the queue has ended before it
+static int q_past_end(MPI_Win q, int64_t ticket) {
+    return q_read(q, Q_END) && ticket >= q_read(q, Q_FILLED);
+}
+
+// Next tasks for a node that wants `want`: batch = [n, ids...]
+static void fill_batch(journal_t *journal, long *task_iterator, int want, int *batch) {
+    int n = 0;
+    while (n < want && (*task_iterator = journal_next(journal, *task_iterator)) < journal->ntasks) {
+        batch[1 + n++] = (int)(*task_iterator)++;
+    }
+    batch[0] = n > 0 || want == 0 ? n : -1;
+}
+
+// Returns 0, or 1 if some task was not reported done
+static int manager(int nodes, const int *leaders, int cap, long total_tasks, const char *journal_path) {
+    printf("\n=== DYNAMIC WORKLOAD MANAGER ===\n");
+    printf("Checking logs for previous progress...\n");
+    journal_t journal;
+    long already = journal_open(&journal, journal_path, total_tasks);
+    if (already < 0) {
+        fprintf(stderr, "Manager: out of memory for the journal of %ld tasks\n", total_tasks);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    printf("%ld of %ld tasks already done, %d node(s)\n", already, total_tasks, nodes);
+
+    int active_nodes = nodes;
+    int report_len = cap + 3, batch_len = cap + 1;
+    int *reports = (int *)malloc((size_t)nodes * report_len * sizeof(int));
+    int *batches = (int *)malloc((size_t)nodes * batch_len * sizeof(int));
+    MPI_Request *recv_req = (MPI_Request *)malloc(nodes * sizeof(MPI_Request));
+    MPI_Request *send_req = (MPI_Request *)malloc(nodes * sizeof(MPI_Request));
+    int *sent = (int *)calloc(nodes, sizeof(int));
+    if (!reports || !batches || !recv_req || !send_req || !sent) {
+        fprintf(stderr, "Manager: out of memory\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    long task_iterator = 0;
+    double t0 = MPI_Wtime(), last_print = t0;
+
+    for (int n = 0; n < nodes; n++) {
+        MPI_Recv_init(reports + n * report_len, report_len, MPI_INT, leaders[n], TAG_REPORT, MPI_COMM_WORLD,
+                      &recv_req[n]);
+        MPI_Send_init(batches + n * batch_len, batch_len, MPI_INT, leaders[n], TAG_TASKS, MPI_COMM_WORLD,
+                      &send_req[n]);
+    }
+    // 1. Initial Work goes out as the answer to each node's first report,
+    //    which asks for a full queue
+    MPI_Startall(nodes, recv_req);
+
+    // 2. Dynamic Loop (Receive Report -> Send Refill)
+    while (active_nodes > 0) {
+        int n;
+        MPI_Waitany(nodes, recv_req, &n, MPI_STATUS_IGNORE);
+        int *report = reports + n * report_len;
+
+        for (int i = 0; i < report[2]; i++) journal_mark(&journal, report[3 + i]);
+        if (MPI_Wtime() - last_print >= 1.0) {
+            last_print = MPI_Wtime();
+            printf("[MANAGER] %ld/%ld tasks done (%.0f tasks/s)\n", journal.ndone, total_tasks,
+                   (journal.ndone - already) / (last_print - t0));
+        }
+
+        if (report[0]) {
+            // Final report: the node has run out of work
+            active_nodes--;
+            continue;
         }
+        if (sent[n]) MPI_Wait(&send_req[n], MPI_STATUS_IGNORE);   // its last batch has left
+        sent[n] = 1;
+        fill_batch(&journal, &task_iterator, report[1], batches + n * batch_len);
+        MPI_Start(&send_req[n]);
+        MPI_Start(&recv_req[n]);
+    }
+
+    for (int n = 0; n < nodes; n++) {
+        if (sent[n]) MPI_Wait(&send_req[n], MPI_STATUS_IGNORE);
+        MPI_Request_free(&recv_req[n]);
+        MPI_Request_free(&send_req[n]);
     }
-    fclose(fp);
-    return 0;
+    int lost = journal.ndone != total_tasks;
+    if (lost)
+        fprintf(stderr, "Manager: only %ld of %ld tasks were reported done\n", journal.ndone, total_tasks);
+    else
+        printf("=== ALL TASKS COMPLETED === (%ld run in %.2f s)\n", journal.ndone - already, MPI_Wtime() - t0);
+    journal_close(&journal);
+    free(reports);
+    free(batches);
+    free(recv_req);
+    free(send_req);
+    free(sent);
+    return lost;
 }
 
-// Function to mark task as done
-void mark_task_done(int task_id) {
-    FILE *fp = fopen(LOG_FILE, "a");
-    fprintf(fp, "%d\n", task_id);
-    fclose(fp);
+// A node rank other than the sub-manager: take, work, park the id
+static void worker(MPI_Win q, int cap, int node_rank, long work_us) {
+    int64_t ring = Q_SLOTS + cap + (int64_t)node_rank * DONE_RING, ndone = 0;
+    while (1) {
+        int64_t ticket = q_op(q, 1, MPI_SUM, Q_CLAIMED), task_id;
+        while ((task_id = q_take(q, cap, ticket)) < 0) {
+            if (q_past_end(q, ticket)) {
+                q_op(q, 1, MPI_SUM, Q_FINISHED);
+                return;
+            }
+            usleep(IDLE_US);
+        }
+
+        // Simulate Heavy Work
+        usleep(work_us);
+
+        // Return Task ID as proof of work
+        while (q_read(q, ring + ndone % DONE_RING) != 0) usleep(IDLE_US);
+        q_op(q, task_id + 1, MPI_REPLACE, ring + ndone % DONE_RING);
+        ndone++;
+    }
 }
 
-int main(int argc, char *argv[]) {
-    int rank, size;
-    MPI_Init(&argc, &argv);
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
+// Node rank 0: feeds the node queue from rank 0, forwards finished ids,
+// and works on the queue itself in between
+typedef struct {
+    MPI_Win q;
+    int cap, node_size, report_len, batch_len;
+    int *report, *batch;
+    MPI_Request reply, send;
+    int waiting, got_end, end_set;
+    int *unplaced, nunplaced, unplaced_head;  // received, not yet in a slot
+    int64_t filled;
+    int64_t *cursor;                          // next ring entry per worker
+    int *pending, npending, pending_cap;      // finished, not yet reported
+    long received;
+} SubManager;
 
-    // --- MASTER (MANAGER) ---
-    if (rank == 0) {
-        printf("\n=== DYNAMIC WORKLOAD MANAGER ===\n");
-        printf("Checking logs for previous progress...\n");
-
-        int tasks_assigned = 0;
-        int active_workers = size - 1;
-        int *worker_status = (int *)calloc(size, sizeof(int)); // 0=Idle, 1=Busy
-        int task_iterator = 0;
-
-        // 1. Assign Initial Work
-        for (int i = 1; i < size; i++) {
-            // Find next incomplete task
-            while (task_iterator < TOTAL_TASKS && is_task_done(task_iterator)) {
-                task_iterator++;
-            }
+static void sub_pending(SubManager *s, int task_id) {
+    if (s->npending == s->pending_cap) {
+        s->pending_cap *= 2;
+        s->pending = (int *)realloc(s->pending, s->pending_cap * sizeof(int));
+    }
+    s->pending[s->npending++] = task_id;
+}
 
-            if (task_iterator < TOTAL_TASKS) {
-                MPI_Send(&task_iterator, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
-                printf("[MANAGER] Assigned Task %d to Worker %d\n", task_iterator, i);
-                worker_status[i] = 1;
-                task_iterator++;
-            } else {
-                // No work left, send kill signal
-                int kill = -1;
-                MPI_Send(&kill, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
-                active_workers--;
-            }
+// Send up to cap finished ids to rank 0 (and ask for `want` more)
+static void sub_report(SubManager *s, int final, int want) {
+    int n = s->npending < s->cap ? s->npending : s->cap;
+    MPI_Wait(&s->send, MPI_STATUS_IGNORE);
+    s->report[0] = final;
+    s->report[1] = want;
+    s->report[2] = n;
+    memcpy(s->report + 3, s->pending + s->npending - n, n * sizeof(int));
+    s->npending -= n;
+    MPI_Start(&s->send);
+    if (!final) {
+        MPI_Start(&s->reply);
+        s->waiting = 1;
+    }
+}
+
+// One round of chores; cheap when there is nothing to do
+static void sub_service(SubManager *s) {
+    // Collect finished ids from the workers' rings
+    for (int r = 1; r < s->node_size; r++) {
+        int64_t v, ring = Q_SLOTS + s->cap + (int64_t)r * DONE_RING;
+        while ((v = q_op(s->q, 0, MPI_REPLACE, ring + s->cursor[r] % DONE_RING)) != 0) {
+            sub_pending(s, (int)(v - 1));
+            s->cursor[r]++;
         }
+    }
 
-        // 2. Dynamic Loop (Receive Result -> Send New Task)
-        while (active_workers > 0) {
-            int done_task;
-            MPI_Status status;
-            
-            // Wait for ANY worker to finish
-            MPI_Recv(&done_task, 1, MPI_INT, MPI_ANY_SOURCE, 0, MPI_COMM_WORLD, &status);
-            
-            int source = status.MPI_SOURCE;
-            printf("   -> [SUCCESS] Worker %d finished Task %d\n", source, done_task);
-            mark_task_done(done_task);
-
-            // Find next incomplete task
-            while (task_iterator < TOTAL_TASKS && is_task_done(task_iterator)) {
-                task_iterator++;
-            }
+    if (s->waiting) {
+        int arrived;
+        MPI_Test(&s->reply, &arrived, MPI_STATUS_IGNORE);
+        if (arrived) {
+            s->waiting = 0;
+            if (s->batch[0] < 0) s->got_end = 1;      // Kill signal
+            for (int i = 0; i < s->batch[0]; i++)
+                s->unplaced[(s->unplaced_head + s->nunplaced++) % s->cap] = s->batch[1 + i];
+            s->received += s->batch[0] > 0 ? s->batch[0] : 0;
+        }
+    }
 
-            if (task_iterator < TOTAL_TASKS) {
-                MPI_Send(&task_iterator, 1, MPI_INT, source, 0, MPI_COMM_WORLD);
-                printf("[MANAGER] Re-Assigned Task %d to Worker %d\n", task_iterator, source);
-                task_iterator++;
-            } else {
-                // No more work
-                int kill = -1;
-                MPI_Send(&kill, 1, MPI_INT, source, 0, MPI_COMM_WORLD);
-                active_workers--;
+    // Fill free slots in ticket order, then publish them
+    int64_t filled = s->filled;
+    while (s->nunplaced > 0 && q_read(s->q, Q_SLOTS + filled % s->cap) == 0) {
+        q_op(s->q, s->unplaced[s->unplaced_head] + 1, MPI_REPLACE, Q_SLOTS + filled % s->cap);
+        s->unplaced_head = (s->unplaced_head + 1) % s->cap;
+        s->nunplaced--;
+        filled++;
+    }
+    if (filled != s->filled) q_op(s->q, s->filled = filled, MPI_REPLACE, Q_FILLED);
+    if (s->got_end && s->nunplaced == 0 && !s->end_set) {
+        q_op(s->q, 1, MPI_REPLACE, Q_END);
+        s->end_set = 1;
+    }
+
+    // Low-water mark (or a full report's worth of finished ids): report.
+    // Tickets claimed ahead of the fill are not room: a refill has to fit
+    // in unplaced[] next to what is already there, so ask for at most
+    // cap - nunplaced - tasks still sitting in slots.
+    int64_t queued = s->filled - q_read(s->q, Q_CLAIMED);
+    int64_t avail = (queued > 0 ? queued : 0) + s->nunplaced;
+    if (!s->waiting && !s->got_end && (avail <= s->cap / 2 || s->npending >= s->cap))
+        sub_report(s, 0, s->cap - (int)avail);
+}
+
+static void sub_manager(MPI_Win q, int cap, int node_size, int cap_max, long work_us, const char *hostname,
+                        int rank) {
+    SubManager s;
+    memset(&s, 0, sizeof(s));
+    s.q = q;
+    s.cap = cap;
+    s.node_size = node_size;
+    s.report_len = cap_max + 3;
+    s.batch_len = cap_max + 1;
+    s.report = (int *)malloc(s.report_len * sizeof(int));
+    s.batch = (int *)malloc(s.batch_len * sizeof(int));
+    s.unplaced = (int *)malloc(cap * sizeof(int));
+    s.cursor = (int64_t *)calloc(node_size, sizeof(int64_t));
+    s.pending_cap = 2 * cap;
+    s.pending = (int *)malloc(s.pending_cap * sizeof(int));
+    MPI_Recv_init(s.batch, s.batch_len, MPI_INT, 0, TAG_TASKS, MPI_COMM_WORLD, &s.reply);
+    MPI_Send_init(s.report, s.report_len, MPI_INT, 0, TAG_REPORT, MPI_COMM_WORLD, &s.send);
+    sub_report(&s, 0, cap);                              // ask for a full queue
+
+    long mine = 0;
+    int64_t ticket = -1, task_id;
+    while (1) {
+        sub_service(&s);
+        if (ticket < 0) ticket = q_op(q, 1, MPI_SUM, Q_CLAIMED);
+        if ((task_id = q_take(q, cap, ticket)) >= 0) {
+            // Simulate Heavy Work, serving the node between slices
+            for (long left = work_us; left > 0; left -= SERVICE_US) {
+                usleep(left < SERVICE_US ? left : SERVICE_US);
+                sub_service(&s);
             }
+            sub_pending(&s, (int)task_id);
+            mine++;
+            ticket = -1;
+        } else if (s.end_set && q_past_end(q, ticket)) {
+            break;
+        } else {
+            usleep(IDLE_US);
         }
-        printf("=== ALL TASKS COMPLETED ===\n");
-    } 
-    
-    // --- WORKER ---
+    }
+
+    // Wait for the node's workers, then hand in the last finished ids
+    while (q_read(q, Q_FINISHED) < node_size - 1) {
+        sub_service(&s);
+        usleep(IDLE_US);
+    }
+    sub_service(&s);
+    while (s.npending > cap) {
+        sub_report(&s, 0, 0);
+        MPI_Wait(&s.reply, MPI_STATUS_IGNORE);
+        s.waiting = 0;
+    }
+    sub_report(&s, 1, 0);
+    MPI_Wait(&s.send, MPI_STATUS_IGNORE);
+    printf("[Node: %s] Sub-manager rank %d: %d rank(s) ran %ld task(s), %ld here\n", hostname, rank,
+           node_size, s.received, mine);
+
+    MPI_Request_free(&s.reply);
+    MPI_Request_free(&s.send);
+    free(s.report);
+    free(s.batch);
+    free(s.unplaced);
+    free(s.cursor);
+    free(s.pending);
+}
+
+int main(int argc, char *argv[]) {
+    int rank, size, rc = 0;
+    long total_tasks = TOTAL_TASKS;
+    long work_us = 1000000;
+    int prefetch = PREFETCH;
+    const char *journal_path = JOURNAL_FILE;
+    char hostname[MPI_MAX_PROCESSOR_NAME];
+    int len;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Get_processor_name(hostname, &len);
+
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--journal") == 0 && a + 1 < argc) journal_path = argv[++a];
+        else if (strcmp(argv[a], "--work-us") == 0 && a + 1 < argc) work_us = atol(argv[++a]);
+        else if (strcmp(argv[a], "--prefetch") == 0 && a + 1 < argc) prefetch = atoi(argv[++a]);
+        else total_tasks = atol(argv[a]);
+    }
+    if (total_tasks < 0 || total_tasks > 0x7fffffff || work_us < 0 || prefetch < 1) {
+        if (rank == 0)
+            fprintf(stderr, "Usage: %s [tasks] [--journal FILE] [--work-us US] [--prefetch K]\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    // Workers (every rank but 0) grouped by node; node rank 0 sub-manages
+    MPI_Comm workers = MPI_COMM_NULL, node = MPI_COMM_NULL;
+    int node_rank = -1, node_size = 0, node_max = 0;
+    MPI_Comm_split(MPI_COMM_WORLD, rank == 0 ? MPI_UNDEFINED : 0, rank, &workers);
+    if (workers != MPI_COMM_NULL) {
+        MPI_Comm_split_type(workers, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+        MPI_Comm_rank(node, &node_rank);
+        MPI_Comm_size(node, &node_size);
+    }
+    MPI_Allreduce(&node_size, &node_max, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    int cap = prefetch * node_size, cap_max = prefetch * node_max;
+    int leader = node_rank == 0 ? rank : -1;
+    int *leaders = rank == 0 ? (int *)malloc(size * sizeof(int)) : NULL;
+    MPI_Gather(&leader, 1, MPI_INT, leaders, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    // --- MASTER (MANAGER) ---
+    if (rank == 0) {
+        int nodes = 0;
+        for (int r = 0; r < size; r++)
+            if (leaders[r] > 0) leaders[nodes++] = leaders[r];
+        rc = manager(nodes, leaders, cap_max, total_tasks, journal_path);
+        free(leaders);
+    }
+    // --- SUB-MANAGER AND WORKERS (one shared queue per node) ---
     else {
-        int task_id;
-        while (1) {
-            MPI_Recv(&task_id, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            if (task_id == -1) break; // Kill signal
-
-            // Simulate Heavy Work
-            sleep(1); 
-            
-            // Return Task ID as proof of work
-            MPI_Send(&task_id, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
-        }
+        int64_t *base;
+        MPI_Win q;
+        MPI_Aint words = Q_SLOTS + cap + (MPI_Aint)node_size * DONE_RING;
+        MPI_Win_allocate_shared(node_rank == 0 ? words * sizeof(int64_t) : 0, sizeof(int64_t), MPI_INFO_NULL,
+                                node, &base, &q);
+        if (node_rank == 0) memset(base, 0, words * sizeof(int64_t));
+        MPI_Barrier(node);             // queue is empty before anyone takes from it
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, q);
+        if (node_rank == 0) sub_manager(q, cap, node_size, cap_max, work_us, hostname, rank);
+        else worker(q, cap, node_rank, work_us);
+        MPI_Win_unlock_all(q);
+        MPI_Win_free(&q);
+        MPI_Comm_free(&node);
+        MPI_Comm_free(&workers);
     }
 
     MPI_Finalize();
-    return 0;
+    return rc;
 }
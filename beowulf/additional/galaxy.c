@@ -2,110 +2,346 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+
+#include "thread_pool.h"
+#include "barnes_hut.h"
+#include "nbody.h"
+#include "particle_mesh.h"
+#include "domain.h"
 
 // --- TUNING PARAMETERS ---
 // Increase NUM_STARS to make it slower (Try 5000 or 10000)
 #define NUM_STARS 10000 
 // Increase NUM_STEPS to make it run longer
 #define NUM_STEPS 50    
+// Time step for the velocity/position update (the original "vx += ax" is dt = 1)
+#define DT 1.0
+// Rebalance only when the slowest rank is this much above the mean
+#define REBALANCE_TOLERANCE 1.05
+
+// HYBRID MODE: run one rank per node and use the node's cores as threads
+//   mpirun --hostfile hosts --map-by ppr:1:node ./galaxy --threads hosts
+// --threads takes N, auto, or a hostfile with threads=N (see thread_pool.h).
+// Build: mpicc -O3 -pthread -o galaxy galaxy.c -lm
+//
+// SOLVER: --solver direct (all pairs, O(N^2), default), --solver bh
+// (Barnes-Hut quadtree, O(N log N), see barnes_hut.h) or --solver pm
+// (particle mesh, O(N + M^2 log M), see particle_mesh.h). --theta sets the
+// bh opening angle (default 0.5; smaller is more accurate, 0 is exact).
+// --mesh sets the pm mesh size M (power of two, default 256).
+// With bh or pm, step 0 also checks --check stars of each rank against the
+// direct sum and prints the relative force error. --stars / --steps
+// override NUM_STARS / NUM_STEPS, e.g. for 10^6 star runs:
+//   mpirun --hostfile hosts ./galaxy --solver bh --stars 1000000 --steps 5
+//
+// Stars are stored as separate x[], y[], mass[], vx[], vy[] arrays and the
+// direct sum runs a SIMD kernel (see nbody.h). --kernel avx512|avx2|scalar
+// forces one; the default is the widest the CPU supports.
+//
+// STATE: each rank owns a block of stars and integrates them (kick +
+// drift) every step. With the direct solver the blocks' positions travel
+// around a ring of ranks while forces against the current block are
+// computed, so no rank holds more than O(N / ranks) stars. The tree needs
+// every position, so with bh the blocks are all-gathered each step. pm
+// only exchanges the mesh.
+//
+// DOMAINS: the blocks are pieces of a Hilbert curve through the galaxy
+// (see domain.h), so each rank owns one patch of sky. Every --rebalance K
+// steps (default 10, 0 keeps the plain index split) the curve is cut
+// again by measured cost: each rank's force time since the last cut is
+// spread over its stars, so a rank that was slow (a dense cluster under
+// bh, or a slower node) hands stars to its neighbours. Cuts are skipped
+// while the slowest rank is within 5% of the mean. pm's cost is mostly
+// the shared mesh, so there the cut only keeps counts equal.
+
+enum { SOLVER_DIRECT, SOLVER_BH, SOLVER_PM };
 
 typedef struct {
-    double x, y;
-    double mass;
-    double vx, vy;
-} Star;
+    stars_t *local;             // this rank's stars
+    stars_t *all;               // every star's x, y, mass (bh only)
+    double *acc_x, *acc_y;      // per local star, without the G * m_i factor
+    nbody_accum_t accum;        // direct: block currently on the ring
+    thread_pool_t *pool;
+    const nbody_kernel_t *kernel;
+    double busy;                // force time since the last rebalance
+} ForceJob;
+
+// Forces on local stars [lo, hi) from the current ring block (one thread-pool task)
+static void compute_forces(long lo, long hi, int tid, void *arg) {
+    ForceJob *job = (ForceJob *)arg;
+    (void)tid;
+
+    // Physics Formula: F = G * m1 * m2 / r^2, with r clamped to >= 1.
+    // The kernel sums m_j * d / r^3; G * m_i is applied once in nbody_step.
+    nbody_accum_range(&job->accum, (int)lo, (int)hi);
+}
+
+// Ring callback: split this rank's stars over the thread pool (work-stealing)
+static void ring_block(const double *x, const double *y, const double *m,
+                       int n_pad, void *arg) {
+    ForceJob *job = (ForceJob *)arg;
+    job->accum.bx = x;
+    job->accum.by = y;
+    job->accum.bm = m;
+    job->accum.bn_pad = n_pad;
+    double t0 = MPI_Wtime();
+    tp_parallel_for(job->pool, 0, job->local->n, 64, compute_forces, job);
+    job->busy += MPI_Wtime() - t0;
+}
+
+// Compare the solver's forces (acc_x/acc_y, already computed this step)
+// with the direct sum on `samples` of this rank's stars and print the
+// error over all ranks on rank 0
+static void check_solver_error(ForceJob *job, nbody_ring_t *ring, int samples,
+                               int rank, const char *label) {
+    double max_err, rms;
+    int count = nbody_check_error(ring, job->local, job->acc_x, job->acc_y, job->kernel,
+                                  samples, &max_err, &rms);
+    if (rank == 0 && count > 0)
+        printf("%s check: %d stars vs direct sum, max rel error %.3e, rms %.3e\n",
+               label, count, max_err, rms);
+}
+
+// Recut the curve (cost per local star, or NULL for equal counts), then
+// resize everything that depends on the local star count
+static void redistribute(ForceJob *job, nbody_ring_t *ring, const double *cost, int rank) {
+    if (domain_rebalance(job->local, cost, MPI_COMM_WORLD) != 0) {
+        fprintf(stderr, "Rank %d: out of memory rebalancing\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    nbody_ring_free(ring);
+    free(job->acc_x);
+    free(job->acc_y);
+    job->acc_x = (double *)calloc(job->local->n + 1, sizeof(double));
+    job->acc_y = (double *)calloc(job->local->n + 1, sizeof(double));
+    if (nbody_ring_init(ring, job->local->n, MPI_COMM_WORLD) != 0 || !job->acc_x || !job->acc_y) {
+        fprintf(stderr, "Rank %d: out of memory rebalancing\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    job->accum.ax = job->acc_x;
+    job->accum.ay = job->acc_y;
+    // The tree's copy of the masses follows the new star order
+    if (job->all->n > 0)
+        MPI_Allgatherv(job->local->mass, job->local->n, MPI_DOUBLE, job->all->mass,
+                       ring->counts, ring->displs, MPI_DOUBLE, MPI_COMM_WORLD);
+}
 
 int main(int argc, char *argv[]) {
-    int rank, size;
-    int i, j, step;
-    double dx, dy, distance, force, start_time, end_time;
+    int rank, size, provided;
+    int i, step;
+    double start_time, end_time;
     double G = 6.674e-11; // Gravitational constant
+    char hostname[MPI_MAX_PROCESSOR_NAME];
+    int len;
+    const char *threads_spec = NULL;
+    const char *kernel_name = NULL;
+    int num_stars = NUM_STARS;
+    int num_steps = NUM_STEPS;
+    int solver = SOLVER_DIRECT;
+    double theta = 0.5;
+    int mesh = 256;
+    int check = 32;
+    int rebalance = 10;
+    int rebalances = 0;
+    double tree_time = 0.0;
+    double busy_total = 0.0;
 
-    MPI_Init(&argc, &argv);
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Get_processor_name(hostname, &len);
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads_spec = argv[++i];
+        else if (strcmp(argv[i], "--stars") == 0 && i + 1 < argc) num_stars = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) num_steps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--theta") == 0 && i + 1 < argc) theta = atof(argv[++i]);
+        else if (strcmp(argv[i], "--mesh") == 0 && i + 1 < argc) mesh = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rebalance") == 0 && i + 1 < argc) rebalance = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--check") == 0 || strcmp(argv[i], "--bh-check") == 0) && i + 1 < argc)
+            check = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) kernel_name = argv[++i];
+        else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "direct") == 0) solver = SOLVER_DIRECT;
+            else if (strcmp(argv[i], "bh") == 0) solver = SOLVER_BH;
+            else if (strcmp(argv[i], "pm") == 0) solver = SOLVER_PM;
+            else {
+                if (rank == 0) fprintf(stderr, "Unknown solver '%s' (use direct, bh or pm)\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        }
+    }
+    if (num_stars < 1 || num_steps < 0 || theta < 0.0 || rebalance < 0) {
+        if (rank == 0) fprintf(stderr, "Invalid --stars, --steps, --theta or --rebalance\n");
+        MPI_Finalize();
+        return 1;
+    }
+    const nbody_kernel_t *kernel = nbody_select_kernel(kernel_name);
+    if (!kernel) {
+        if (rank == 0) fprintf(stderr, "Kernel '%s' is not available on this CPU\n", kernel_name);
+        MPI_Finalize();
+        return 1;
+    }
+    int nthreads = tp_resolve_threads(threads_spec, hostname, tp_ranks_on_node(MPI_COMM_WORLD));
+    thread_pool_t *pool = tp_create(tp_mpi_threads(nthreads, provided));
+    if (!pool) MPI_Abort(MPI_COMM_WORLD, 1);
+    bh_tree_t tree;
+    bh_init(&tree);
+    pm_t pm;
+    if (solver == SOLVER_PM && pm_init(&pm, mesh, MPI_COMM_WORLD) != 0) {
+        if (rank == 0) fprintf(stderr, "--mesh must be a power of two >= 8 (got %d)\n", mesh);
+        MPI_Finalize();
+        return 1;
+    }
 
-    // Allocate memory for stars
-    Star *stars = (Star *)malloc(NUM_STARS * sizeof(Star));
+    // BLOCK DECOMPOSITION
+    // Divide the stars among processors.
+    // If there are 6000 stars and 6 nodes, each node owns 1000 stars.
+    int start_index, end_index;
+    nbody_block_range(num_stars, rank, size, &start_index, &end_index);
+
+    // Allocate memory for our stars. The full set exists on rank 0 for the
+    // initial state, and everywhere with bh (the tree needs all positions).
+    stars_t stars, all;
+    nbody_ring_t ring;
+    int all_n = (rank == 0 || solver == SOLVER_BH) ? num_stars : 0;
+    if (stars_alloc(&stars, end_index - start_index) != 0 ||
+        stars_alloc(&all, all_n) != 0 ||
+        nbody_ring_init(&ring, stars.n, MPI_COMM_WORLD) != 0) {
+        fprintf(stderr, "Rank %d: out of memory for %d stars\n", rank, num_stars);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    double *acc_x = (double *)calloc(stars.n + 1, sizeof(double));
+    double *acc_y = (double *)calloc(stars.n + 1, sizeof(double));
+    if (!acc_x || !acc_y) MPI_Abort(MPI_COMM_WORLD, 1);
 
     // Master initializes the Galaxy
     if (rank == 0) {
         printf("=== N-BODY GALAXY SIMULATION ===\n");
-        printf("Simulating %d Stars for %d Time Steps...\n", NUM_STARS, NUM_STEPS);
-        for (i = 0; i < NUM_STARS; i++) {
-            stars[i].x = (rand() % 1000) * 1.0;
-            stars[i].y = (rand() % 1000) * 1.0;
-            stars[i].mass = (rand() % 100) * 10.0;
-            stars[i].vx = 0;
-            stars[i].vy = 0;
+        printf("Simulating %d Stars for %d Time Steps...\n", num_stars, num_steps);
+        if (solver == SOLVER_BH) printf("Solver: Barnes-Hut (theta=%.2f)\n", theta);
+        if (solver == SOLVER_PM) printf("Solver: particle mesh (%d x %d)\n", mesh, mesh);
+        for (i = 0; i < num_stars; i++) {
+            all.x[i] = (rand() % 1000) * 1.0;
+            all.y[i] = (rand() % 1000) * 1.0;
+            all.mass[i] = (rand() % 100) * 10.0;
+            all.vx[i] = 0;
+            all.vy[i] = 0;
         }
         start_time = MPI_Wtime();
     }
 
-    // Broadcast the initial state of the universe to all workers
-    MPI_Bcast(stars, NUM_STARS * sizeof(Star), MPI_BYTE, 0, MPI_COMM_WORLD);
+    // Hand each worker its block of the initial universe
+    nbody_scatter(&ring, &all, &stars, 0);
+    if (solver == SOLVER_BH) {
+        MPI_Bcast(all.mass, num_stars, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    } else {
+        stars_free(&all);
+    }
+    ForceJob job = { &stars, &all, acc_x, acc_y,
+                     { &stars, acc_x, acc_y, kernel, NULL, NULL, NULL, 0 },
+                     pool, kernel, 0.0 };
+
+    // Start from equal counts along the curve
+    if (rebalance > 0) redistribute(&job, &ring, NULL, rank);
+
+    printf("  [Node %s | Rank %d] using %d thread(s), %s kernel\n",
+           hostname, rank, tp_size(pool), kernel->name);
 
     // --- TIME STEP LOOP ---
-    for (step = 0; step < NUM_STEPS; step++) {
+    for (step = 0; step < num_steps; step++) {
         
         // Print progress bar on Master every 10 steps
         if (rank == 0 && step % 10 == 0) { 
-            printf("Processing Step %d/%d...\n", step, NUM_STEPS); 
+            printf("Processing Step %d/%d...\n", step, num_steps); 
         }
 
-        // BLOCK DECOMPOSITION
-        // Divide the stars among processors.
-        // If there are 6000 stars and 6 nodes, each node calculates forces for 1000 stars.
-        int stars_per_proc = NUM_STARS / size;
-        int start_index = rank * stars_per_proc;
-        int end_index = start_index + stars_per_proc;
-        
-        // Handle remainder for the last rank
-        if (rank == size - 1) {
-            end_index = NUM_STARS;
+        // Recut the curve by the force time each rank measured
+        if (rebalance > 0 && step > 0 && step % rebalance == 0) {
+            double max_load, mean_load;
+            MPI_Allreduce(&job.busy, &max_load, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+            MPI_Allreduce(&job.busy, &mean_load, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+            mean_load /= size;
+            if (solver == SOLVER_PM) {
+                redistribute(&job, &ring, NULL, rank);
+                rebalances++;
+            } else if (max_load > REBALANCE_TOLERANCE * mean_load) {
+                double *cost = (double *)malloc((stars.n + 1) * sizeof(double));
+                if (!cost) MPI_Abort(MPI_COMM_WORLD, 1);
+                for (i = 0; i < stars.n; i++) cost[i] = job.busy / stars.n;
+                redistribute(&job, &ring, cost, rank);
+                free(cost);
+                rebalances++;
+            }
+            busy_total += job.busy;
+            job.busy = 0.0;
         }
 
         // --- HEAVY CALCULATION START ---
-        for (i = start_index; i < end_index; i++) {
-            double ax = 0.0;
-            double ay = 0.0;
-
-            for (j = 0; j < NUM_STARS; j++) {
-                if (i == j) continue; // Don't calculate gravity on self
-
-                dx = stars[j].x - stars[i].x;
-                dy = stars[j].y - stars[i].y;
-                distance = sqrt(dx*dx + dy*dy);
-
-                // Avoid division by zero (particles crashing)
-                if (distance < 1.0) distance = 1.0; 
-
-                // Physics Formula: F = G * m1 * m2 / r^2
-                force = (G * stars[i].mass * stars[j].mass) / (distance * distance);
-                
-                // Accumulate Acceleration
-                ax += force * dx / distance;
-                ay += force * dy / distance;
+        if (solver == SOLVER_BH) {
+            // Every rank builds the whole tree from the current positions,
+            // then walks it only for its own stars
+            MPI_Allgatherv(stars.x, stars.n, MPI_DOUBLE, all.x, ring.counts, ring.displs,
+                           MPI_DOUBLE, MPI_COMM_WORLD);
+            MPI_Allgatherv(stars.y, stars.n, MPI_DOUBLE, all.y, ring.counts, ring.displs,
+                           MPI_DOUBLE, MPI_COMM_WORLD);
+            double t0 = MPI_Wtime();
+            if (bh_build(&tree, all.x, all.y, all.mass, 1, num_stars, pool) != 0) {
+                fprintf(stderr, "Rank %d: out of memory building the tree\n", rank);
+                MPI_Abort(MPI_COMM_WORLD, 1);
             }
-            // Update Velocity (Simplified physics for demo)
-            stars[i].vx += ax;
-            stars[i].vy += ay;
+            tree_time += MPI_Wtime() - t0;
+            t0 = MPI_Wtime();
+            bh_accel_all(&tree, stars.x, stars.y, stars.n, theta, job.acc_x, job.acc_y, pool);
+            job.busy += MPI_Wtime() - t0;
+        } else if (solver == SOLVER_PM) {
+            // Own work only: the mesh collectives wait for every rank
+            double t0 = MPI_Wtime(), wait0 = pm.wait;
+            pm_accel(&pm, &stars, job.acc_x, job.acc_y, pool);
+            job.busy += MPI_Wtime() - t0 - (pm.wait - wait0);
+        } else {
+            // Forces from every rank's block as it passes by on the ring
+            memset(job.acc_x, 0, stars.n * sizeof(double));
+            memset(job.acc_y, 0, stars.n * sizeof(double));
+            nbody_ring_pass(&ring, &stars, ring_block, &job);
         }
         // --- HEAVY CALCULATION END ---
 
-        // In a real simulation, we would perform MPI_Allgather here to update positions.
-        // For this benchmark, we skip that to focus purely on CPU crunching speed.
-        MPI_Barrier(MPI_COMM_WORLD);
+        if (step == 0 && check > 0 && solver != SOLVER_DIRECT)
+            check_solver_error(&job, &ring, check, rank, solver == SOLVER_BH ? "BH" : "PM");
+
+        // Update velocities and positions of our stars
+        nbody_step(&stars, job.acc_x, job.acc_y, G, DT);
     }
+    busy_total += job.busy;
+
+    // Force time of the busiest rank against the mean: 1.00 is perfect balance
+    double busy_max, busy_sum;
+    MPI_Reduce(&busy_total, &busy_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&busy_total, &busy_sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
 
     if (rank == 0) {
         end_time = MPI_Wtime();
         printf("\nSimulation Complete.\n");
         printf("Time Taken: %.4f seconds\n", end_time - start_time);
+        if (solver == SOLVER_BH) printf("Tree Build: %.4f seconds (rank 0)\n", tree_time);
+        if (busy_sum > 0.0)
+            printf("Load Balance: busiest rank %.4f s of force work, mean %.4f s (%d rebalance(s))\n",
+                   busy_max, busy_sum / size, rebalances);
         printf("================================\n");
     }
 
-    free(stars);
+    bh_free(&tree);
+    if (solver == SOLVER_PM) pm_free(&pm);
+    tp_destroy(pool);
+    free(job.acc_x);
+    free(job.acc_y);
+    nbody_ring_free(&ring);
+    stars_free(&all);
+    stars_free(&stars);
     MPI_Finalize();
     return 0;
 }
@@ -2,122 +2,590 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <unistd.h> // For checking file existence
 
+#include "thread_pool.h"
+#include "barnes_hut.h"
+#include "nbody.h"
+
 #define NUM_STARS 10000 
 #define NUM_STEPS 100    // Increased steps so you have time to kill it
-#define CHECKPOINT_FILE "/cluster/checkpoint.dat"
+#define CHECKPOINT_DIR "/cluster/checkpoint"
+#define CHECKPOINT_EVERY 10
+#define DT 1.0          // time step for the velocity/position update
+
+// Each rank keeps only its own block of stars; the others' positions come
+// by on a ring every step (see nbody.h).
+//
+// SOLVER: --solver direct (all pairs, default) or --solver bh (Barnes-Hut
+// quadtree, see barnes_hut.h): positions are all-gathered every step and
+// each rank walks the whole tree for its own stars. --theta sets the
+// opening angle (default 0.5, 0 is exact), --check the stars per rank
+// compared with the direct sum on the first step (default 32), and
+// --threads (see thread_pool.h) the threads that build and walk the tree.
+// A run may resume with a different solver.
+//
+// CHECKPOINTS (Build: mpicc -O3 -pthread -o galaxy_checkpoint galaxy_checkpoint.c -lm)
+// Every rank writes its own block to its own part file, from a background
+// I/O thread, so the compute loop only pays for a memcpy into one of two
+// snapshot buffers. A checkpoint becomes the restart point only when all
+// parts are on disk: rank 0 then renames a new manifest over the old one,
+// which lists the parts of that step. A crash at any moment leaves the
+// previous manifest and its parts intact.
+//
+//   CHECKPOINT_DIR/manifest             header + (first, count) per part
+//   CHECKPOINT_DIR/step<S>.part<R>      header + x[] y[] mass[] vx[] vy[]
+//
+// Headers carry a format version and a checksum of the payload. A restart
+// may use a different number of ranks: each rank reads the parts that
+// overlap its new block.
+
+enum { SOLVER_DIRECT, SOLVER_BH };
+
+#define CKPT_VERSION 2
+#define CKPT_PART_MAGIC "BWCKPART"
+#define CKPT_MANIFEST_MAGIC "BWCKMANI"
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    int32_t  step;
+    int64_t  num_stars;
+    int64_t  first;      // part: first global star; manifest: 0
+    int64_t  count;      // part: stars in the file; manifest: number of parts
+    uint64_t checksum;   // of the payload after the header
+    uint8_t  reserved[16];
+} CkptHeader;
+
+_Static_assert(sizeof(CkptHeader) == 64, "checkpoint header must be 64 bytes");
+
+// 64-bit FNV-1a over 8-byte words (payloads are whole doubles / int64s)
+static uint64_t ckpt_checksum(const void *data, size_t bytes) {
+    const uint64_t *w = (const uint64_t *)data;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < bytes / 8; i++) {
+        h ^= w[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void ckpt_part_path(char *path, size_t len, int step, int part) {
+    snprintf(path, len, "%s/step%d.part%d", CHECKPOINT_DIR, step, part);
+}
+
+static void ckpt_sync_dir(void) {
+    int fd = open(CHECKPOINT_DIR, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Write header + payload to path.tmp, fsync, and rename it to path
+static int ckpt_write_file(const char *path, const CkptHeader *h,
+                           const void *payload, size_t bytes) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    const char *chunks[2] = { (const char *)h, (const char *)payload };
+    size_t sizes[2] = { sizeof(*h), bytes };
+    for (int c = 0; c < 2; c++) {
+        size_t done = 0;
+        while (done < sizes[c]) {
+            ssize_t n = write(fd, chunks[c] + done, sizes[c] - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                close(fd);
+                unlink(tmp);
+                return -1;
+            }
+            done += (size_t)n;
+        }
+    }
+    if (fsync(fd) != 0 || close(fd) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    ckpt_sync_dir();
+    return 0;
+}
+
+// Read a whole file and check its header and checksum. Returns the payload
+// (caller frees) or NULL.
+static void *ckpt_read_file(const char *path, const char *magic, CkptHeader *h, size_t bytes) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    void *payload = malloc(bytes ? bytes : 1);
+    int ok = payload &&
+             fread(h, sizeof(*h), 1, fp) == 1 &&
+             memcmp(h->magic, magic, 8) == 0 &&
+             h->version == CKPT_VERSION &&
+             fread(payload, 1, bytes, fp) == bytes &&
+             ckpt_checksum(payload, bytes) == h->checksum;
+    fclose(fp);
+    if (!ok) {
+        free(payload);
+        return NULL;
+    }
+    return payload;
+}
+
+// Remove every checkpoint file except the parts of keep_step and the
+// manifest (keep_step < 0 removes everything, manifest first)
+static void ckpt_clean(int keep_step) {
+    char path[512];
+    if (keep_step < 0) {
+        snprintf(path, sizeof(path), "%s/manifest", CHECKPOINT_DIR);
+        unlink(path);
+    }
+    DIR *dir = opendir(CHECKPOINT_DIR);
+    if (!dir) return;
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        int step, part;
+        char tail;
+        if (strcmp(e->d_name, "manifest") == 0 && keep_step >= 0) continue;
+        if (sscanf(e->d_name, "step%d.part%d%c", &step, &part, &tail) == 2 && step == keep_step)
+            continue;
+        if (e->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", CHECKPOINT_DIR, e->d_name);
+        unlink(path);
+    }
+    closedir(dir);
+}
+
+// ---------------- background writer ----------------
+
+enum { JOB_PART, JOB_COMMIT };
 
 typedef struct {
-    double x, y;
-    double mass;
-    double vx, vy;
-} Star;
+    int type;
+    int step;
+    int snap;            // JOB_PART: snapshot buffer index
+} CkptJob;
+
+#define CKPT_QUEUE 4
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    CkptJob queue[CKPT_QUEUE];
+    int head, len;
+    int shutdown;
+
+    // Double-buffered snapshots of this rank's block: the compute loop fills
+    // one while the thread may still be writing the other
+    double *snap[2];
+    int snap_busy[2];
+    int snap_next;
+
+    int rank, size, first, count;
+    int done_step;       // newest step whose part is durable (-1: none)
+    int failed;
+
+    // rank 0: parts of every rank, for the manifest
+    int64_t *ranges;     // (first, count) per rank
+    int committed_step, committed_parts;
+} CkptWriter;
+
+static int ckpt_write_part(CkptWriter *w, int step, const double *buf) {
+    CkptHeader h;
+    char path[512];
+    size_t bytes = 5 * (size_t)w->count * sizeof(double);
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CKPT_PART_MAGIC, 8);
+    h.version = CKPT_VERSION;
+    h.step = step;
+    h.num_stars = NUM_STARS;
+    h.first = w->first;
+    h.count = w->count;
+    h.checksum = ckpt_checksum(buf, bytes);
+    ckpt_part_path(path, sizeof(path), step, w->rank);
+    return ckpt_write_file(path, &h, buf, bytes);
+}
+
+// rank 0: point the manifest at `step`, then drop the parts it replaces
+static int ckpt_write_manifest(CkptWriter *w, int step) {
+    CkptHeader h;
+    char path[512];
+    size_t bytes = 2 * (size_t)w->size * sizeof(int64_t);
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CKPT_MANIFEST_MAGIC, 8);
+    h.version = CKPT_VERSION;
+    h.step = step;
+    h.num_stars = NUM_STARS;
+    h.count = w->size;
+    h.checksum = ckpt_checksum(w->ranges, bytes);
+    snprintf(path, sizeof(path), "%s/manifest", CHECKPOINT_DIR);
+    if (ckpt_write_file(path, &h, w->ranges, bytes) != 0) return -1;
+
+    if (w->committed_step >= 0 && w->committed_step != step) {
+        for (int p = 0; p < w->committed_parts; p++) {
+            ckpt_part_path(path, sizeof(path), w->committed_step, p);
+            unlink(path);
+        }
+    }
+    w->committed_step = step;
+    w->committed_parts = w->size;
+    return 0;
+}
+
+static void *ckpt_thread(void *arg) {
+    CkptWriter *w = (CkptWriter *)arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->len == 0 && !w->shutdown) pthread_cond_wait(&w->cv, &w->lock);
+        if (w->len == 0) break;
+        CkptJob job = w->queue[w->head];
+        pthread_mutex_unlock(&w->lock);
+
+        int rc = (job.type == JOB_PART) ? ckpt_write_part(w, job.step, w->snap[job.snap])
+                                        : ckpt_write_manifest(w, job.step);
+        if (rc != 0) fprintf(stderr, "[CHECKPOINT] Rank %d: writing step %d failed\n", w->rank, job.step);
+
+        pthread_mutex_lock(&w->lock);
+        w->head = (w->head + 1) % CKPT_QUEUE;
+        w->len--;
+        if (job.type == JOB_PART) {
+            w->snap_busy[job.snap] = 0;
+            if (rc == 0) w->done_step = job.step;
+        }
+        if (rc != 0) w->failed = 1;
+        pthread_cond_broadcast(&w->cv);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static void ckpt_enqueue(CkptWriter *w, int type, int step, int snap) {
+    while (w->len == CKPT_QUEUE) pthread_cond_wait(&w->cv, &w->lock);
+    CkptJob job = { type, step, snap };
+    w->queue[(w->head + w->len) % CKPT_QUEUE] = job;
+    w->len++;
+    pthread_cond_broadcast(&w->cv);
+}
+
+static int ckpt_start(CkptWriter *w, const nbody_ring_t *ring, int committed_step, int committed_parts) {
+    memset(w, 0, sizeof(*w));
+    w->rank = ring->rank;
+    w->size = ring->size;
+    w->first = ring->displs[ring->rank];
+    w->count = ring->counts[ring->rank];
+    w->done_step = -1;
+    w->committed_step = committed_step;
+    w->committed_parts = committed_parts;
+    w->snap[0] = (double *)malloc(5 * (size_t)w->count * sizeof(double) + 1);
+    w->snap[1] = (double *)malloc(5 * (size_t)w->count * sizeof(double) + 1);
+    w->ranges = (int64_t *)malloc(2 * (size_t)w->size * sizeof(int64_t));
+    if (!w->snap[0] || !w->snap[1] || !w->ranges) return -1;
+    for (int p = 0; p < w->size; p++) {
+        w->ranges[2 * p] = ring->displs[p];
+        w->ranges[2 * p + 1] = ring->counts[p];
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cv, NULL);
+    return pthread_create(&w->thread, NULL, ckpt_thread, w) == 0 ? 0 : -1;
+}
 
-void save_checkpoint(Star *stars, int step) {
-    FILE *fp = fopen(CHECKPOINT_FILE, "wb");
-    if (fp) {
-        fwrite(&step, sizeof(int), 1, fp);
-        fwrite(stars, sizeof(Star), NUM_STARS, fp);
-        fclose(fp);
-        printf("[CHECKPOINT] Progress saved at Step %d\n", step);
+// Copy our block into a free snapshot buffer and queue it for writing.
+// Only waits if both buffers are still being written.
+static void ckpt_snapshot(CkptWriter *w, const stars_t *stars, int step) {
+    const double *src[5] = { stars->x, stars->y, stars->mass, stars->vx, stars->vy };
+    pthread_mutex_lock(&w->lock);
+    while (w->snap_busy[w->snap_next]) pthread_cond_wait(&w->cv, &w->lock);
+    int b = w->snap_next;
+    w->snap_busy[b] = 1;
+    w->snap_next = 1 - b;
+    pthread_mutex_unlock(&w->lock);
+
+    for (int f = 0; f < 5; f++)
+        memcpy(w->snap[b] + (size_t)f * w->count, src[f], w->count * sizeof(double));
+
+    pthread_mutex_lock(&w->lock);
+    ckpt_enqueue(w, JOB_PART, step, b);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Collective: commit the newest step every rank has on disk. With wait set,
+// first let the I/O threads finish everything queued.
+static void ckpt_commit(CkptWriter *w, int *committed, int wait) {
+    int done, all_done;
+    pthread_mutex_lock(&w->lock);
+    while (wait && w->len > 0) pthread_cond_wait(&w->cv, &w->lock);
+    done = w->failed ? -1 : w->done_step;
+    pthread_mutex_unlock(&w->lock);
+
+    MPI_Allreduce(&done, &all_done, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (all_done > *committed) {
+        *committed = all_done;
+        if (w->rank == 0) {
+            pthread_mutex_lock(&w->lock);
+            ckpt_enqueue(w, JOB_COMMIT, all_done, 0);
+            pthread_mutex_unlock(&w->lock);
+            printf("[CHECKPOINT] Progress saved at Step %d\n", all_done);
+        }
     }
 }
 
-int load_checkpoint(Star *stars) {
-    if (access(CHECKPOINT_FILE, F_OK) != -1) {
-        FILE *fp = fopen(CHECKPOINT_FILE, "rb");
-        int step = 0;
+static void ckpt_stop(CkptWriter *w) {
+    pthread_mutex_lock(&w->lock);
+    w->shutdown = 1;
+    pthread_cond_broadcast(&w->cv);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cv);
+    free(w->snap[0]);
+    free(w->snap[1]);
+    free(w->ranges);
+}
+
+// ---------------- restart ----------------
+
+// Collective. Fills our block from the committed checkpoint and returns its
+// step, or 0 if there is none. *parts is the writing run's part count.
+static int load_checkpoint(stars_t *stars, int first, int rank, int *parts) {
+    CkptHeader h;
+    int info[2] = { 0, 0 };   // step, number of parts
+    int64_t *ranges = NULL;
+
+    if (rank == 0) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/manifest", CHECKPOINT_DIR);
+        FILE *fp = fopen(path, "rb");
         if (fp) {
-            fread(&step, sizeof(int), 1, fp);
-            fread(stars, sizeof(Star), NUM_STARS, fp);
+            // Size the payload from the header, then read and verify it all
+            if (fread(&h, sizeof(h), 1, fp) == 1 && h.count > 0 && h.count < (1 << 20)) {
+                ranges = (int64_t *)ckpt_read_file(path, CKPT_MANIFEST_MAGIC, &h,
+                                                   2 * (size_t)h.count * sizeof(int64_t));
+            }
             fclose(fp);
-            return step;
+            if (ranges && h.num_stars == NUM_STARS) {
+                info[0] = h.step;
+                info[1] = (int)h.count;
+            } else {
+                fprintf(stderr, "[CHECKPOINT] %s is damaged or for another galaxy size, starting fresh\n", path);
+                free(ranges);
+                ranges = NULL;
+            }
+        }
+    }
+    MPI_Bcast(info, 2, MPI_INT, 0, MPI_COMM_WORLD);
+    *parts = info[1];
+    if (info[1] == 0) return 0;
+
+    if (rank != 0) ranges = (int64_t *)malloc(2 * (size_t)info[1] * sizeof(int64_t));
+    MPI_Bcast(ranges, 2 * info[1], MPI_INT64_T, 0, MPI_COMM_WORLD);
+
+    // Read every part that overlaps [first, first + n)
+    int ok = 1;
+    double *dst[5] = { stars->x, stars->y, stars->mass, stars->vx, stars->vy };
+    for (int p = 0; p < info[1] && ok; p++) {
+        int64_t pf = ranges[2 * p], pc = ranges[2 * p + 1];
+        int64_t lo = pf > first ? pf : first;
+        int64_t hi = (pf + pc < first + stars->n) ? pf + pc : first + stars->n;
+        if (lo >= hi) continue;
+
+        char path[512];
+        ckpt_part_path(path, sizeof(path), info[0], p);
+        double *buf = (double *)ckpt_read_file(path, CKPT_PART_MAGIC, &h, 5 * (size_t)pc * sizeof(double));
+        if (!buf || h.step != info[0] || h.first != pf || h.count != pc) {
+            fprintf(stderr, "[CHECKPOINT] Rank %d: part %s is missing or damaged\n", rank, path);
+            ok = 0;
+        } else {
+            for (int f = 0; f < 5; f++)
+                memcpy(dst[f] + (lo - first), buf + (size_t)f * pc + (lo - pf),
+                       (size_t)(hi - lo) * sizeof(double));
         }
+        free(buf);
+    }
+    free(ranges);
+
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (!all_ok) {
+        if (rank == 0) fprintf(stderr, "[CHECKPOINT] Step %d cannot be restored\n", info[0]);
+        MPI_Abort(MPI_COMM_WORLD, 1);
     }
-    return 0; // If no file, start at 0
+    return info[0];
 }
 
 int main(int argc, char *argv[]) {
-    int rank, size;
-    int i, j, step, start_step = 0;
-    double dx, dy, distance, force;
+    int rank, size, provided;
+    int i, step, start_step = 0, parts = 0;
     double G = 6.674e-11; 
+    double stall = 0.0, start_time;
+    int solver = SOLVER_DIRECT;
+    double theta = 0.5;
+    int check = 32;
+    const char *threads_spec = NULL;
+    char hostname[MPI_MAX_PROCESSOR_NAME];
+    int len;
 
-    MPI_Init(&argc, &argv);
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Get_processor_name(hostname, &len);
 
-    Star *stars = (Star *)malloc(NUM_STARS * sizeof(Star));
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--theta") == 0 && i + 1 < argc) theta = atof(argv[++i]);
+        else if (strcmp(argv[i], "--check") == 0 && i + 1 < argc) check = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads_spec = argv[++i];
+        else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "direct") == 0) solver = SOLVER_DIRECT;
+            else if (strcmp(argv[i], "bh") == 0) solver = SOLVER_BH;
+            else {
+                if (rank == 0) fprintf(stderr, "Unknown solver '%s' (use direct or bh)\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        }
+    }
+    if (theta < 0.0) {
+        if (rank == 0) fprintf(stderr, "--theta must not be negative\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    int start_index, end_index;
+    nbody_block_range(NUM_STARS, rank, size, &start_index, &end_index);
+
+    // With bh every rank also keeps all positions and masses for the tree
+    stars_t stars, all;
+    nbody_ring_t ring;
+    bh_tree_t tree;
+    bh_init(&tree);
+    thread_pool_t *pool = NULL;
+    if (solver == SOLVER_BH) {
+        int nthreads = tp_resolve_threads(threads_spec, hostname, tp_ranks_on_node(MPI_COMM_WORLD));
+        pool = tp_create(tp_mpi_threads(nthreads, provided));
+        if (!pool) MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (stars_alloc(&stars, end_index - start_index) != 0 ||
+        stars_alloc(&all, solver == SOLVER_BH ? NUM_STARS : 0) != 0 ||
+        nbody_ring_init(&ring, stars.n, MPI_COMM_WORLD) != 0) {
+        fprintf(stderr, "Rank %d: out of memory\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    const nbody_kernel_t *kernel = nbody_select_kernel(NULL);
+    double *acc_x = (double *)calloc(stars.n + 1, sizeof(double));
+    double *acc_y = (double *)calloc(stars.n + 1, sizeof(double));
+    if (!acc_x || !acc_y) MPI_Abort(MPI_COMM_WORLD, 1);
+    nbody_accum_t accum = { &stars, acc_x, acc_y, kernel, NULL, NULL, NULL, 0 };
 
     // --- INITIALIZATION / RESUME LOGIC ---
-    if (rank == 0) {
-        // Try to load from file first
-        start_step = load_checkpoint(stars);
-        
-        if (start_step > 0) {
-            printf("\n=== RESUMING GALAXY SIMULATION FROM STEP %d ===\n", start_step);
-        } else {
+    if (rank == 0) mkdir(CHECKPOINT_DIR, 0755);
+
+    // Try to load from the checkpoint first (every rank reads its own block)
+    start_step = load_checkpoint(&stars, start_index, rank, &parts);
+
+    if (start_step > 0) {
+        if (rank == 0) printf("\n=== RESUMING GALAXY SIMULATION FROM STEP %d ===\n", start_step);
+    } else {
+        // Random init if no checkpoint (on rank 0, then hand out the blocks)
+        stars_t init;
+        if (stars_alloc(&init, rank == 0 ? NUM_STARS : 0) != 0) MPI_Abort(MPI_COMM_WORLD, 1);
+        if (rank == 0) {
             printf("\n=== NEW GALAXY SIMULATION ===\n");
-            // Random init if no checkpoint
             for (i = 0; i < NUM_STARS; i++) {
-                stars[i].x = (rand() % 1000) * 1.0;
-                stars[i].y = (rand() % 1000) * 1.0;
-                stars[i].mass = (rand() % 100) * 10.0;
-                stars[i].vx = 0;
-                stars[i].vy = 0;
+                init.x[i] = (rand() % 1000) * 1.0;
+                init.y[i] = (rand() % 1000) * 1.0;
+                init.mass[i] = (rand() % 100) * 10.0;
+                init.vx[i] = 0;
+                init.vy[i] = 0;
             }
         }
+        nbody_scatter(&ring, &init, &stars, 0);
+        stars_free(&init);
+    }
+    if (solver == SOLVER_BH) {
+        if (rank == 0) printf("Solver: Barnes-Hut (theta=%.2f)\n", theta);
+        MPI_Allgatherv(stars.mass, stars.n, MPI_DOUBLE, all.mass, ring.counts, ring.displs,
+                       MPI_DOUBLE, MPI_COMM_WORLD);
     }
 
-    // Broadcast the Start Step so everyone knows where to begin
-    MPI_Bcast(&start_step, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    // Broadcast the Star Data (either Random or Loaded from file)
-    MPI_Bcast(stars, NUM_STARS * sizeof(Star), MPI_BYTE, 0, MPI_COMM_WORLD);
-
-    int stars_per_proc = NUM_STARS / size;
-    int start_index = rank * stars_per_proc;
-    int end_index = (rank == size - 1) ? NUM_STARS : start_index + stars_per_proc;
+    // Drop leftovers of interrupted checkpoints (everyone has read by now)
+    if (rank == 0) ckpt_clean(start_step > 0 ? start_step : -1);
+    int committed = start_step > 0 ? start_step : -1;
+    CkptWriter writer;
+    if (ckpt_start(&writer, &ring, committed, parts) != 0) {
+        fprintf(stderr, "Rank %d: cannot start the checkpoint thread\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    start_time = MPI_Wtime();
 
     // --- MAIN LOOP ---
     // Note: We start loop at 'start_step', not 0!
     for (step = start_step; step < NUM_STEPS; step++) {
         
-        if (rank == 0 && step % 10 == 0) { 
-            printf("Processing Step %d/%d...\n", step, NUM_STEPS); 
-            // Save Checkpoint every 10 steps
-            save_checkpoint(stars, step);
+        if (step % CHECKPOINT_EVERY == 0) { 
+            if (rank == 0) printf("Processing Step %d/%d...\n", step, NUM_STEPS); 
+
+            // Save Checkpoint every 10 steps: commit the last one that is
+            // complete on all ranks, then snapshot this one in the background
+            double t0 = MPI_Wtime();
+            ckpt_commit(&writer, &committed, 0);
+            if (step != start_step || start_step == 0) ckpt_snapshot(&writer, &stars, step);
+            stall += MPI_Wtime() - t0;
         }
 
-        // Heavy Math
-        for (i = start_index; i < end_index; i++) {
-            double ax = 0.0, ay = 0.0;
-            for (j = 0; j < NUM_STARS; j++) {
-                if (i == j) continue; 
-                dx = stars[j].x - stars[i].x;
-                dy = stars[j].y - stars[i].y;
-                distance = sqrt(dx*dx + dy*dy);
-                if (distance < 1.0) distance = 1.0; 
-                force = (G * stars[i].mass * stars[j].mass) / (distance * distance);
-                ax += force * dx / distance;
-                ay += force * dy / distance;
+        // Heavy Math: forces on our stars, then move them
+        if (solver == SOLVER_BH) {
+            MPI_Allgatherv(stars.x, stars.n, MPI_DOUBLE, all.x, ring.counts, ring.displs,
+                           MPI_DOUBLE, MPI_COMM_WORLD);
+            MPI_Allgatherv(stars.y, stars.n, MPI_DOUBLE, all.y, ring.counts, ring.displs,
+                           MPI_DOUBLE, MPI_COMM_WORLD);
+            if (bh_build(&tree, all.x, all.y, all.mass, 1, NUM_STARS, pool) != 0) {
+                fprintf(stderr, "Rank %d: out of memory building the tree\n", rank);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            bh_accel_all(&tree, stars.x, stars.y, stars.n, theta, acc_x, acc_y, pool);
+            if (step == start_step && check > 0) {
+                double max_err, rms;
+                int n = nbody_check_error(&ring, &stars, acc_x, acc_y, kernel, check, &max_err, &rms);
+                if (rank == 0 && n > 0)
+                    printf("BH check: %d stars vs direct sum, max rel error %.3e, rms %.3e\n",
+                           n, max_err, rms);
             }
-            stars[i].vx += ax;
-            stars[i].vy += ay;
+        } else {
+            // Forces from every block on the ring
+            memset(acc_x, 0, stars.n * sizeof(double));
+            memset(acc_y, 0, stars.n * sizeof(double));
+            nbody_ring_pass(&ring, &stars, nbody_accum_block, &accum);
         }
-
-        // IMPORTANT: In a real simulation, we need to gather positions here 
-        // to update the shared state for the next checkpoint.
-        // For this demo, we just sync.
-        MPI_Barrier(MPI_COMM_WORLD);
+        nbody_step(&stars, acc_x, acc_y, G, DT);
     }
 
-    if (rank == 0) printf("Simulation Complete.\n");
+    if (rank == 0) {
+        printf("Simulation Complete.\n");
+        printf("Time Taken: %.4f seconds (checkpointing stalled rank 0 for %.4f)\n",
+               MPI_Wtime() - start_time, stall);
+    }
     
-    // Cleanup checkpoint file on success so next run starts fresh
-    if (rank == 0) remove(CHECKPOINT_FILE);
+    // Cleanup checkpoint files on success so next run starts fresh
+    ckpt_stop(&writer);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 0) ckpt_clean(-1);
 
-    free(stars);
+    free(acc_x);
+    free(acc_y);
+    bh_free(&tree);
+    if (pool) tp_destroy(pool);
+    nbody_ring_free(&ring);
+    stars_free(&all);
+    stars_free(&stars);
     MPI_Finalize();
     return 0;
 }
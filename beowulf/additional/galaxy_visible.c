@@ -2,70 +2,316 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+#include "barnes_hut.h"
+#include "nbody.h"
+#include "snapshot_file.h"
 
 // --- TUNING PARAMETERS ---
 #define NUM_STARS 10000 
 #define NUM_STEPS 50    
+#define DT 1.0          // time step for the velocity/position update
+
+// Stars live in separate x[], y[], mass[], vx[], vy[] arrays and forces come
+// from the SIMD direct-sum kernel in nbody.h. Each rank keeps only its own
+// stars; the others' positions pass by on a ring every step (nbody.h), so
+// positions really move and memory per rank is O(N / ranks).
+//
+// SOLVER: --solver direct (all pairs, default) or --solver bh (Barnes-Hut
+// quadtree, see barnes_hut.h). With bh the positions are all-gathered
+// every step, each rank builds the whole tree and walks it for its own
+// stars. --theta sets the opening angle (default 0.5, 0 is exact), and
+// step 0 checks --check stars of each rank (default 32) against the
+// direct sum. --threads (N, auto or a hostfile, see thread_pool.h) sets
+// the threads that build and walk the tree.
+//
+// SNAPSHOTS (Build: mpicc -O3 -pthread -o galaxy_visible galaxy_visible.c -lm)
+//   mpirun -np 4 ./galaxy_visible --snapshot run.snap --every 5
+// appends the positions and velocities of every star to run.snap (format in
+// snapshot_file.h) for the initial state and then every K steps (default
+// 10). Ranks hand their stars to rank 0 with a non-blocking MPI_Igatherv
+// and keep computing; rank 0 passes each finished frame to a background
+// thread that writes it, so no rank waits for the disk. Read the file back
+// with snapshot_extract (snapshot_extract.c).
+
+// ---------------- snapshot stream ----------------
+
+enum { FRAME_FREE, FRAME_GATHERING, FRAME_READY };
+enum { SOLVER_DIRECT, SOLVER_BH };
 
 typedef struct {
-    double x, y;
-    double mass;
-    double vx, vy;
-} Star;
+    int every;
+    double *send;                   // x | y | vx | vy of my stars for the gather
+    MPI_Request req[SNAPF_FIELDS];
+    int pending;                    // a gather is in flight into frame[pending_buf]
+    int pending_buf, next_buf;
+
+    // rank 0: double-buffered frames and the thread that writes them
+    int rank;
+    double *frame[2];
+    int state[2], step[2];
+    int write_buf;                  // next buffer the writer takes (frames stay in order)
+    int shutdown, failed;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    int fd;
+    snapf_header_t hdr;
+    snapf_index_t *index;
+    int frames, index_cap;
+} SnapStream;
+
+static void *snap_thread(void *arg) {
+    SnapStream *s = (SnapStream *)arg;
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        int b = s->write_buf;
+        while (s->state[b] != FRAME_READY && !s->shutdown) pthread_cond_wait(&s->cv, &s->lock);
+        if (s->state[b] != FRAME_READY) break;
+        int step = s->step[b];
+        pthread_mutex_unlock(&s->lock);
+
+        int rc = -1;
+        if (s->frames == s->index_cap) {
+            int cap = s->index_cap ? 2 * s->index_cap : 64;
+            snapf_index_t *grown = (snapf_index_t *)realloc(s->index, cap * sizeof(snapf_index_t));
+            if (grown) { s->index = grown; s->index_cap = cap; }
+        }
+        if (s->frames < s->index_cap &&
+            snapf_write_frame(s->fd, &s->hdr, s->frames, step, s->frame[b]) == 0) {
+            s->index[s->frames].offset = snapf_frame_offset(&s->hdr, s->frames);
+            s->index[s->frames].step = step;
+            s->frames++;
+            rc = 0;
+        }
+        if (rc != 0) fprintf(stderr, "[SNAPSHOT] writing step %d failed\n", step);
+
+        pthread_mutex_lock(&s->lock);
+        if (rc != 0) s->failed = 1;
+        s->state[b] = FRAME_FREE;
+        s->write_buf = 1 - b;
+        pthread_cond_broadcast(&s->cv);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+// Collective. Returns 0, or -1 if rank 0 cannot create the file.
+static int snap_start(SnapStream *s, const char *path, int every, int local_n, int num_stars) {
+    int ok = 1;
+    memset(s, 0, sizeof(*s));
+    MPI_Comm_rank(MPI_COMM_WORLD, &s->rank);
+    s->every = every;
+    s->fd = -1;
+    s->send = (double *)malloc(SNAPF_FIELDS * (size_t)local_n * sizeof(double) + 1);
+    if (!s->send) MPI_Abort(MPI_COMM_WORLD, 1);
+    if (s->rank == 0) {
+        snapf_header_init(&s->hdr, num_stars, DT);
+        s->frame[0] = (double *)malloc(SNAPF_FIELDS * (size_t)num_stars * sizeof(double));
+        s->frame[1] = (double *)malloc(SNAPF_FIELDS * (size_t)num_stars * sizeof(double));
+        if (!s->frame[0] || !s->frame[1]) MPI_Abort(MPI_COMM_WORLD, 1);
+        s->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        // Header without an index until snap_stop: readers see an unclosed file
+        ok = s->fd >= 0 && snapf_pwrite(s->fd, &s->hdr, sizeof(s->hdr), 0) == 0;
+        pthread_mutex_init(&s->lock, NULL);
+        pthread_cond_init(&s->cv, NULL);
+        ok = ok && pthread_create(&s->thread, NULL, snap_thread, s) == 0;
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    return ok ? 0 : -1;
+}
+
+// The gather in flight has arrived: rank 0 hands the frame to the writer
+static void snap_gathered(SnapStream *s) {
+    s->pending = 0;
+    if (s->rank != 0) return;
+    pthread_mutex_lock(&s->lock);
+    s->state[s->pending_buf] = FRAME_READY;
+    pthread_cond_broadcast(&s->cv);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Once per step: let a running gather progress without waiting for it
+static void snap_poll(SnapStream *s) {
+    int done;
+    if (!s->pending) return;
+    MPI_Testall(SNAPF_FIELDS, s->req, &done, MPI_STATUSES_IGNORE);
+    if (done) snap_gathered(s);
+}
+
+static void snap_complete(SnapStream *s) {
+    if (!s->pending) return;
+    MPI_Waitall(SNAPF_FIELDS, s->req, MPI_STATUSES_IGNORE);
+    snap_gathered(s);
+}
+
+// Collective: start gathering the current state as the frame for `step`
+static void snap_frame(SnapStream *s, const nbody_ring_t *ring, const stars_t *stars, int step) {
+    const double *src[SNAPF_FIELDS] = { stars->x, stars->y, stars->vx, stars->vy };
+    int n = stars->n, b = s->next_buf;
+    snap_complete(s);
+    for (int f = 0; f < SNAPF_FIELDS; f++)
+        memcpy(s->send + (size_t)f * n, src[f], n * sizeof(double));
+
+    double *frame = NULL;
+    if (s->rank == 0) {
+        // Only waits if the writer is two frames behind
+        pthread_mutex_lock(&s->lock);
+        while (s->state[b] != FRAME_FREE) pthread_cond_wait(&s->cv, &s->lock);
+        s->state[b] = FRAME_GATHERING;
+        s->step[b] = step;
+        pthread_mutex_unlock(&s->lock);
+        frame = s->frame[b];
+    }
+    for (int f = 0; f < SNAPF_FIELDS; f++)
+        MPI_Igatherv(s->send + (size_t)f * n, n, MPI_DOUBLE,
+                     frame ? frame + (size_t)f * s->hdr.num_stars : NULL,
+                     ring->counts, ring->displs, MPI_DOUBLE, 0, MPI_COMM_WORLD, &s->req[f]);
+    s->pending = 1;
+    s->pending_buf = b;
+    s->next_buf = 1 - b;
+}
+
+// Collective: flush the last frame, write the index and close the file
+static void snap_stop(SnapStream *s, const char *path) {
+    snap_complete(s);
+    if (s->rank == 0) {
+        pthread_mutex_lock(&s->lock);
+        s->shutdown = 1;
+        pthread_cond_broadcast(&s->cv);
+        pthread_mutex_unlock(&s->lock);
+        pthread_join(s->thread, NULL);
+        if (s->failed || snapf_finish(s->fd, &s->hdr, s->index, s->frames) != 0)
+            fprintf(stderr, "[SNAPSHOT] %s is incomplete\n", path);
+        else
+            printf("[SNAPSHOT] %d frames of %llu stars written to %s\n",
+                   s->frames, (unsigned long long)s->hdr.num_stars, path);
+        close(s->fd);
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->cv);
+        free(s->frame[0]);
+        free(s->frame[1]);
+        free(s->index);
+    }
+    free(s->send);
+}
 
 int main(int argc, char *argv[]) {
-    int rank, size;
-    int i, j, step;
-    double dx, dy, distance, force, start_time, end_time;
+    int rank, size, provided;
+    int i, step;
+    double start_time, end_time;
     double G = 6.674e-11; 
     
     // Variables for Visual Demo
     char hostname[MPI_MAX_PROCESSOR_NAME];
     int len;
+    const char *snapshot_path = NULL;
+    int snapshot_every = 10;
+    int solver = SOLVER_DIRECT;
+    double theta = 0.5;
+    int check = 32;
+    const char *threads_spec = NULL;
 
-    MPI_Init(&argc, &argv);
+    // Only the main thread calls MPI; the snapshot writer just does file I/O
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
     MPI_Get_processor_name(hostname, &len);
 
-    // Allocate memory for stars
-    Star *stars = (Star *)malloc(NUM_STARS * sizeof(Star));
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) snapshot_path = argv[++i];
+        else if (strcmp(argv[i], "--every") == 0 && i + 1 < argc) snapshot_every = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--theta") == 0 && i + 1 < argc) theta = atof(argv[++i]);
+        else if (strcmp(argv[i], "--check") == 0 && i + 1 < argc) check = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads_spec = argv[++i];
+        else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "direct") == 0) solver = SOLVER_DIRECT;
+            else if (strcmp(argv[i], "bh") == 0) solver = SOLVER_BH;
+            else {
+                if (rank == 0) fprintf(stderr, "Unknown solver '%s' (use direct or bh)\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        }
+    }
+    if (snapshot_every < 1 || theta < 0.0) {
+        if (rank == 0) fprintf(stderr, "--every must be at least 1 and --theta not negative\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    const nbody_kernel_t *kernel = nbody_select_kernel(NULL);
+
+    // --- WORK DISTRIBUTION CALCULATION ---
+    // We calculate this ONCE at the start to print the status
+    int start_index, end_index;
+    nbody_block_range(NUM_STARS, rank, size, &start_index, &end_index);
+
+    // Allocate memory for our stars (rank 0 also holds the initial galaxy,
+    // and with bh every rank keeps all positions for the tree)
+    stars_t stars, all;
+    nbody_ring_t ring;
+    bh_tree_t tree;
+    bh_init(&tree);
+    thread_pool_t *pool = NULL;
+    if (solver == SOLVER_BH) {
+        int nthreads = tp_resolve_threads(threads_spec, hostname, tp_ranks_on_node(MPI_COMM_WORLD));
+        pool = tp_create(tp_mpi_threads(nthreads, provided));
+        if (!pool) MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (stars_alloc(&stars, end_index - start_index) != 0 ||
+        stars_alloc(&all, (rank == 0 || solver == SOLVER_BH) ? NUM_STARS : 0) != 0 ||
+        nbody_ring_init(&ring, stars.n, MPI_COMM_WORLD) != 0) {
+        fprintf(stderr, "Rank %d: out of memory\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    // Accumulated forces on our stars (+1 so an empty rank still allocates)
+    double *acc_x = (double *)calloc(stars.n + 1, sizeof(double));
+    double *acc_y = (double *)calloc(stars.n + 1, sizeof(double));
+    if (!acc_x || !acc_y) MPI_Abort(MPI_COMM_WORLD, 1);
+    nbody_accum_t accum = { &stars, acc_x, acc_y, kernel, NULL, NULL, NULL, 0 };
 
     // Master initializes the Galaxy
     if (rank == 0) {
         printf("\n=== N-BODY GALAXY SIMULATION ===\n");
         printf("Simulating %d Stars for %d Time Steps...\n", NUM_STARS, NUM_STEPS);
+        if (solver == SOLVER_BH) printf("Solver: Barnes-Hut (theta=%.2f)\n", theta);
         printf("------------------------------------------------\n");
         
         for (i = 0; i < NUM_STARS; i++) {
-            stars[i].x = (rand() % 1000) * 1.0;
-            stars[i].y = (rand() % 1000) * 1.0;
-            stars[i].mass = (rand() % 100) * 10.0;
-            stars[i].vx = 0;
-            stars[i].vy = 0;
+            all.x[i] = (rand() % 1000) * 1.0;
+            all.y[i] = (rand() % 1000) * 1.0;
+            all.mass[i] = (rand() % 100) * 10.0;
+            all.vx[i] = 0;
+            all.vy[i] = 0;
         }
         start_time = MPI_Wtime();
     }
 
-    // Broadcast the universe
-    MPI_Bcast(stars, NUM_STARS * sizeof(Star), MPI_BYTE, 0, MPI_COMM_WORLD);
+    // Hand each rank its own block of the universe
+    nbody_scatter(&ring, &all, &stars, 0);
+    if (solver == SOLVER_BH) MPI_Bcast(all.mass, NUM_STARS, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    else stars_free(&all);
 
-    // --- WORK DISTRIBUTION CALCULATION ---
-    // We calculate this ONCE at the start to print the status
-    int stars_per_proc = NUM_STARS / size;
-    int start_index = rank * stars_per_proc;
-    int end_index = start_index + stars_per_proc;
-    
-    // Handle remainder for the last rank
-    if (rank == size - 1) {
-        end_index = NUM_STARS;
+    SnapStream snap;
+    if (snapshot_path) {
+        if (snap_start(&snap, snapshot_path, snapshot_every, stars.n, NUM_STARS) != 0) {
+            if (rank == 0) fprintf(stderr, "Cannot create snapshot file %s\n", snapshot_path);
+            MPI_Finalize();
+            return 1;
+        }
+        snap_frame(&snap, &ring, &stars, 0);
     }
 
     // --- VISUAL PROOF: Each Node Announces its Job ---
     MPI_Barrier(MPI_COMM_WORLD); // Sync so they don't print over the header
     
-    printf("  [Node %s | Rank %d] Calculating forces for Stars %d to %d\n", 
-           hostname, rank, start_index, end_index);
+    printf("  [Node %s | Rank %d] Calculating forces for Stars %d to %d (%s kernel)\n", 
+           hostname, rank, start_index, end_index, kernel->name);
            
     MPI_Barrier(MPI_COMM_WORLD); // Wait for printing to finish
     if (rank == 0) printf("------------------------------------------------\n");
@@ -79,30 +325,43 @@ int main(int argc, char *argv[]) {
         }
 
         // --- HEAVY CALCULATION START ---
-        for (i = start_index; i < end_index; i++) {
-            double ax = 0.0;
-            double ay = 0.0;
-
-            for (j = 0; j < NUM_STARS; j++) {
-                if (i == j) continue; 
-
-                dx = stars[j].x - stars[i].x;
-                dy = stars[j].y - stars[i].y;
-                distance = sqrt(dx*dx + dy*dy);
-                if (distance < 1.0) distance = 1.0; 
-
-                force = (G * stars[i].mass * stars[j].mass) / (distance * distance);
-                ax += force * dx / distance;
-                ay += force * dy / distance;
+        if (solver == SOLVER_BH) {
+            // Build the whole tree from everyone's positions, walk it for ours
+            MPI_Allgatherv(stars.x, stars.n, MPI_DOUBLE, all.x, ring.counts, ring.displs,
+                           MPI_DOUBLE, MPI_COMM_WORLD);
+            MPI_Allgatherv(stars.y, stars.n, MPI_DOUBLE, all.y, ring.counts, ring.displs,
+                           MPI_DOUBLE, MPI_COMM_WORLD);
+            if (bh_build(&tree, all.x, all.y, all.mass, 1, NUM_STARS, pool) != 0) {
+                fprintf(stderr, "Rank %d: out of memory building the tree\n", rank);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            bh_accel_all(&tree, stars.x, stars.y, stars.n, theta, acc_x, acc_y, pool);
+            if (step == 0 && check > 0) {
+                double max_err, rms;
+                int n = nbody_check_error(&ring, &stars, acc_x, acc_y, kernel, check, &max_err, &rms);
+                if (rank == 0 && n > 0)
+                    printf("BH check: %d stars vs direct sum, max rel error %.3e, rms %.3e\n",
+                           n, max_err, rms);
             }
-            stars[i].vx += ax;
-            stars[i].vy += ay;
+        } else {
+            // Forces from every block as it passes by on the ring
+            memset(acc_x, 0, stars.n * sizeof(double));
+            memset(acc_y, 0, stars.n * sizeof(double));
+            nbody_ring_pass(&ring, &stars, nbody_accum_block, &accum);
         }
+        nbody_step(&stars, acc_x, acc_y, G, DT);
         // --- HEAVY CALCULATION END ---
 
+        if (snapshot_path) {
+            if ((step + 1) % snapshot_every == 0) snap_frame(&snap, &ring, &stars, step + 1);
+            else snap_poll(&snap);
+        }
+
         MPI_Barrier(MPI_COMM_WORLD);
     }
 
+    if (snapshot_path) snap_stop(&snap, snapshot_path);
+
     if (rank == 0) {
         end_time = MPI_Wtime();
         printf("\nSimulation Complete.\n");
@@ -110,7 +369,13 @@ int main(int argc, char *argv[]) {
         printf("================================\n");
     }
 
-    free(stars);
+    free(acc_x);
+    free(acc_y);
+    bh_free(&tree);
+    if (pool) tp_destroy(pool);
+    nbody_ring_free(&ring);
+    stars_free(&all);
+    stars_free(&stars);
     MPI_Finalize();
     return 0;
 }
@@ -0,0 +1,297 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+/*
+ * Cache-blocked, register-tiled DGEMM for the matmul programs.
+ *
+ *   C (m x n) = A (m x k) * B (k x n)          (accumulate = 0)
+ *   C (m x n) += A (m x k) * B (k x n)         (accumulate = 1)
+ *
+ * All matrices are row-major with leading dimensions lda/ldb/ldc.
+ *
+ * Layout follows the usual Goto/BLIS scheme:
+ *   - B is packed KC x NC at a time into NR-wide column slivers (stays in L3)
+ *   - A is packed MC x KC at a time into MR-tall row slivers   (stays in L2)
+ *   - a micro-kernel multiplies one MR x KC sliver of A by one KC x NR
+ *     sliver of B, keeping the whole MR x NR tile of C in registers.
+ *
+ * Three micro-kernels exist (scalar 4x4, AVX2+FMA 6x8, AVX-512 8x16). The
+ * widest one the CPU supports is picked at runtime, so the file is built
+ * with a plain `mpicc -O3` (no -march needed).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMM_X86 1
+#endif
+
+/* Cache blocking. MC and NC are multiples of every MR / NR below. */
+#define GEMM_KC 256
+#define GEMM_MC 96
+#define GEMM_NC 4096
+
+/* Largest micro-tile of any kernel (sizes the scratch tile on the stack) */
+#define GEMM_MAX_MR 8
+#define GEMM_MAX_NR 16
+
+/* Micro-kernel: tile[MR x NR] = Apanel (MR x kc) * Bpanel (kc x NR) */
+typedef void (*gemm_ukernel_fn)(int kc, const double *a, const double *b,
+                                double *tile);
+
+typedef struct {
+    const char *name;
+    int mr, nr;
+    gemm_ukernel_fn run;
+} gemm_kernel_t;
+
+/* ---------------- Micro-kernels ---------------- */
+
+static void gemm_ukernel_scalar(int kc, const double *a, const double *b,
+                                double *tile) {
+    double c[4][4] = {{0}};
+    for (int p = 0; p < kc; p++) {
+        for (int i = 0; i < 4; i++) {
+            double ai = a[p * 4 + i];
+            for (int j = 0; j < 4; j++) {
+                c[i][j] += ai * b[p * 4 + j];
+            }
+        }
+    }
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            tile[i * 4 + j] = c[i][j];
+}
+
+#ifdef GEMM_X86
+__attribute__((target("avx2,fma")))
+static void gemm_ukernel_avx2(int kc, const double *a, const double *b,
+                              double *tile) {
+    /* 6 rows x 2 ymm (8 doubles) = 12 accumulators */
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+    __m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+    __m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+
+    for (int p = 0; p < kc; p++) {
+        __m256d b0 = _mm256_load_pd(b);
+        __m256d b1 = _mm256_load_pd(b + 4);
+        __m256d ai;
+        ai = _mm256_broadcast_sd(a + 0);
+        c00 = _mm256_fmadd_pd(ai, b0, c00); c01 = _mm256_fmadd_pd(ai, b1, c01);
+        ai = _mm256_broadcast_sd(a + 1);
+        c10 = _mm256_fmadd_pd(ai, b0, c10); c11 = _mm256_fmadd_pd(ai, b1, c11);
+        ai = _mm256_broadcast_sd(a + 2);
+        c20 = _mm256_fmadd_pd(ai, b0, c20); c21 = _mm256_fmadd_pd(ai, b1, c21);
+        ai = _mm256_broadcast_sd(a + 3);
+        c30 = _mm256_fmadd_pd(ai, b0, c30); c31 = _mm256_fmadd_pd(ai, b1, c31);
+        ai = _mm256_broadcast_sd(a + 4);
+        c40 = _mm256_fmadd_pd(ai, b0, c40); c41 = _mm256_fmadd_pd(ai, b1, c41);
+        ai = _mm256_broadcast_sd(a + 5);
+        c50 = _mm256_fmadd_pd(ai, b0, c50); c51 = _mm256_fmadd_pd(ai, b1, c51);
+        a += 6;
+        b += 8;
+    }
+
+    _mm256_storeu_pd(tile + 0 * 8, c00); _mm256_storeu_pd(tile + 0 * 8 + 4, c01);
+    _mm256_storeu_pd(tile + 1 * 8, c10); _mm256_storeu_pd(tile + 1 * 8 + 4, c11);
+    _mm256_storeu_pd(tile + 2 * 8, c20); _mm256_storeu_pd(tile + 2 * 8 + 4, c21);
+    _mm256_storeu_pd(tile + 3 * 8, c30); _mm256_storeu_pd(tile + 3 * 8 + 4, c31);
+    _mm256_storeu_pd(tile + 4 * 8, c40); _mm256_storeu_pd(tile + 4 * 8 + 4, c41);
+    _mm256_storeu_pd(tile + 5 * 8, c50); _mm256_storeu_pd(tile + 5 * 8 + 4, c51);
+}
+
+__attribute__((target("avx512f")))
+static void gemm_ukernel_avx512(int kc, const double *a, const double *b,
+                                double *tile) {
+    /* 8 rows x 2 zmm (16 doubles) = 16 accumulators */
+    __m512d c00 = _mm512_setzero_pd(), c01 = _mm512_setzero_pd();
+    __m512d c10 = _mm512_setzero_pd(), c11 = _mm512_setzero_pd();
+    __m512d c20 = _mm512_setzero_pd(), c21 = _mm512_setzero_pd();
+    __m512d c30 = _mm512_setzero_pd(), c31 = _mm512_setzero_pd();
+    __m512d c40 = _mm512_setzero_pd(), c41 = _mm512_setzero_pd();
+    __m512d c50 = _mm512_setzero_pd(), c51 = _mm512_setzero_pd();
+    __m512d c60 = _mm512_setzero_pd(), c61 = _mm512_setzero_pd();
+    __m512d c70 = _mm512_setzero_pd(), c71 = _mm512_setzero_pd();
+
+    for (int p = 0; p < kc; p++) {
+        __m512d b0 = _mm512_load_pd(b);
+        __m512d b1 = _mm512_load_pd(b + 8);
+        __m512d ai;
+        ai = _mm512_set1_pd(a[0]);
+        c00 = _mm512_fmadd_pd(ai, b0, c00); c01 = _mm512_fmadd_pd(ai, b1, c01);
+        ai = _mm512_set1_pd(a[1]);
+        c10 = _mm512_fmadd_pd(ai, b0, c10); c11 = _mm512_fmadd_pd(ai, b1, c11);
+        ai = _mm512_set1_pd(a[2]);
+        c20 = _mm512_fmadd_pd(ai, b0, c20); c21 = _mm512_fmadd_pd(ai, b1, c21);
+        ai = _mm512_set1_pd(a[3]);
+        c30 = _mm512_fmadd_pd(ai, b0, c30); c31 = _mm512_fmadd_pd(ai, b1, c31);
+        ai = _mm512_set1_pd(a[4]);
+        c40 = _mm512_fmadd_pd(ai, b0, c40); c41 = _mm512_fmadd_pd(ai, b1, c41);
+        ai = _mm512_set1_pd(a[5]);
+        c50 = _mm512_fmadd_pd(ai, b0, c50); c51 = _mm512_fmadd_pd(ai, b1, c51);
+        ai = _mm512_set1_pd(a[6]);
+        c60 = _mm512_fmadd_pd(ai, b0, c60); c61 = _mm512_fmadd_pd(ai, b1, c61);
+        ai = _mm512_set1_pd(a[7]);
+        c70 = _mm512_fmadd_pd(ai, b0, c70); c71 = _mm512_fmadd_pd(ai, b1, c71);
+        a += 8;
+        b += 16;
+    }
+
+    _mm512_storeu_pd(tile + 0 * 16, c00); _mm512_storeu_pd(tile + 0 * 16 + 8, c01);
+    _mm512_storeu_pd(tile + 1 * 16, c10); _mm512_storeu_pd(tile + 1 * 16 + 8, c11);
+    _mm512_storeu_pd(tile + 2 * 16, c20); _mm512_storeu_pd(tile + 2 * 16 + 8, c21);
+    _mm512_storeu_pd(tile + 3 * 16, c30); _mm512_storeu_pd(tile + 3 * 16 + 8, c31);
+    _mm512_storeu_pd(tile + 4 * 16, c40); _mm512_storeu_pd(tile + 4 * 16 + 8, c41);
+    _mm512_storeu_pd(tile + 5 * 16, c50); _mm512_storeu_pd(tile + 5 * 16 + 8, c51);
+    _mm512_storeu_pd(tile + 6 * 16, c60); _mm512_storeu_pd(tile + 6 * 16 + 8, c61);
+    _mm512_storeu_pd(tile + 7 * 16, c70); _mm512_storeu_pd(tile + 7 * 16 + 8, c71);
+}
+#endif /* GEMM_X86 */
+
+static const gemm_kernel_t gemm_kernels[] = {
+#ifdef GEMM_X86
+    { "avx512", 8, 16, gemm_ukernel_avx512 },
+    { "avx2",   6,  8, gemm_ukernel_avx2 },
+#endif
+    { "scalar", 4,  4, gemm_ukernel_scalar },
+};
+
+static int gemm_kernel_supported(const char *name) {
+#ifdef GEMM_X86
+    if (strcmp(name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+    if (strcmp(name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+/*
+ * Pick a micro-kernel. name == NULL (or "auto") selects the widest one this
+ * CPU supports; otherwise the named kernel is returned if usable, else NULL.
+ */
+static const gemm_kernel_t *gemm_select_kernel(const char *name) {
+    int n = (int)(sizeof(gemm_kernels) / sizeof(gemm_kernels[0]));
+    return (const gemm_kernel_t *)cpu_kernel_select(gemm_kernels, n, sizeof(gemm_kernels[0]), name,
+                                                    gemm_kernel_supported);
+}
+
+/* ---------------- Packing ---------------- */
+
+/* Pack kc x nc block of B into NR-wide slivers, zero-padding the last one */
+static void gemm_pack_b(int kc, int nc, int nr, const double *B, int ldb,
+                        double *Bp) {
+    for (int j = 0; j < nc; j += nr) {
+        int w = (nc - j < nr) ? nc - j : nr;
+        for (int p = 0; p < kc; p++) {
+            const double *src = B + (size_t)p * ldb + j;
+            int q = 0;
+            for (; q < w; q++) *Bp++ = src[q];
+            for (; q < nr; q++) *Bp++ = 0.0;
+        }
+    }
+}
+
+/* Pack mc x kc block of A into MR-tall slivers (column-major inside) */
+static void gemm_pack_a(int mc, int kc, int mr, const double *A, int lda,
+                        double *Ap) {
+    for (int i = 0; i < mc; i += mr) {
+        int h = (mc - i < mr) ? mc - i : mr;
+        for (int p = 0; p < kc; p++) {
+            int q = 0;
+            for (; q < h; q++) *Ap++ = A[(size_t)(i + q) * lda + p];
+            for (; q < mr; q++) *Ap++ = 0.0;
+        }
+    }
+}
+
+/* ---------------- Driver ---------------- */
+
+/*
+ * One MC x NC block of C: pack mc x kc of A into Ap, then run the
+ * micro-kernel over it and the packed kc x nc panel Bp. Threaded callers
+ * share one Bp and give each thread its own Ap.
+ */
+static void gemm_block(const gemm_kernel_t *kern, int mc, int nc, int kc,
+                       const double *A, int lda, const double *Bp,
+                       double *Ap, double *C, int ldc) {
+    const int mr = kern->mr, nr = kern->nr;
+    double tile[GEMM_MAX_MR * GEMM_MAX_NR];
+
+    gemm_pack_a(mc, kc, mr, A, lda, Ap);
+    for (int jr = 0; jr < nc; jr += nr) {
+        int w = (nc - jr < nr) ? nc - jr : nr;
+        const double *bs = Bp + (size_t)jr * kc;
+
+        for (int ir = 0; ir < mc; ir += mr) {
+            int h = (mc - ir < mr) ? mc - ir : mr;
+            kern->run(kc, Ap + (size_t)ir * kc, bs, tile);
+
+            /* Add the (possibly partial) tile into C */
+            double *cp = C + (size_t)ir * ldc + jr;
+            for (int i = 0; i < h; i++)
+                for (int j = 0; j < w; j++)
+                    cp[(size_t)i * ldc + j] += tile[i * nr + j];
+        }
+    }
+}
+
+/* Packing buffers, 64-byte aligned so the AVX-512 kernel can use aligned
+ * loads: Bp holds a KC x NC panel, Ap an MC x KC block */
+static double *gemm_alloc_bp(void) {
+    return (double *)aligned_alloc(64, (size_t)GEMM_KC * GEMM_NC * sizeof(double));
+}
+
+static double *gemm_alloc_ap(void) {
+    return (double *)aligned_alloc(64, (size_t)GEMM_MC * GEMM_KC * sizeof(double));
+}
+
+/*
+ * Multiply with an explicit kernel. Returns 0 on success, -1 if the packing
+ * buffers could not be allocated.
+ */
+static int gemm_with_kernel(const gemm_kernel_t *kern, int m, int n, int k,
+                            const double *A, int lda,
+                            const double *B, int ldb,
+                            double *C, int ldc, int accumulate) {
+    if (!accumulate) {
+        for (int i = 0; i < m; i++)
+            memset(C + (size_t)i * ldc, 0, (size_t)n * sizeof(double));
+    }
+    if (m <= 0 || n <= 0 || k <= 0) return 0;
+
+    double *Bp = gemm_alloc_bp();
+    double *Ap = gemm_alloc_ap();
+    if (!Bp || !Ap) {
+        free(Bp);
+        free(Ap);
+        return -1;
+    }
+
+    for (int jc = 0; jc < n; jc += GEMM_NC) {
+        int nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+
+        for (int pc = 0; pc < k; pc += GEMM_KC) {
+            int kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+            gemm_pack_b(kc, nc, kern->nr, B + (size_t)pc * ldb + jc, ldb, Bp);
+
+            for (int ic = 0; ic < m; ic += GEMM_MC) {
+                int mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+                gemm_block(kern, mc, nc, kc, A + (size_t)ic * lda + pc, lda, Bp, Ap,
+                           C + (size_t)ic * ldc + jc, ldc);
+            }
+        }
+    }
+
+    free(Bp);
+    free(Ap);
+    return 0;
+}
+
+#endif /* GEMM_H */
@@ -8,6 +8,7 @@ SLOTS_PER_NODE=2           # CPUs per node
 NODES=("master" "worker1" "worker2")
 HOSTFILE_DYN="hosts.dynamic"
 LOG_FILE="cluster_job.log"
+LEDGER="/cluster/nonce_ledger.txt"   # Shared nonce ledger (see nonce_ledger.h)
 
 # MCA Flags
 MCA_FLAGS="--mca orte_base_help_aggregate 0 --mca oob_tcp_listen_mode listen_thread"
@@ -22,6 +23,8 @@ MPI_HARD_TIMEOUT=5s
 > $LOG_FILE
 completed=0
 final_result=0
+chunk_id=1
+rm -f $LEDGER
 
 echo "=================================================="
 echo "   STARTING FAULT-TOLERANT JOB: $TOTAL_WORKLOAD items"
@@ -70,7 +73,7 @@ while [ $completed -lt $TOTAL_WORKLOAD ]; do
              mpirun -np $total_slots \
              --hostfile $HOSTFILE_DYN \
              $MCA_FLAGS \
-             $EXEC $this_chunk 2>&1)
+             $EXEC $this_chunk --chunk-id $chunk_id --ledger $LEDGER 2>&1)
     
     EXIT_CODE=$?
 
@@ -83,6 +86,7 @@ while [ $completed -lt $TOTAL_WORKLOAD ]; do
             echo "[SUCCESS]  Chunk finished. Result: $chunk_val"
             final_result=$((final_result + chunk_val))
             completed=$((completed + this_chunk))
+            chunk_id=$((chunk_id + 1))
             
             # Progress Bar effect
             percent=$((100 * completed / TOTAL_WORKLOAD))
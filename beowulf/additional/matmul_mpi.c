@@ -3,99 +3,250 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "gemm.h"
+#include "matrix_file.h"
+#include "thread_pool.h"
+
 /*
  * Chunk-aware MPI matrix multiply (C = A * B)
  *
  * Usage (per chunk, driven by run_chunks.sh):
  *   mpirun -np <P> ... matmul_mpi N --chunk-id K --num-chunks M
+ *                      [--kernel NAME] [--dist rows|summa|stream] [--block NB]
+ *                      [--stream-rows R] [--window W]
+ *                      [--output text|binary] [--out PATH] [--threads SPEC]
+ *                      [--A PATH --B PATH] [--readahead none|willneed|sequential]
  *
  * - N          : size of square matrices (N x N)
  * - chunk-id   : which chunk of rows this run should compute (0 .. M-1)
  * - num-chunks : total number of chunks
+ * - kernel     : GEMM micro-kernel: auto (default), avx512, avx2, scalar
+ * - dist       : data distribution (default rows, see below)
+ * - block      : block size of the 2D block-cyclic layout (summa only, default 128)
+ * - stream-rows: rows per pipelined block (stream only, default 32)
+ * - window     : blocks in flight per rank / prefetched by rank 0 (stream only, default 2)
+ * - output     : text (default) or binary, see Output below
+ * - out        : binary output file (default /cluster/results/C.bin)
+ * - threads    : threads per rank: N, auto, or a hostfile with threads=N per
+ *                host (see thread_pool.h; default 1 or $BW_THREADS)
+ * - A, B       : N x N operand files in the matrix_file.h format (default:
+ *                the synthetic matrices below)
+ * - readahead  : kernel readahead hint for the rows a rank reads from the
+ *                operand files (default willneed)
+ *
+ * Build:
+ *   mpicc -O3 -pthread -o matmul_mpi matmul_mpi.c
+ *
+ * Hybrid mode (one rank per node, all cores through the thread pool, so each
+ * node holds a single copy of A and B):
+ *   mpirun --hostfile hosts --map-by ppr:1:node matmul_mpi N --threads hosts
  *
  * Output:
- *   Rank 0 writes the rows for this chunk into:
- *     /cluster/results/C_chunk_<chunk_id>.txt
+ *   --output text: rank 0 gathers the chunk and writes its rows into
+ *     /cluster/results/C_chunk_<chunk_id>.txt   (merged by merge_chunk.sh)
+ *   --output binary: every rank writes its own part of C straight to its
+ *     final offset in ONE shared file with collective MPI-IO. The file is
+ *     the full N x N matrix in the matrix_file.h format (64-byte header +
+ *     row-major doubles), so all chunks land in the same file, no merge
+ *     step is needed and the result can be mmap'd directly.
+ *
+ * Operands:
+ *   Without --A/--B the deterministic benchmark matrices are generated:
+ *     A[i][j] = i + j
+ *     B[i][j] = i * j
+ *   With --A/--B every rank mmaps the files and touches only the rows or
+ *   tiles it needs (rows/stream modes use them in place, zero-copy), so
+ *   ranks don't each read whole files over NFS at startup. The binary
+ *   result of one run (--output binary) is a valid operand for the next.
+ *   C = A * B (cache-blocked GEMM from gemm.h, micro-kernel picked at runtime)
+ *
+ * --dist rows (default):
+ *   All ranks allocate A and B (replicated data) to keep MPI logic simple.
+ *   Each rank computes only the rows in:
+ *     intersection(rank_row_range, chunk_row_range)
+ *   and sends them to rank 0 via MPI_Gatherv (with custom displacements).
  *
- * For simplicity:
- *   A[i][j] = i + j
- *   B[i][j] = i * j
- *   C = A * B (naive O(N^3) per row)
+ * --dist summa:
+ *   Ranks form a 2D process grid and hold only their block-cyclic tiles of
+ *   the chunk's A rows, of B and of C (O(N^2 / P) memory per rank). Panels
+ *   of A and B are broadcast along grid rows/columns (SUMMA), and rank 0
+ *   assembles the chunk at the end.
  *
- * All ranks allocate A and B (replicated data) to keep MPI logic simple.
- * Each rank computes only the rows in:
- *   intersection(rank_row_range, chunk_row_range)
- * and sends them to rank 0 via MPI_Gatherv (with custom displacements).
+ * --dist stream:
+ *   Like rows (A and B replicated), but the chunk is cut into blocks of
+ *   R rows dealt round-robin to the ranks. Each rank computes block k+1
+ *   while the MPI_Isend of block k is still in flight (up to W buffers),
+ *   and rank 0 writes blocks in row order as they arrive, with only W
+ *   receives prefetched. Rank 0 therefore never holds more than a few
+ *   blocks instead of chunk_rows x N. Round-robin ownership is what lets
+ *   rank 0 write in order without waiting for whole ranks to finish.
+ *   With --output binary every rank instead posts MPI_File_iwrite_at per
+ *   block, overlapping the write of block k with computing block k+1.
+ *
+ * Every rank reports its compute time and GFLOP/s.
  */
 
+enum { DIST_ROWS, DIST_SUMMA, DIST_STREAM };
+enum { OUTPUT_TEXT, OUTPUT_BINARY };
+enum { OPERAND_A, OPERAND_B };
+
 static void die(const char *msg) {
     fprintf(stderr, "Fatal: %s\n", msg);
     MPI_Abort(MPI_COMM_WORLD, 1);
     exit(1);
 }
 
-int main(int argc, char *argv[]) {
-    int rank, size;
-    MPI_Init(&argc, &argv);
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
+/* An input matrix: a mapped matrix file, or the synthetic benchmark generator */
+typedef struct {
+    matf_map_t file;   /* file.data == NULL -> synthetic */
+    int which;         /* OPERAND_A: i + j, OPERAND_B: i * j */
+    int advice;        /* MATF_ADVISE_* for rows we read from the file */
+} operand_t;
 
-    if (argc < 2) {
-        if (rank == 0) {
-            fprintf(stderr, "Usage: %s N [--chunk-id K --num-chunks M]\n", argv[0]);
-        }
-        MPI_Finalize();
-        return 1;
+/* Map an N x N operand file. Returns 0 on success. */
+static int operand_open(operand_t *op, const char *path, int N, int rank) {
+    if (matf_map(path, &op->file) != 0) {
+        fprintf(stderr, "[Rank %d] Cannot map matrix file %s\n", rank, path);
+        return -1;
     }
+    if (op->file.hdr.rows != (uint64_t)N || op->file.hdr.cols != (uint64_t)N) {
+        fprintf(stderr, "[Rank %d] %s is %llux%llu, expected %dx%d\n", rank, path,
+                (unsigned long long)op->file.hdr.rows,
+                (unsigned long long)op->file.hdr.cols, N, N);
+        matf_unmap(&op->file);
+        return -1;
+    }
+    return 0;
+}
 
-    int N = atoi(argv[1]);
-    if (N <= 0) {
-        if (rank == 0) fprintf(stderr, "N must be > 0\n");
-        MPI_Finalize();
-        return 1;
+static double operand_at(const operand_t *op, int i, int j) {
+    if (op->file.data) return op->file.data[(size_t)i * op->file.hdr.cols + j];
+    return (op->which == OPERAND_A) ? (double)(i + j) : (double)i * (double)j;
+}
+
+/* Announce that rows [r0, r1) of a file operand are about to be read */
+static void operand_advise(const operand_t *op, int r0, int r1) {
+    if (op->file.data) matf_advise_rows(&op->file, r0, r1, op->advice);
+}
+
+/*
+ * Rows [r0, r0 + nrows) x [0, N). File operands are returned in place
+ * (zero-copy); synthetic ones are generated into scratch (nrows x N),
+ * which may be NULL for file operands.
+ */
+static const double *operand_rows(const operand_t *op, int r0, int nrows, int N,
+                                  double *scratch) {
+    if (op->file.data) {
+        operand_advise(op, r0, r0 + nrows);
+        return op->file.data + (size_t)r0 * N;
     }
+    for (int i = 0; i < nrows; i++)
+        for (int j = 0; j < N; j++)
+            scratch[(size_t)i * N + j] = operand_at(op, r0 + i, j);
+    return scratch;
+}
 
-    /* Default chunking: 1 chunk that covers all rows */
-    int chunk_id = 0;
-    int num_chunks = 1;
+/* Scratch buffer for operand_rows: NULL (not needed) for file operands */
+static double *operand_scratch(const operand_t *op, int nrows, int N) {
+    if (op->file.data) return NULL;
+    double *buf = (double *)malloc(((size_t)nrows * N + 1) * sizeof(double));
+    if (!buf) die("Not enough memory for operand rows");
+    return buf;
+}
 
-    /* Parse optional args */
-    for (int i = 2; i < argc; i++) {
-        if (strcmp(argv[i], "--chunk-id") == 0 && i + 1 < argc) {
-            chunk_id = atoi(argv[++i]);
-        } else if (strcmp(argv[i], "--num-chunks") == 0 && i + 1 < argc) {
-            num_chunks = atoi(argv[++i]);
-        }
+/*
+ * One GEMM over the thread pool. Every KC x NC panel of B is packed once
+ * (its NR-wide slivers split over the threads) and shared read-only; the
+ * threads then take GEMM_MC-row blocks of C against it, each packing A
+ * into its own Ap, allocated once per call.
+ */
+typedef struct {
+    const gemm_kernel_t *kernel;
+    const double *A;
+    int lda;
+    const double *B;
+    int ldb;
+    double *C;
+    int ldc;
+    int m, n, accumulate;
+    int jc, nc, pc, kc;         /* the current panel */
+    double *Bp;
+    double **Ap;                /* one per thread */
+} gemm_job_t;
+
+static void gemm_zero_task(long lo, long hi, int tid, void *arg) {
+    gemm_job_t *job = (gemm_job_t *)arg;
+    (void)tid;
+    for (long i = lo; i < hi; i++)
+        memset(job->C + (size_t)i * job->ldc, 0, (size_t)job->n * sizeof(double));
+}
+
+/* Slivers [lo, hi) (in units of NR columns) of the current B panel */
+static void gemm_pack_b_task(long lo, long hi, int tid, void *arg) {
+    gemm_job_t *job = (gemm_job_t *)arg;
+    int nr = job->kernel->nr, j0 = (int)lo * nr;
+    int j1 = (int)hi * nr < job->nc ? (int)hi * nr : job->nc;
+    (void)tid;
+    gemm_pack_b(job->kc, j1 - j0, nr, job->B + (size_t)job->pc * job->ldb + job->jc + j0, job->ldb,
+                job->Bp + (size_t)j0 * job->kc);
+}
+
+static void gemm_rows_task(long lo, long hi, int tid, void *arg) {
+    gemm_job_t *job = (gemm_job_t *)arg;
+    for (long ic = lo; ic < hi; ic += GEMM_MC) {
+        int mc = (hi - ic < GEMM_MC) ? (int)(hi - ic) : GEMM_MC;
+        gemm_block(job->kernel, mc, job->nc, job->kc, job->A + (size_t)ic * job->lda + job->pc, job->lda,
+                   job->Bp, job->Ap[tid], job->C + (size_t)ic * job->ldc + job->jc, job->ldc);
     }
+}
 
-    if (chunk_id < 0 || chunk_id >= num_chunks) {
-        if (rank == 0) {
-            fprintf(stderr, "Invalid chunk-id %d (num-chunks=%d)\n", chunk_id, num_chunks);
-        }
-        MPI_Finalize();
-        return 1;
+static void gemm_threaded(thread_pool_t *tp, const gemm_kernel_t *kernel,
+                          int m, int n, int k, const double *A, int lda,
+                          const double *B, int ldb, double *C, int ldc, int accumulate) {
+    gemm_job_t job = { kernel, A, lda, B, ldb, C, ldc, m, n, accumulate, 0, 0, 0, 0, NULL, NULL };
+    int nt = tp_size(tp), nr = kernel->nr;
+
+    if (nt == 1) {
+        if (gemm_with_kernel(kernel, m, n, k, A, lda, B, ldb, C, ldc, accumulate) != 0)
+            die("Not enough memory for GEMM packing buffers");
+        return;
     }
+    if (!accumulate) tp_parallel_for(tp, 0, m, 64, gemm_zero_task, &job);
+    if (m <= 0 || n <= 0 || k <= 0) return;
 
-    /* Global chunk row range [chunk_start, chunk_end) */
-    int chunk_start = (chunk_id * N) / num_chunks;
-    int chunk_end   = ((chunk_id + 1) * N) / num_chunks;
-    int chunk_rows  = chunk_end - chunk_start;
-    if (chunk_rows <= 0) {
-        /* Nothing to do for this chunk */
-        if (rank == 0) {
-            fprintf(stderr, "Chunk %d has no rows to compute (N=%d, num_chunks=%d)\n",
-                    chunk_id, N, num_chunks);
+    job.Bp = gemm_alloc_bp();
+    job.Ap = (double **)calloc(nt, sizeof(double *));
+    int failed = !job.Bp || !job.Ap;
+    for (int t = 0; !failed && t < nt; t++) failed = !(job.Ap[t] = gemm_alloc_ap());
+    if (failed) die("Not enough memory for GEMM packing buffers");
+
+    for (job.jc = 0; job.jc < n; job.jc += GEMM_NC) {
+        job.nc = (n - job.jc < GEMM_NC) ? n - job.jc : GEMM_NC;
+        for (job.pc = 0; job.pc < k; job.pc += GEMM_KC) {
+            job.kc = (k - job.pc < GEMM_KC) ? k - job.pc : GEMM_KC;
+            tp_parallel_for(tp, 0, (job.nc + nr - 1) / nr, 8, gemm_pack_b_task, &job);
+            tp_parallel_for(tp, 0, m, GEMM_MC, gemm_rows_task, &job);
         }
-        MPI_Finalize();
-        return 0;
     }
 
-    if (rank == 0) {
-        printf("[matmul] N=%d, chunk-id=%d, num-chunks=%d, rows=[%d,%d)\n",
-               N, chunk_id, num_chunks, chunk_start, chunk_end);
-        fflush(stdout);
-    }
+    for (int t = 0; t < nt; t++) free(job.Ap[t]);
+    free(job.Ap);
+    free(job.Bp);
+}
 
+/*
+ * Row distribution: every rank holds all of B plus its own rows of A and
+ * computes the rows of intersection(rank_row_range, chunk_row_range).
+ *
+ * If fh is MPI_FILE_NULL, returns the gathered chunk (chunk_rows x N) on
+ * rank 0 and NULL elsewhere. Otherwise every rank writes its rows to fh
+ * collectively and NULL is returned everywhere.
+ */
+static double *rows_chunk(int N, const operand_t *opA, const operand_t *opB,
+                          int chunk_start, int chunk_end,
+                          const gemm_kernel_t *kernel, thread_pool_t *tp,
+                          int rank, int size,
+                          const char *hostname, MPI_File fh) {
     /* Rank-specific row range [rank_start, rank_end) over all N rows */
     int rank_start = (rank * N) / size;
     int rank_end   = ((rank + 1) * N) / size;
@@ -105,18 +256,11 @@ int main(int argc, char *argv[]) {
     int local_end   = (rank_end   < chunk_end)   ? rank_end   : chunk_end;
     int local_rows  = (local_end > local_start) ? (local_end - local_start) : 0;
 
-    /* Allocate A, B (replicated on all ranks for simplicity) */
-    double *A = (double *)malloc((size_t)N * N * sizeof(double));
-    double *B = (double *)malloc((size_t)N * N * sizeof(double));
-    if (!A || !B) die("Not enough memory for A/B allocation");
-
-    /* Initialize A and B deterministically */
-    for (int i = 0; i < N; i++) {
-        for (int j = 0; j < N; j++) {
-            A[i * N + j] = (double)(i + j);
-            B[i * N + j] = (double)(i * j);
-        }
-    }
+    /* Our rows of A and all of B (replicated on all ranks for simplicity) */
+    double *A_buf = operand_scratch(opA, local_rows, N);
+    double *B_buf = operand_scratch(opB, N, N);
+    const double *A = operand_rows(opA, local_start, local_rows, N, A_buf);
+    const double *B = operand_rows(opB, 0, N, N, B_buf);
 
     /* Compute local contribution C_local (only if we have rows) */
     double *C_local = NULL;
@@ -124,24 +268,32 @@ int main(int argc, char *argv[]) {
         C_local = (double *)malloc((size_t)local_rows * N * sizeof(double));
         if (!C_local) die("Not enough memory for C_local");
 
-        for (int r = 0; r < local_rows; r++) {
-            int global_row = local_start + r;
-            for (int c = 0; c < N; c++) {
-                double sum = 0.0;
-                for (int k = 0; k < N; k++) {
-                    double a = A[global_row * N + k];
-                    double b = B[k * N + c];
-                    sum += a * b;
-                }
-                C_local[r * N + c] = sum;
-            }
-        }
+        double t0 = MPI_Wtime();
+        gemm_threaded(tp, kernel, local_rows, N, N, A, N, B, N, C_local, N, 0);
+        double t1 = MPI_Wtime();
+
+        double gflops = 2.0 * local_rows * (double)N * N / ((t1 - t0) * 1e9);
+        printf("[matmul] [Node %s | Rank %d] rows=[%d,%d) kernel=%s threads=%d "
+               "time=%.4f s | %.2f GFLOP/s\n",
+               hostname, rank, local_start, local_end, kernel->name, tp_size(tp),
+               t1 - t0, gflops);
+        fflush(stdout);
     }
 
-    free(A);
-    free(B);
+    free(A_buf);
+    free(B_buf);
+
+    if (fh != MPI_FILE_NULL) {
+        /* Rows are contiguous in the file: one collective write at our offset */
+        MPI_Offset off = MATF_HEADER_SIZE + (MPI_Offset)local_start * N * sizeof(double);
+        MPI_File_write_at_all(fh, off, C_local, local_rows * N, MPI_DOUBLE,
+                              MPI_STATUS_IGNORE);
+        free(C_local);
+        return NULL;
+    }
 
     /* Gather results on rank 0 into C_chunk (chunk_rows x N) */
+    int chunk_rows = chunk_end - chunk_start;
     double *C_chunk = NULL;
     int *recvcounts = NULL;
     int *displs = NULL;
@@ -183,30 +335,603 @@ int main(int argc, char *argv[]) {
     if (recvcounts) free(recvcounts);
     if (displs) free(displs);
 
-    /* Rank 0 writes this chunk's rows to a text file */
+    return C_chunk;
+
+}
+
+/* Number of rows/cols of an n-long block-cyclic dimension owned by iproc */
+static int numroc(int n, int nb, int iproc, int nprocs) {
+    int nblocks = n / nb;
+    int num = (nblocks / nprocs) * nb;
+    int extra = nblocks % nprocs;
+    if (iproc < extra) num += nb;
+    else if (iproc == extra) num += n % nb;
+    return num;
+}
+
+/* Local index -> global index in a block-cyclic dimension */
+static int local_to_global(int l, int nb, int iproc, int nprocs) {
+    return ((l / nb) * nprocs + iproc) * nb + l % nb;
+}
+
+/*
+ * SUMMA on a 2D block-cyclic process grid (Pr x Pc, block size nb).
+ *
+ * The chunk's slice of A (chunk_rows x N), B (N x N) and the chunk of C
+ * (chunk_rows x N) are all distributed block-cyclically, so each rank
+ * only generates and stores its own tiles (O(N^2 / P) memory). For every
+ * block column kb of A / block row kb of B, the owning grid column
+ * broadcasts its A panel along grid rows and the owning grid row
+ * broadcasts its B panel along grid columns; each rank then does a local
+ * rank-nb update C_loc += A_panel * B_panel.
+ *
+ * If fh is MPI_FILE_NULL, returns the assembled chunk (chunk_rows x N) on
+ * rank 0 and NULL elsewhere. Otherwise every rank writes its tiles to fh
+ * through a block-cyclic file view and NULL is returned everywhere.
+ */
+static double *summa_chunk(int N, const operand_t *opA, const operand_t *opB,
+                           int chunk_start, int chunk_end, int nb,
+                           const gemm_kernel_t *kernel, thread_pool_t *tp,
+                           int rank, int size,
+                           const char *hostname, MPI_File fh) {
+    int M = chunk_end - chunk_start;
+
+    /* Chunks have at most N rows, so put the smaller grid dimension on rows */
+    int dims[2] = {0, 0};
+    MPI_Dims_create(size, 2, dims);
+    int Pr = dims[1], Pc = dims[0];
+    int pr = rank / Pc, pc = rank % Pc;
+
+    MPI_Comm row_comm, col_comm;
+    MPI_Comm_split(MPI_COMM_WORLD, pr, pc, &row_comm);   /* rank in row_comm == pc */
+    MPI_Comm_split(MPI_COMM_WORLD, pc, pr, &col_comm);   /* rank in col_comm == pr */
+
+    int mloc  = numroc(M, nb, pr, Pr);   /* local rows of A and C */
+    int nloc  = numroc(N, nb, pc, Pc);   /* local cols of B and C */
+    int kloca = numroc(N, nb, pc, Pc);   /* local cols of A */
+    int klocb = numroc(N, nb, pr, Pr);   /* local rows of B */
+
+    double *A_loc   = (double *)malloc(((size_t)mloc * kloca + 1) * sizeof(double));
+    double *B_loc   = (double *)malloc(((size_t)klocb * nloc + 1) * sizeof(double));
+    double *C_loc   = (double *)malloc(((size_t)mloc * nloc + 1) * sizeof(double));
+    double *A_panel = (double *)malloc(((size_t)mloc * nb + 1) * sizeof(double));
+    double *B_panel = (double *)malloc(((size_t)nb * nloc + 1) * sizeof(double));
+    if (!A_loc || !B_loc || !C_loc || !A_panel || !B_panel)
+        die("Not enough memory for SUMMA tiles");
+
+    /* Load (or generate) only the tiles this rank owns */
+    for (int lb = 0; lb < mloc; lb += nb) {
+        int g0 = chunk_start + local_to_global(lb, nb, pr, Pr);
+        operand_advise(opA, g0, g0 + ((mloc - lb < nb) ? mloc - lb : nb));
+    }
+    for (int lb = 0; lb < klocb; lb += nb) {
+        int g0 = local_to_global(lb, nb, pr, Pr);
+        operand_advise(opB, g0, g0 + ((klocb - lb < nb) ? klocb - lb : nb));
+    }
+    for (int li = 0; li < mloc; li++) {
+        int gi = chunk_start + local_to_global(li, nb, pr, Pr);
+        for (int lk = 0; lk < kloca; lk++) {
+            int gk = local_to_global(lk, nb, pc, Pc);
+            A_loc[(size_t)li * kloca + lk] = operand_at(opA, gi, gk);
+        }
+    }
+    for (int lk = 0; lk < klocb; lk++) {
+        int gk = local_to_global(lk, nb, pr, Pr);
+        for (int lj = 0; lj < nloc; lj++) {
+            int gj = local_to_global(lj, nb, pc, Pc);
+            B_loc[(size_t)lk * nloc + lj] = operand_at(opB, gk, gj);
+        }
+    }
+    memset(C_loc, 0, (size_t)mloc * nloc * sizeof(double));
+
+    double t0 = MPI_Wtime();
+    int nkb = (N + nb - 1) / nb;
+    for (int kb = 0; kb < nkb; kb++) {
+        int w = (N - kb * nb < nb) ? N - kb * nb : nb;
+        int a_owner = kb % Pc;
+        int b_owner = kb % Pr;
+
+        if (pc == a_owner) {
+            int off = (kb / Pc) * nb;
+            for (int li = 0; li < mloc; li++)
+                memcpy(A_panel + (size_t)li * w, A_loc + (size_t)li * kloca + off,
+                       (size_t)w * sizeof(double));
+        }
+        if (pr == b_owner) {
+            int off = (kb / Pr) * nb;
+            memcpy(B_panel, B_loc + (size_t)off * nloc, (size_t)w * nloc * sizeof(double));
+        }
+
+        MPI_Bcast(A_panel, mloc * w, MPI_DOUBLE, a_owner, row_comm);
+        MPI_Bcast(B_panel, w * nloc, MPI_DOUBLE, b_owner, col_comm);
+
+        gemm_threaded(tp, kernel, mloc, nloc, w, A_panel, w, B_panel, nloc,
+                      C_loc, nloc, 1);
+    }
+    double t1 = MPI_Wtime();
+
+    double gflops = 2.0 * mloc * (double)nloc * N / ((t1 - t0) * 1e9);
+    printf("[matmul] [Node %s | Rank %d] grid=(%d,%d) of %dx%d tile=%dx%d kernel=%s "
+           "threads=%d time=%.4f s | %.2f GFLOP/s\n",
+           hostname, rank, pr, pc, Pr, Pc, mloc, nloc, kernel->name, tp_size(tp),
+           t1 - t0, gflops);
+    fflush(stdout);
+
+    free(A_loc);
+    free(B_loc);
+    free(A_panel);
+    free(B_panel);
+
+    int gsizes[2]   = {M, N};
+    int distribs[2] = {MPI_DISTRIBUTE_CYCLIC, MPI_DISTRIBUTE_CYCLIC};
+    int dargs[2]    = {nb, nb};
+    int psizes[2]   = {Pr, Pc};
+
+    if (fh != MPI_FILE_NULL) {
+        /* The chunk is rows [chunk_start, chunk_end) of the N x N file matrix */
+        MPI_Datatype ftype;
+        MPI_Type_create_darray(size, rank, 2, gsizes, distribs, dargs, psizes,
+                               MPI_ORDER_C, MPI_DOUBLE, &ftype);
+        MPI_Type_commit(&ftype);
+        MPI_Offset disp = MATF_HEADER_SIZE + (MPI_Offset)chunk_start * N * sizeof(double);
+        MPI_File_set_view(fh, disp, MPI_DOUBLE, ftype, "native", MPI_INFO_NULL);
+        MPI_File_write_all(fh, C_loc, mloc * nloc, MPI_DOUBLE, MPI_STATUS_IGNORE);
+        MPI_Type_free(&ftype);
+
+        free(C_loc);
+        MPI_Comm_free(&row_comm);
+        MPI_Comm_free(&col_comm);
+        return NULL;
+    }
+
+    /*
+     * Assemble C on rank 0. A darray datatype per source rank scatters its
+     * contiguous local tile straight into the right block-cyclic positions.
+     */
+    double *C_chunk = NULL;
+    MPI_Request *reqs = NULL;
+    MPI_Datatype *types = NULL;
     if (rank == 0) {
-        char fname[256];
-        snprintf(fname, sizeof(fname),
-                 "/cluster/results/C_chunk_%d.txt", chunk_id);
+        C_chunk = (double *)malloc((size_t)M * N * sizeof(double));
+        reqs  = (MPI_Request *)malloc(size * sizeof(MPI_Request));
+        types = (MPI_Datatype *)malloc(size * sizeof(MPI_Datatype));
+        if (!C_chunk || !reqs || !types) die("Not enough memory for C_chunk");
+
+        for (int r = 0; r < size; r++) {
+            MPI_Type_create_darray(size, r, 2, gsizes, distribs, dargs, psizes,
+                                   MPI_ORDER_C, MPI_DOUBLE, &types[r]);
+            MPI_Type_commit(&types[r]);
+            MPI_Irecv(C_chunk, 1, types[r], r, 1, MPI_COMM_WORLD, &reqs[r]);
+        }
+    }
+
+    MPI_Send(C_loc, mloc * nloc, MPI_DOUBLE, 0, 1, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        MPI_Waitall(size, reqs, MPI_STATUSES_IGNORE);
+        for (int r = 0; r < size; r++) MPI_Type_free(&types[r]);
+        free(reqs);
+        free(types);
+    }
 
-        FILE *f = fopen(fname, "w");
+    free(C_loc);
+    MPI_Comm_free(&row_comm);
+    MPI_Comm_free(&col_comm);
+    return C_chunk;
+}
+
+/* One text line per row, N numbers each (the C_chunk_<id>.txt format) */
+static void write_text_rows(FILE *f, const double *C, int rows, int N) {
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < N; c++) {
+            fprintf(f, "%.6f", C[(size_t)r * N + c]);
+            if (c != N - 1) fputc(' ', f);
+        }
+        fputc('\n', f);
+    }
+}
+
+/* State shared by the producer and consumer sides of stream mode */
+typedef struct {
+    int N, chunk_start, chunk_end, rb, nblocks;
+    const operand_t *opA;
+    const double *B;
+    double *A_blk;
+    const gemm_kernel_t *kernel;
+    thread_pool_t *tp;
+    double t_compute;
+    int blocks_done, rows_done;
+} stream_ctx_t;
+
+static int stream_block_rows(const stream_ctx_t *sc, int b) {
+    int r0 = sc->chunk_start + b * sc->rb;
+    return (sc->chunk_end - r0 < sc->rb) ? sc->chunk_end - r0 : sc->rb;
+}
+
+/* Compute block b of C into C (rb x N); A rows are fetched per block */
+static int stream_compute_block(stream_ctx_t *sc, int b, double *C) {
+    int N = sc->N;
+    int r0 = sc->chunk_start + b * sc->rb;
+    int rows = stream_block_rows(sc, b);
+    const double *A = operand_rows(sc->opA, r0, rows, N, sc->A_blk);
+
+    double t0 = MPI_Wtime();
+    gemm_threaded(sc->tp, sc->kernel, rows, N, N, A, N, sc->B, N, C, N, 0);
+    sc->t_compute += MPI_Wtime() - t0;
+    sc->blocks_done++;
+    sc->rows_done += rows;
+    return rows;
+}
+
+/* Rank 0: post the receive for the next remote block (in row order) into
+ * ring slot *post_slot. Does nothing once every block has been posted. */
+static void stream_post_next(const stream_ctx_t *sc, double *bufs, MPI_Request *reqs,
+                             int window, int size, int *next_post, int *post_slot) {
+    while (*next_post < sc->nblocks && *next_post % size == 0) (*next_post)++;
+    if (*next_post >= sc->nblocks) return;
+
+    MPI_Irecv(bufs + (size_t)*post_slot * sc->rb * sc->N,
+              stream_block_rows(sc, *next_post) * sc->N, MPI_DOUBLE,
+              *next_post % size, 2, MPI_COMM_WORLD, &reqs[*post_slot]);
+    *post_slot = (*post_slot + 1) % window;
+    (*next_post)++;
+}
+
+/*
+ * Streaming row distribution (see --dist stream above). Block b of the chunk
+ * covers rows [chunk_start + b*rb, ...) and belongs to rank b % size.
+ *
+ * Text output: rank 0 writes every block to text_out in order. Binary
+ * output: every rank writes its own blocks to fh. Always returns NULL.
+ */
+static double *stream_chunk(int N, const operand_t *opA, const operand_t *opB,
+                            int chunk_start, int chunk_end, int rb, int window,
+                            const gemm_kernel_t *kernel, thread_pool_t *tp,
+                            int rank, int size, const char *hostname,
+                            MPI_File fh, FILE *text_out) {
+    stream_ctx_t sc = { N, chunk_start, chunk_end, rb, (chunk_end - chunk_start + rb - 1) / rb,
+                        opA, NULL, NULL, kernel, tp, 0.0, 0, 0 };
+
+    /* B replicated; A is fetched one block of rows at a time */
+    double *B_buf = operand_scratch(opB, N, N);
+    double *A_blk = operand_scratch(opA, rb, N);
+    double *bufs  = (double *)malloc((size_t)window * rb * N * sizeof(double));
+    MPI_Request *reqs = (MPI_Request *)malloc(window * sizeof(MPI_Request));
+    if (!bufs || !reqs) die("Not enough memory for stream buffers");
+
+    for (int w = 0; w < window; w++) reqs[w] = MPI_REQUEST_NULL;
+    sc.B = operand_rows(opB, 0, N, N, B_buf);
+    sc.A_blk = A_blk;
+
+    double t_start = MPI_Wtime();
+
+    if (fh != MPI_FILE_NULL || rank != 0) {
+        /* Producer: compute our blocks, keep up to `window` sends/writes in flight */
+        int slot = 0;
+        for (int b = rank; b < sc.nblocks; b += size) {
+            double *C = bufs + (size_t)slot * rb * N;
+            MPI_Wait(&reqs[slot], MPI_STATUS_IGNORE);
+            int rows = stream_compute_block(&sc, b, C);
+            if (fh != MPI_FILE_NULL) {
+                MPI_Offset off = MATF_HEADER_SIZE +
+                    ((MPI_Offset)chunk_start + (MPI_Offset)b * rb) * N * sizeof(double);
+                MPI_File_iwrite_at(fh, off, C, rows * N, MPI_DOUBLE, &reqs[slot]);
+            } else {
+                MPI_Isend(C, rows * N, MPI_DOUBLE, 0, 2, MPI_COMM_WORLD, &reqs[slot]);
+            }
+            slot = (slot + 1) % window;
+        }
+        MPI_Waitall(window, reqs, MPI_STATUSES_IGNORE);
+    } else {
+        /*
+         * Rank 0, text output: walk the blocks in row order. Our own blocks
+         * are computed in place; remote ones come from a ring of `window`
+         * prefetched receives, posted in row order (messages from one
+         * source arrive in the order they were sent, so no tags needed).
+         */
+        double *own = (double *)malloc((size_t)rb * N * sizeof(double));
+        if (!own) die("Not enough memory for stream buffers");
+
+        int next_post = 0, post_slot = 0, use_slot = 0;
+        for (int w = 0; w < window; w++)
+            stream_post_next(&sc, bufs, reqs, window, size, &next_post, &post_slot);
+
+        for (int b = 0; b < sc.nblocks; b++) {
+            int rows = stream_block_rows(&sc, b);
+            if (b % size == 0) {
+                stream_compute_block(&sc, b, own);
+                write_text_rows(text_out, own, rows, N);
+                continue;
+            }
+
+            MPI_Wait(&reqs[use_slot], MPI_STATUS_IGNORE);
+            write_text_rows(text_out, bufs + (size_t)use_slot * rb * N, rows, N);
+
+            /* The slot just drained is the next one to refill */
+            stream_post_next(&sc, bufs, reqs, window, size, &next_post, &post_slot);
+            use_slot = (use_slot + 1) % window;
+        }
+        free(own);
+    }
+
+    double t_total = MPI_Wtime() - t_start;
+    double flops = 2.0 * sc.rows_done * (double)N * N;
+    printf("[matmul] [Node %s | Rank %d] stream blocks=%d rows=%d kernel=%s threads=%d "
+           "compute=%.4f s total=%.4f s | %.2f GFLOP/s\n",
+           hostname, rank, sc.blocks_done, sc.rows_done, kernel->name, tp_size(tp),
+           sc.t_compute, t_total, sc.t_compute > 0 ? flops / (sc.t_compute * 1e9) : 0.0);
+    fflush(stdout);
+
+    free(B_buf);
+    free(A_blk);
+    free(bufs);
+    free(reqs);
+    return NULL;
+}
+
+/*
+ * Open (or create) the shared binary result file and make sure it holds an
+ * N x N matrix header. Existing files from earlier chunks of the same run
+ * are kept so every chunk fills in its own rows. Collective.
+ */
+static int open_binary_output(const char *path, int N, int rank, MPI_File *fh) {
+    int rc = MPI_File_open(MPI_COMM_WORLD, path, MPI_MODE_CREATE | MPI_MODE_RDWR,
+                           MPI_INFO_NULL, fh);
+    if (rc != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Cannot open %s for MPI-IO\n", path);
+        return -1;
+    }
+
+    int ok = 1;
+    if (rank == 0) {
+        MPI_Offset fsize;
+        matf_header_t hdr;
+        MPI_File_get_size(*fh, &fsize);
+        if (fsize >= MATF_HEADER_SIZE) {
+            MPI_File_read_at(*fh, 0, &hdr, sizeof(hdr), MPI_BYTE, MPI_STATUS_IGNORE);
+            if (matf_header_check(&hdr) != 0 ||
+                hdr.rows != (uint64_t)N || hdr.cols != (uint64_t)N) {
+                fprintf(stderr, "%s exists but is not a %dx%d result matrix; "
+                        "remove it first\n", path, N, N);
+                ok = 0;
+            }
+        } else {
+            matf_header_init(&hdr, N, N);
+            MPI_File_write_at(*fh, 0, &hdr, sizeof(hdr), MPI_BYTE, MPI_STATUS_IGNORE);
+        }
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!ok) {
+        MPI_File_close(fh);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int rank, size;
+    char hostname[MPI_MAX_PROCESSOR_NAME];
+    int name_len;
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Get_processor_name(hostname, &name_len);
+
+    if (argc < 2) {
+        if (rank == 0) {
+            fprintf(stderr, "Usage: %s N [--chunk-id K --num-chunks M] [--kernel NAME] "
+                    "[--dist rows|summa|stream] [--block NB] [--stream-rows R] "
+                    "[--window W] [--output text|binary] "
+                    "[--out PATH] [--threads SPEC] [--A PATH --B PATH] "
+                    "[--readahead none|willneed|sequential]\n", argv[0]);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    int N = atoi(argv[1]);
+    if (N <= 0) {
+        if (rank == 0) fprintf(stderr, "N must be > 0\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    /* Default chunking: 1 chunk that covers all rows */
+    int chunk_id = 0;
+    int num_chunks = 1;
+    const char *kernel_name = "auto";
+    int dist = DIST_ROWS;
+    int block = 128;
+    int stream_rows = 32;
+    int window = 2;
+    int output = OUTPUT_TEXT;
+    const char *out_path = "/cluster/results/C.bin";
+    const char *threads_spec = NULL;
+    const char *a_path = NULL, *b_path = NULL;
+    int advice = MATF_ADVISE_WILLNEED;
+
+    /* Parse optional args */
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--chunk-id") == 0 && i + 1 < argc) {
+            chunk_id = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--num-chunks") == 0 && i + 1 < argc) {
+            num_chunks = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+            kernel_name = argv[++i];
+        } else if (strcmp(argv[i], "--dist") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "summa") == 0) {
+                dist = DIST_SUMMA;
+            } else if (strcmp(argv[i], "stream") == 0) {
+                dist = DIST_STREAM;
+            } else if (strcmp(argv[i], "rows") == 0) {
+                dist = DIST_ROWS;
+            } else {
+                if (rank == 0) fprintf(stderr, "Unknown --dist '%s' (rows|summa|stream)\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc) {
+            block = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stream-rows") == 0 && i + 1 < argc) {
+            stream_rows = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            window = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "binary") == 0) {
+                output = OUTPUT_BINARY;
+            } else if (strcmp(argv[i], "text") == 0) {
+                output = OUTPUT_TEXT;
+            } else {
+                if (rank == 0) fprintf(stderr, "Unknown --output '%s' (text|binary)\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads_spec = argv[++i];
+        } else if (strcmp(argv[i], "--A") == 0 && i + 1 < argc) {
+            a_path = argv[++i];
+        } else if (strcmp(argv[i], "--B") == 0 && i + 1 < argc) {
+            b_path = argv[++i];
+        } else if (strcmp(argv[i], "--readahead") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "none") == 0) {
+                advice = MATF_ADVISE_NONE;
+            } else if (strcmp(argv[i], "willneed") == 0) {
+                advice = MATF_ADVISE_WILLNEED;
+            } else if (strcmp(argv[i], "sequential") == 0) {
+                advice = MATF_ADVISE_SEQUENTIAL;
+            } else {
+                if (rank == 0) {
+                    fprintf(stderr, "Unknown --readahead '%s' (none|willneed|sequential)\n",
+                            argv[i]);
+                }
+                MPI_Finalize();
+                return 1;
+            }
+        }
+    }
+
+    if (block <= 0 || stream_rows <= 0 || window <= 0) {
+        if (rank == 0) fprintf(stderr, "--block, --stream-rows and --window must be > 0\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    const gemm_kernel_t *kernel = gemm_select_kernel(kernel_name);
+    if (!kernel) {
+        if (rank == 0) {
+            fprintf(stderr, "GEMM kernel '%s' is unknown or not supported on this CPU\n",
+                    kernel_name);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (chunk_id < 0 || chunk_id >= num_chunks) {
+        if (rank == 0) {
+            fprintf(stderr, "Invalid chunk-id %d (num-chunks=%d)\n", chunk_id, num_chunks);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    /* Global chunk row range [chunk_start, chunk_end) */
+    int chunk_start = (chunk_id * N) / num_chunks;
+    int chunk_end   = ((chunk_id + 1) * N) / num_chunks;
+    int chunk_rows  = chunk_end - chunk_start;
+    if (chunk_rows <= 0) {
+        /* Nothing to do for this chunk */
+        if (rank == 0) {
+            fprintf(stderr, "Chunk %d has no rows to compute (N=%d, num_chunks=%d)\n",
+                    chunk_id, N, num_chunks);
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    if (rank == 0) {
+        printf("[matmul] N=%d, chunk-id=%d, num-chunks=%d, rows=[%d,%d)\n",
+               N, chunk_id, num_chunks, chunk_start, chunk_end);
+        fflush(stdout);
+    }
+
+    /* Operands: mapped files, or the synthetic generator */
+    operand_t opA, opB;
+    memset(&opA, 0, sizeof(opA));
+    memset(&opB, 0, sizeof(opB));
+    opA.which = OPERAND_A;
+    opB.which = OPERAND_B;
+    opA.advice = opB.advice = advice;
+    int load_ok = 1;
+    if (a_path && operand_open(&opA, a_path, N, rank) != 0) load_ok = 0;
+    if (b_path && operand_open(&opB, b_path, N, rank) != 0) load_ok = 0;
+    MPI_Allreduce(MPI_IN_PLACE, &load_ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (!load_ok) {
+        MPI_Finalize();
+        return 1;
+    }
+
+    MPI_File fh = MPI_FILE_NULL;
+    if (output == OUTPUT_BINARY && open_binary_output(out_path, N, rank, &fh) != 0) {
+        MPI_Finalize();
+        return 1;
+    }
+
+    int nthreads = tp_resolve_threads(threads_spec, hostname, tp_ranks_on_node(MPI_COMM_WORLD));
+    nthreads = tp_mpi_threads(nthreads, provided);
+    thread_pool_t *tp = tp_create(nthreads);
+    if (!tp) die("Cannot create thread pool");
+
+    /* Rank 0 opens the text file up front so stream mode can write as it goes */
+    char fname[256];
+    snprintf(fname, sizeof(fname), "/cluster/results/C_chunk_%d.txt", chunk_id);
+    FILE *f = NULL;
+    if (output == OUTPUT_TEXT && rank == 0) {
+        f = fopen(fname, "w");
         if (!f) {
             perror("fopen C_chunk");
-            free(C_chunk);
-            MPI_Finalize();
-            return 1;
+            die("Cannot open chunk output file");
         }
+    }
 
+    double *C_chunk = NULL;
+    if (dist == DIST_SUMMA) {
+        C_chunk = summa_chunk(N, &opA, &opB, chunk_start, chunk_end, block, kernel, tp,
+                              rank, size, hostname, fh);
+    } else if (dist == DIST_STREAM) {
+        C_chunk = stream_chunk(N, &opA, &opB, chunk_start, chunk_end, stream_rows, window,
+                               kernel, tp, rank, size, hostname, fh, f);
+    } else {
+        C_chunk = rows_chunk(N, &opA, &opB, chunk_start, chunk_end, kernel, tp,
+                             rank, size, hostname, fh);
+    }
+    tp_destroy(tp);
+    if (opA.file.data) matf_unmap(&opA.file);
+    if (opB.file.data) matf_unmap(&opB.file);
+
+    if (output == OUTPUT_BINARY) {
+        MPI_File_close(&fh);
+        if (rank == 0) {
+            printf("[matmul] Wrote chunk %d rows [%d,%d) to %s (binary, MPI-IO)\n",
+                   chunk_id, chunk_start, chunk_end, out_path);
+            fflush(stdout);
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    /* Rank 0 writes this chunk's rows to a text file */
+    if (rank == 0) {
         /* We write chunk_rows lines, each with N numbers.
          * Chunks will be concatenated in order later.
+         * (Stream mode has already written them block by block.)
          */
-        for (int r = 0; r < chunk_rows; r++) {
-            for (int c = 0; c < N; c++) {
-                fprintf(f, "%.6f", C_chunk[r * N + c]);
-                if (c != N - 1) fputc(' ', f);
-            }
-            fputc('\n', f);
-        }
+        if (C_chunk) write_text_rows(f, C_chunk, chunk_rows, N);
 
         fclose(f);
         printf("[matmul] Wrote chunk %d rows [%d,%d) to %s\n",
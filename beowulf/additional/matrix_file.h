@@ -0,0 +1,131 @@
+#ifndef MATRIX_FILE_H
+#define MATRIX_FILE_H
+
+/*
+ * Binary matrix file format shared by the matmul programs.
+ *
+ *   [ 64-byte header ][ rows * cols doubles, row-major, native endianness ]
+ *
+ * The header is exactly 64 bytes so the data starts cache-line aligned and
+ * the whole file can be mmap'd and indexed as
+ *   data[(size_t)i * cols + j]  with  data = base + header.data_offset.
+ *
+ * Result files written by `matmul_mpi --output binary` use this format, and
+ * matf_map() loads the same format as input operands. Mapping is lazy: a
+ * rank only pulls the pages of the rows/tiles it actually touches over NFS.
+ * The mapping is marked MADV_RANDOM so a fault does not drag in neighbours'
+ * rows, and matf_advise_rows() can request readahead for owned rows.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MATF_MAGIC            "BWMATRIX"   /* 8 bytes, no terminator stored */
+#define MATF_VERSION          1
+#define MATF_DTYPE_F64        1
+#define MATF_LAYOUT_ROW_MAJOR 0
+#define MATF_HEADER_SIZE      64
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t dtype;        /* MATF_DTYPE_F64 */
+    uint32_t layout;       /* MATF_LAYOUT_ROW_MAJOR */
+    uint32_t elem_size;    /* sizeof(double) */
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t data_offset;  /* byte offset of element (0,0) */
+    uint8_t  reserved[16];
+} matf_header_t;
+
+_Static_assert(sizeof(matf_header_t) == MATF_HEADER_SIZE, "matrix header must be 64 bytes");
+
+static inline void matf_header_init(matf_header_t *h, uint64_t rows, uint64_t cols) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, MATF_MAGIC, sizeof(h->magic));
+    h->version     = MATF_VERSION;
+    h->dtype       = MATF_DTYPE_F64;
+    h->layout      = MATF_LAYOUT_ROW_MAJOR;
+    h->elem_size   = sizeof(double);
+    h->rows        = rows;
+    h->cols        = cols;
+    h->data_offset = MATF_HEADER_SIZE;
+}
+
+/* Returns 0 if the header describes a matrix this code can read */
+static inline int matf_header_check(const matf_header_t *h) {
+    if (memcmp(h->magic, MATF_MAGIC, sizeof(h->magic)) != 0) return -1;
+    if (h->version != MATF_VERSION) return -1;
+    if (h->dtype != MATF_DTYPE_F64 || h->elem_size != sizeof(double)) return -1;
+    if (h->layout != MATF_LAYOUT_ROW_MAJOR) return -1;
+    if (h->data_offset < MATF_HEADER_SIZE) return -1;
+    return 0;
+}
+
+/* ---------------- mmap loader ---------------- */
+
+typedef struct {
+    int fd;
+    void *base;
+    size_t length;
+    matf_header_t hdr;
+    const double *data;   /* element (0,0) */
+} matf_map_t;
+
+/* Readahead hints for matf_advise_rows */
+enum { MATF_ADVISE_NONE, MATF_ADVISE_WILLNEED, MATF_ADVISE_SEQUENTIAL };
+
+/* Map a matrix file read-only. Returns 0 on success, -1 on any error. */
+static inline int matf_map(const char *path, matf_map_t *m) {
+    struct stat st;
+    memset(m, 0, sizeof(*m));
+    m->fd = open(path, O_RDONLY);
+    if (m->fd < 0) return -1;
+    if (fstat(m->fd, &st) != 0 || st.st_size < MATF_HEADER_SIZE) goto fail;
+
+    m->length = (size_t)st.st_size;
+    m->base = mmap(NULL, m->length, PROT_READ, MAP_SHARED, m->fd, 0);
+    if (m->base == MAP_FAILED) {
+        m->base = NULL;
+        goto fail;
+    }
+
+    memcpy(&m->hdr, m->base, sizeof(m->hdr));
+    if (matf_header_check(&m->hdr) != 0) goto fail;
+    if (m->hdr.data_offset + m->hdr.rows * m->hdr.cols * sizeof(double) > m->length) goto fail;
+
+    madvise(m->base, m->length, MADV_RANDOM);
+    m->data = (const double *)((const char *)m->base + m->hdr.data_offset);
+    return 0;
+
+fail:
+    if (m->base) munmap(m->base, m->length);
+    close(m->fd);
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+    return -1;
+}
+
+/* Hint the kernel that rows [r0, r1) are about to be read */
+static inline void matf_advise_rows(const matf_map_t *m, uint64_t r0, uint64_t r1, int advice) {
+    if (advice == MATF_ADVISE_NONE || r1 <= r0) return;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = m->hdr.data_offset + r0 * m->hdr.cols * sizeof(double);
+    size_t end   = m->hdr.data_offset + r1 * m->hdr.cols * sizeof(double);
+    start -= start % page;
+    madvise((char *)m->base + start, end - start,
+            advice == MATF_ADVISE_SEQUENTIAL ? MADV_SEQUENTIAL : MADV_WILLNEED);
+}
+
+static inline void matf_unmap(matf_map_t *m) {
+    if (m->base) munmap(m->base, m->length);
+    if (m->fd >= 0) close(m->fd);
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+}
+
+#endif /* MATRIX_FILE_H */
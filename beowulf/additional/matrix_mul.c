@@ -1,8 +1,18 @@
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define N 1000  // Matrix size N x N
+#include "matrix_file.h"
+
+#define DEFAULT_N 1000  // Matrix size N x N for the synthetic matrices
+
+// Usage:
+//   mpirun -np P ./matrix_mul                 synthetic A[i] = B[i] = i + 1
+//   mpirun -np P ./matrix_mul A.bin B.bin     square operands in the
+//                                             matrix_file.h binary format
+// With files, every rank mmaps A and reads only its own rows (no scatter
+// from rank 0); B is mapped on all ranks.
 
 // Helper function to print matrix
 void print_matrix(double *mat, int rows, int cols) {
@@ -17,10 +27,32 @@ void print_matrix(double *mat, int rows, int cols) {
 
 int main(int argc, char *argv[]) {
     int rank, size;
+    int N = DEFAULT_N;
+    matf_map_t fileA, fileB;
+    int from_files = (argc == 3);
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
+    // Map the operand files (if given); every rank maps them itself
+    if (from_files) {
+        // Map both, so both are safe to unmap whichever one failed
+        int ok = (matf_map(argv[1], &fileA) == 0) & (matf_map(argv[2], &fileB) == 0);
+        if (ok && (fileA.hdr.rows != fileA.hdr.cols || fileB.hdr.rows != fileB.hdr.cols ||
+                   fileA.hdr.rows != fileB.hdr.rows)) {
+            ok = 0;
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+        if (!ok) {
+            if (rank == 0) fprintf(stderr, "Cannot load square matrices %s and %s\n", argv[1], argv[2]);
+            matf_unmap(&fileA);
+            matf_unmap(&fileB);
+            MPI_Finalize();
+            return 1;
+        }
+        N = (int)fileA.hdr.rows;
+    }
+
     int rows_per_proc = N / size;
     int remainder = N % size;
 
@@ -35,15 +67,19 @@ int main(int argc, char *argv[]) {
 
     // Allocate matrices
     double *A = NULL;
-    double *B = (double *)malloc(N * N * sizeof(double));
+    double *B = (double *)malloc((size_t)N * N * sizeof(double));
     double *C_local = (double *)malloc((end_row - start_row + 1) * N * sizeof(double));
 
     // Initialize matrix B on all processes
-    for (int i = 0; i < N * N; i++)
-        B[i] = i + 1;
+    if (from_files) {
+        memcpy(B, fileB.data, (size_t)N * N * sizeof(double));
+    } else {
+        for (int i = 0; i < N * N; i++)
+            B[i] = i + 1;
+    }
 
     // Initialize matrix A only on rank 0
-    if (rank == 0) {
+    if (rank == 0 && !from_files) {
         A = (double *)malloc(N * N * sizeof(double));
         for (int i = 0; i < N * N; i++)
             A[i] = i + 1;
@@ -61,7 +97,13 @@ int main(int argc, char *argv[]) {
     }
 
     double *A_local = (double *)malloc(sendcounts[rank] * sizeof(double));
-    MPI_Scatterv(A, sendcounts, displs, MPI_DOUBLE, A_local, sendcounts[rank], MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (from_files) {
+        // Read only our own rows straight from the mapped file
+        matf_advise_rows(&fileA, start_row, start_row + sendcounts[rank] / N, MATF_ADVISE_WILLNEED);
+        memcpy(A_local, fileA.data + displs[rank], sendcounts[rank] * sizeof(double));
+    } else {
+        MPI_Scatterv(A, sendcounts, displs, MPI_DOUBLE, A_local, sendcounts[rank], MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
 
     // Perform local multiplication
     int local_rows = end_row - start_row + 1;
@@ -94,6 +136,10 @@ int main(int argc, char *argv[]) {
     free(C_local);
     free(sendcounts);
     free(displs);
+    if (from_files) {
+        matf_unmap(&fileA);
+        matf_unmap(&fileB);
+    }
 
     MPI_Finalize();
     return 0;
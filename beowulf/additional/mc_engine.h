@@ -0,0 +1,224 @@
+#ifndef MC_ENGINE_H
+#define MC_ENGINE_H
+
+/*
+ * Hit-or-miss Monte Carlo engine shared by pi_mpi and area_mpi.
+ *
+ *   mc_options_t o;
+ *   if (mc_parse_args(argc, argv, "circle", &o) != 0) ...usage
+ *   long long hits[MC_MAX_REGIONS];
+ *   long long n = mc_run(&o, rank, size, hits);       // this rank's share
+ *   mc_report(&o, n, hits, rank);                      // reduce + CHUNK_RESULT
+ *
+ * A run estimates the area of one or more regions (--regions a,b,...) from
+ * the SAME points: every batch of MC_BATCH points is drawn once from the
+ * rank's rng.h stream and then handed to each region's kernel while it is
+ * still in L1, so a survey of several shapes pays for random numbers and
+ * the MPI launch once. Points are stored as x[] then y[] so the kernels
+ * are plain unit-stride loops that the compiler vectorizes.
+ *
+ * All regions are symmetric in both axes, so points are drawn in the
+ * quadrant [0, 1)^2 and the estimate is  scale * hits / n  (scale = 4).
+ * Kernels are generated per region by MC_KERNEL with the powers written
+ * out as multiplies (no pow(), no fabs()).
+ *
+ * --target-error E samples in rounds of MC_ROUND points per rank until
+ * every region's standard error  scale * sqrt(p (1 - p) / n)  is at most
+ * E. Round r's totals are summed with MPI_Iallreduce while round r + 1 is
+ * sampled and the decision is taken after that, so the check does not
+ * stall sampling and the stop point is reproducible. A positional
+ * iteration count is the sample budget (the cap in adaptive mode).
+ *
+ * Output (rank 0): one "CHUNK_RESULT=SAMPLES=HITS=ESTIMATE=STDERR" line for
+ * the first region, as the launch scripts expect, then one
+ * "REGION=name=SAMPLES=HITS=ESTIMATE=STDERR=EXACT" line per region.
+ *
+ * Include mpi.h first.
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rng.h"
+
+#define MC_BATCH 2048          /* points per batch (x and y: 32 KiB) */
+#define MC_ROUND (1 << 20)     /* points per rank between convergence checks */
+#define MC_MAX_REGIONS 8
+
+/* Hits among n points (x[i], y[i]) in [0, 1)^2 */
+typedef long long (*mc_kernel_fn)(const double *x, const double *y, int n);
+
+typedef struct {
+    const char *name;
+    const char *shape;
+    double scale;              /* estimate = scale * hits / n */
+    double exact;              /* true value, for the report */
+    mc_kernel_fn count;
+} mc_region_t;
+
+#define MC_KERNEL(fname, expr)                                            \
+    static long long fname(const double *x, const double *y, int n) {    \
+        long long hits = 0;                                               \
+        for (int i = 0; i < n; i++) {                                     \
+            double a = x[i], b = y[i];                                    \
+            hits += (expr) <= 1.0;                                        \
+        }                                                                 \
+        return hits;                                                      \
+    }
+
+MC_KERNEL(mc_kernel_diamond,  a + b)
+MC_KERNEL(mc_kernel_circle,   a * a + b * b)
+MC_KERNEL(mc_kernel_island,   a * a * a + b * b * b)
+MC_KERNEL(mc_kernel_squircle, (a * a) * (a * a) + (b * b) * (b * b))
+MC_KERNEL(mc_kernel_super6,   (a * a * a) * (a * a * a) + (b * b * b) * (b * b * b))
+
+/* Exact areas of |x|^p + |y|^p <= 1: 4 Gamma(1 + 1/p)^2 / Gamma(1 + 2/p) */
+static const mc_region_t mc_regions[] = {
+    { "circle",   "x^2 + y^2 <= 1 (area = pi)", 4.0, 3.14159265358979324, mc_kernel_circle },
+    { "island",   "|x|^3 + |y|^3 <= 1",         4.0, 3.53327750057090200, mc_kernel_island },
+    { "diamond",  "|x| + |y| <= 1",             4.0, 2.0,                 mc_kernel_diamond },
+    { "squircle", "x^4 + y^4 <= 1",             4.0, 3.70814935460274500, mc_kernel_squircle },
+    { "super6",   "x^6 + y^6 <= 1",             4.0, 3.85524259331999700, mc_kernel_super6 },
+};
+
+typedef struct {
+    long long total_iters;     /* LLONG_MAX if no count was given */
+    int capped;                /* a count was given */
+    double target_error;       /* 0: fixed count */
+    unsigned long long seed;
+    long chunk;
+    int nregions;
+    const mc_region_t *regions[MC_MAX_REGIONS];
+} mc_options_t;
+
+static inline void mc_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <iterations> [--seed S] [--chunk-id C] [--target-error E]"
+                    " [--regions a,b,...]\n", prog);
+    fprintf(stderr, "       %s [max_iterations] --target-error E ...\nRegions:\n", prog);
+    for (size_t i = 0; i < sizeof(mc_regions) / sizeof(mc_regions[0]); i++)
+        fprintf(stderr, "  %-9s %s\n", mc_regions[i].name, mc_regions[i].shape);
+}
+
+/* Comma-separated region names into o->regions. Returns 0, or -1 if one is
+ * unknown or there are too many. */
+static inline int mc_select_regions(const char *list, mc_options_t *o) {
+    o->nregions = 0;
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        const mc_region_t *found = NULL;
+        for (size_t i = 0; i < sizeof(mc_regions) / sizeof(mc_regions[0]); i++)
+            if (strlen(mc_regions[i].name) == len && strncmp(mc_regions[i].name, list, len) == 0)
+                found = &mc_regions[i];
+        if (!found || o->nregions == MC_MAX_REGIONS) return -1;
+        o->regions[o->nregions++] = found;
+        list += len;
+        if (*list == ',') list++;
+    }
+    return o->nregions > 0 ? 0 : -1;
+}
+
+/* Returns 0, or -1 on a bad command line */
+static inline int mc_parse_args(int argc, char **argv, const char *default_regions, mc_options_t *o) {
+    const char *iters_arg = NULL, *regions = default_regions;
+    memset(o, 0, sizeof(*o));
+    o->seed = 1;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--seed") == 0 && a + 1 < argc) o->seed = strtoull(argv[++a], NULL, 10);
+        else if (strcmp(argv[a], "--chunk-id") == 0 && a + 1 < argc) o->chunk = atol(argv[++a]);
+        else if (strcmp(argv[a], "--num-chunks") == 0 && a + 1 < argc) a++;
+        else if (strcmp(argv[a], "--regions") == 0 && a + 1 < argc) regions = argv[++a];
+        else if (strcmp(argv[a], "--target-error") == 0 && a + 1 < argc) {
+            o->target_error = atof(argv[++a]);
+            if (!(o->target_error > 0.0)) return -1;
+        }
+        else if (!iters_arg) iters_arg = argv[a];
+        else return -1;
+    }
+    if (!iters_arg && o->target_error == 0.0) return -1;
+    o->capped = iters_arg != NULL;
+    o->total_iters = iters_arg ? atoll(iters_arg) : LLONG_MAX;
+    if (o->total_iters < 0) return -1;
+    return mc_select_regions(regions, o);
+}
+
+/* hits[r] += hits of region r among the next n points of the stream */
+static inline void mc_sample(rng_t *rng, const mc_options_t *o, long long n, long long *hits) {
+    double u[2 * MC_BATCH];
+    for (long long i = 0; i < n; i += MC_BATCH) {
+        int points = n - i < MC_BATCH ? (int)(n - i) : MC_BATCH;
+        rng_uniform(rng, u, 2 * (size_t)points);      /* x[points] then y[points] */
+        for (int r = 0; r < o->nregions; r++)
+            hits[r] += o->regions[r]->count(u, u + points, points);
+    }
+}
+
+static inline double mc_std_error(const mc_region_t *reg, long long n, long long hits) {
+    if (n <= 0) return 0.0;
+    double p = (double)hits / (double)n;
+    return reg->scale * sqrt(p * (1.0 - p) / (double)n);
+}
+
+/* Sample this rank's share (fixed count or until the target error, see the
+ * top of this file). Fills hits[0..nregions) and returns the points used. */
+static inline long long mc_run(const mc_options_t *o, int rank, int size, long long *hits) {
+    rng_t rng;
+    rng_init(&rng, o->seed, (uint32_t)o->chunk, (uint32_t)rank);
+    /* The first total_iters % size ranks take one more */
+    long long mine = o->total_iters / size + (rank < o->total_iters % size);
+    memset(hits, 0, MC_MAX_REGIONS * sizeof(long long));
+
+    if (o->target_error == 0.0) {
+        mc_sample(&rng, o, mine, hits);
+        return mine;
+    }
+
+    /* local[0] = points, local[1 + r] = hits; sums[] of the previous
+     * round are in flight while this one is sampled */
+    long long local[1 + MC_MAX_REGIONS] = { 0 }, sent[1 + MC_MAX_REGIONS], sums[1 + MC_MAX_REGIONS];
+    int count = 1 + o->nregions;
+    MPI_Request req = MPI_REQUEST_NULL;
+    for (int round = 0;; round++) {
+        long long n = mine - local[0] < MC_ROUND ? mine - local[0] : MC_ROUND;
+        mc_sample(&rng, o, n, local + 1);
+        local[0] += n;
+        if (round > 0) {
+            MPI_Wait(&req, MPI_STATUS_IGNORE);
+            int done = 1;
+            for (int r = 0; r < o->nregions; r++) {
+                long long h = sums[1 + r];
+                if (h <= 0 || h >= sums[0] || mc_std_error(o->regions[r], sums[0], h) > o->target_error)
+                    done = 0;
+            }
+            if (done || (o->capped && sums[0] >= o->total_iters)) break;
+        }
+        memcpy(sent, local, count * sizeof(long long));
+        MPI_Iallreduce(sent, sums, count, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD, &req);
+    }
+    memcpy(hits, local + 1, o->nregions * sizeof(long long));
+    return local[0];
+}
+
+/* Sum everyone's counts on rank 0 and print the result lines */
+static inline void mc_report(const mc_options_t *o, long long n, const long long *hits, int rank) {
+    long long local[1 + MC_MAX_REGIONS], total[1 + MC_MAX_REGIONS];
+    int count = 1 + o->nregions;
+    local[0] = n;
+    memcpy(local + 1, hits, o->nregions * sizeof(long long));
+    MPI_Reduce(local, total, count, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank != 0) return;
+
+    for (int r = 0; r < o->nregions; r++) {
+        const mc_region_t *reg = o->regions[r];
+        double est = total[0] > 0 ? reg->scale * total[1 + r] / (double)total[0] : 0.0;
+        double err = mc_std_error(reg, total[0], total[1 + r]);
+        if (r == 0)
+            printf("CHUNK_RESULT=%lld=%lld=%.10f=%.3g\n", total[0], total[1], est, err);
+        printf("REGION=%s=%lld=%lld=%.10f=%.3g=%.10f\n", reg->name, total[0], total[1 + r], est, err,
+               reg->exact);
+    }
+}
+
+#endif /* MC_ENGINE_H */
@@ -10,6 +10,10 @@
 #
 # Result:
 #   /cluster/results/C_full.txt
+#
+# Only needed for text output. Runs with `matmul_mpi ... --output binary`
+# write every chunk straight into one shared file (/cluster/results/C.bin)
+# and need no merge step.
 
 RESULT_DIR="/cluster/results"
 OUT_FILE="$RESULT_DIR/C_full.txt"
@@ -1,68 +1,110 @@
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <string.h>
 
-// Defines how "heavy" the calculation is. 
-// Increase this to make the CPU work harder without changing the result count.
-#define COMPLEXITY 1000 
+#include "sha256.h"
+#include "nonce_ledger.h"
+
+// Each item is one real SHA-256d hash of a block header with nonce = item
+// (see sha256.h, 16 or 8 nonces at a time with AVX-512 / AVX2). An item
+// is "gold" if the hash is below the target: its top DIFFICULTY bits are
+// zero, about 1 in 1000 items, like the old 0.77... test.
+//
+// Usage: mining_demo [chunk_size] [--chunk-id C] [--ledger FILE]
+// Chunk C hashes its own range of items: the one the ledger reserves for
+// it (launcher.sh passes /cluster/nonce_ledger.txt, see nonce_ledger.h),
+// else C * 2^32 + [0, chunk_size). With a ledger, a resubmitted chunk only
+// hashes what earlier attempts did not commit.
+//
+// --first stops every rank at the first gold item (see search_stop.h) and
+// prints "CHUNK_RESULT: <found> nonce=<item>|none seconds=<time to it>".
+#define DIFFICULTY 10
 
 int main(int argc, char *argv[]) {
     int rank, size;
-    long long chunk_size, i;
-    int j;
+    long long chunk_size = 1000000;
+    long chunk = 0;
+    const char *ledger_path = NULL;
+    int first_only = 0;
     long long local_found = 0, global_found = 0;
-    double val;
+    char hostname[MPI_MAX_PROCESSOR_NAME];
+    int len;
 
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Get_processor_name(hostname, &len);
 
     // 1. READ CHUNK SIZE FROM SCRIPT
-    if (argc > 1) {
-        chunk_size = atoll(argv[1]); 
-    } else {
-        chunk_size = 1000000; 
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--chunk-id") == 0 && a + 1 < argc) chunk = atol(argv[++a]);
+        else if (strcmp(argv[a], "--ledger") == 0 && a + 1 < argc) ledger_path = argv[++a];
+        else if (strcmp(argv[a], "--first") == 0) first_only = 1;
+        else chunk_size = atoll(argv[a]);
+    }
+    if (chunk_size < 0 || chunk < 0) {
+        if (rank == 0) fprintf(stderr, "Bad chunk size or --chunk-id\n");
+        MPI_Finalize();
+        return 1;
     }
 
-    // Determine workload per node
-    long long items_per_node = chunk_size / size;
-    
-    // We use a "random" start offset based on the chunk size 
-    // to simulate searching different parts of a blockchain
-    // (This is just a dummy offset to make the math vary per chunk)
-    long long start_offset = chunk_size * rank; 
+    // Determine workload per node: an even share of the chunk's items that
+    // no earlier attempt has committed
+    ledger_t ledger;
+    if (ledger_open(&ledger, ledger_path, chunk, (uint64_t)chunk_size, MPI_COMM_WORLD) != 0 && rank == 0)
+        fprintf(stderr, "Chunk %ld is in the ledger with %llu items; using that\n", chunk,
+                (unsigned long long)ledger.count);
+    chunk_size = (long long)ledger.count;
+    ledger_range_t *mine = (ledger_range_t *)malloc((ledger.nopen + 1) * sizeof(ledger_range_t));
+    int nmine = ledger_share(&ledger, rank, size, mine);
+    if (first_only && ledger.salvaged_found > 0) nmine = 0;   // solved by an earlier attempt
 
-    // 2. HEAVY MINING CALCULATION
-    for (i = 0; i < items_per_node; i++) {
-        
-        // The "Block Header" we are hashing
-        long long current_item = start_offset + i;
-        
-        // Perform a computationally expensive operation
-        // This simulates the SHA-256 hashing in Bitcoin
-        val = current_item;
-        for(j = 0; j < COMPLEXITY; j++) {
-            val = sin(val) * cos(val) + tan(sqrt(fabs(val)));
-        }
+    // 2. HEAVY MINING CALCULATION: hash the "Block Header" once per item
+    unsigned char header[80];
+    sha256_job_t job;
+    sha256_demo_header(header);
+    sha256_job_init(&job, header);
+    const sha256_kernel_t *kernel = sha256_select_kernel(NULL);
 
-        // 3. THE "DIFFICULTY" CHECK
-        // We look for a specific mathematical property (The "Gold Nugget")
-        // Check if the first decimal digit is '7' and second is '7' (e.g. 0.77...)
-        double decimal_part = val - floor(val);
-        if (decimal_part > 0.77 && decimal_part < 0.771) {
-            local_found++;
-        }
-    }
+    // 3. THE "DIFFICULTY" CHECK is done by the kernel
+    uint64_t winner, hashed, solution = UINT64_MAX;
+    double solve_seconds = 0.0, stop_lag = 0.0;
+    search_stop_t stop;
+    if (first_only) search_stop_open(&stop, MPI_COMM_WORLD);
+    double t0 = MPI_Wtime();
+    local_found = (long long)ledger_mine(&ledger, mine, nmine, kernel, &job, DIFFICULTY,
+                                         first_only ? &stop : NULL, &hashed, &winner);
+    double seconds = MPI_Wtime() - t0;
+    long long items_per_node = (long long)hashed;
+    if (first_only) search_stop_close(&stop, &solution, &solve_seconds, &stop_lag);
+
+    printf("[Node: %s] Rank %d hashed %lld items | Found %lld | %.2f MH/s (%s)\n", hostname, rank,
+           items_per_node, local_found, seconds > 0 ? items_per_node / seconds / 1e6 : 0.0, kernel->name);
+    fflush(stdout);
+    sha256_report_rate(MPI_COMM_WORLD, hostname, rank, (uint64_t)items_per_node, seconds);
 
     // 4. AGGREGATE "GOLD" FOUND
     MPI_Reduce(&local_found, &global_found, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
 
     // 5. PRINT OUTPUT FOR BASH SCRIPT
     if (rank == 0) {
-        printf("CHUNK_RESULT: %lld\n", global_found);
+        global_found += (long long)ledger.salvaged_found;
+        if (!first_only) {
+            printf("CHUNK_RESULT: %lld\n", global_found);
+        } else {
+            if (ledger.salvaged_found > 0 && ledger.salvaged_first < solution) solution = ledger.salvaged_first;
+            if (solution != UINT64_MAX)
+                printf("Solved: item %llu after %.6f s; all ranks stopped %.3f ms later\n",
+                       (unsigned long long)solution, solve_seconds, stop_lag * 1e3);
+            printf("CHUNK_RESULT: %lld nonce=", global_found);
+            if (solution != UINT64_MAX) printf("%llu seconds=%.6f\n", (unsigned long long)solution, solve_seconds);
+            else printf("none seconds=%.6f\n", seconds);
+        }
     }
 
+    ledger_close(&ledger);
+    free(mine);
     MPI_Finalize();
     return 0;
 }
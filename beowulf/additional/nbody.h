@@ -0,0 +1,436 @@
+#ifndef NBODY_H
+#define NBODY_H
+
+/*
+ * Structure-of-arrays star storage and the direct-sum force kernel shared
+ * by the galaxy programs.
+ *
+ *   stars_t s;
+ *   stars_alloc(&s, n);                        // x, y, mass, vx, vy
+ *   const nbody_kernel_t *k = nbody_select_kernel(NULL);
+ *   k->run(s.x, s.y, s.mass, s.n_pad, s.x[i], s.y[i], &ax, &ay);
+ *   s.vx[i] += G * s.mass[i] * ax;             // G * m_i hoisted out of j
+ *
+ * The five arrays are 64-byte aligned slices of one block (so a whole
+ * state is one MPI_Bcast / fwrite), padded to NBODY_PAD entries with
+ * massless stars at the origin, so kernels run over n_pad without a tail.
+ *
+ * Kernels return  sum_j m_j * d_ij / max(|d_ij|^2, 1)^(3/2), which is the
+ * original galaxy loop with its "distance < 1.0 -> 1.0" clamp done as a
+ * branch-free max. The i == j term has d = 0 and drops out by itself.
+ * The SIMD kernels compute 1/sqrt with the hardware reciprocal square root
+ * estimate plus Newton steps (to full double precision) instead of a
+ * sqrt and two divisions per pair.
+ *
+ * When mpi.h is included first, the ring exchange at the bottom of this
+ * file is available too.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NBODY_X86 1
+#endif
+
+#define NBODY_PAD 16   /* widest kernel step (2 x 8 doubles) */
+
+typedef struct {
+    int n, n_pad;
+    double *x, *y, *mass, *vx, *vy;
+    double *block;     /* 5 * n_pad doubles backing the arrays above */
+} stars_t;
+
+/* Returns 0, or -1 on allocation failure. All fields start zeroed. */
+static inline int stars_alloc(stars_t *s, int n) {
+    memset(s, 0, sizeof(*s));
+    s->n = n;
+    s->n_pad = (n + NBODY_PAD - 1) / NBODY_PAD * NBODY_PAD;
+    size_t bytes = 5 * (size_t)s->n_pad * sizeof(double);
+    if (bytes == 0) bytes = 64;   /* empty set: keep a valid pointer */
+    s->block = (double *)aligned_alloc(64, bytes);
+    if (!s->block) return -1;
+    memset(s->block, 0, bytes);
+    s->x    = s->block;
+    s->y    = s->x + s->n_pad;
+    s->mass = s->y + s->n_pad;
+    s->vx   = s->mass + s->n_pad;
+    s->vy   = s->vx + s->n_pad;
+    return 0;
+}
+
+static inline void stars_free(stars_t *s) {
+    free(s->block);
+    memset(s, 0, sizeof(*s));
+}
+
+/* Kernel: (*ax, *ay) = sum over j < n (n a multiple of NBODY_PAD) */
+typedef void (*nbody_kernel_fn)(const double *x, const double *y, const double *m,
+                                int n, double xi, double yi, double *ax, double *ay);
+
+typedef struct {
+    const char *name;
+    nbody_kernel_fn run;
+} nbody_kernel_t;
+
+/* ---------------- Kernels ---------------- */
+
+static void nbody_kernel_scalar(const double *x, const double *y, const double *m,
+                                int n, double xi, double yi, double *ax, double *ay) {
+    double sx = 0.0, sy = 0.0;
+    for (int j = 0; j < n; j++) {
+        double dx = x[j] - xi;
+        double dy = y[j] - yi;
+        double r2 = dx * dx + dy * dy;
+        r2 = r2 < 1.0 ? 1.0 : r2;
+        double inv = 1.0 / sqrt(r2);
+        double w = m[j] * inv * inv * inv;
+        sx += w * dx;
+        sy += w * dy;
+    }
+    *ax = sx;
+    *ay = sy;
+}
+
+#ifdef NBODY_X86
+/* One Newton step for 1/sqrt(r2): y *= 1.5 - 0.5 * r2 * y^2 */
+__attribute__((target("avx2,fma")))
+static inline __m256d nbody_newton_avx2(__m256d r2h, __m256d y) {
+    __m256d t = _mm256_mul_pd(r2h, _mm256_mul_pd(y, y));
+    return _mm256_mul_pd(y, _mm256_sub_pd(_mm256_set1_pd(1.5), t));
+}
+
+/* w = m / max(r2, 1)^1.5 for 4 pairs */
+__attribute__((target("avx2,fma")))
+static inline __m256d nbody_weight_avx2(__m256d r2, __m256d m) {
+    r2 = _mm256_max_pd(r2, _mm256_set1_pd(1.0));
+    /* 12-bit float estimate, three Newton steps -> full double precision */
+    __m256d y = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+    __m256d r2h = _mm256_mul_pd(r2, _mm256_set1_pd(0.5));
+    y = nbody_newton_avx2(r2h, y);
+    y = nbody_newton_avx2(r2h, y);
+    y = nbody_newton_avx2(r2h, y);
+    return _mm256_mul_pd(m, _mm256_mul_pd(y, _mm256_mul_pd(y, y)));
+}
+
+__attribute__((target("avx2,fma")))
+static void nbody_kernel_avx2(const double *x, const double *y, const double *m,
+                              int n, double xi, double yi, double *ax, double *ay) {
+    __m256d vxi = _mm256_set1_pd(xi), vyi = _mm256_set1_pd(yi);
+    /* Two independent accumulator pairs to hide the FMA latency */
+    __m256d sx0 = _mm256_setzero_pd(), sy0 = _mm256_setzero_pd();
+    __m256d sx1 = _mm256_setzero_pd(), sy1 = _mm256_setzero_pd();
+
+    for (int j = 0; j < n; j += 8) {
+        __m256d dx0 = _mm256_sub_pd(_mm256_load_pd(x + j), vxi);
+        __m256d dy0 = _mm256_sub_pd(_mm256_load_pd(y + j), vyi);
+        __m256d dx1 = _mm256_sub_pd(_mm256_load_pd(x + j + 4), vxi);
+        __m256d dy1 = _mm256_sub_pd(_mm256_load_pd(y + j + 4), vyi);
+        __m256d r0 = _mm256_fmadd_pd(dx0, dx0, _mm256_mul_pd(dy0, dy0));
+        __m256d r1 = _mm256_fmadd_pd(dx1, dx1, _mm256_mul_pd(dy1, dy1));
+        __m256d w0 = nbody_weight_avx2(r0, _mm256_load_pd(m + j));
+        __m256d w1 = nbody_weight_avx2(r1, _mm256_load_pd(m + j + 4));
+        sx0 = _mm256_fmadd_pd(w0, dx0, sx0); sy0 = _mm256_fmadd_pd(w0, dy0, sy0);
+        sx1 = _mm256_fmadd_pd(w1, dx1, sx1); sy1 = _mm256_fmadd_pd(w1, dy1, sy1);
+    }
+
+    double bx[4], by[4];
+    _mm256_storeu_pd(bx, _mm256_add_pd(sx0, sx1));
+    _mm256_storeu_pd(by, _mm256_add_pd(sy0, sy1));
+    *ax = (bx[0] + bx[1]) + (bx[2] + bx[3]);
+    *ay = (by[0] + by[1]) + (by[2] + by[3]);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d nbody_weight_avx512(__m512d r2, __m512d m) {
+    r2 = _mm512_max_pd(r2, _mm512_set1_pd(1.0));
+    /* 14-bit estimate, two Newton steps */
+    __m512d y = _mm512_rsqrt14_pd(r2);
+    __m512d r2h = _mm512_mul_pd(r2, _mm512_set1_pd(0.5));
+    __m512d t;
+    t = _mm512_fnmadd_pd(_mm512_mul_pd(r2h, y), y, _mm512_set1_pd(1.5));
+    y = _mm512_mul_pd(y, t);
+    t = _mm512_fnmadd_pd(_mm512_mul_pd(r2h, y), y, _mm512_set1_pd(1.5));
+    y = _mm512_mul_pd(y, t);
+    return _mm512_mul_pd(m, _mm512_mul_pd(y, _mm512_mul_pd(y, y)));
+}
+
+__attribute__((target("avx512f")))
+static void nbody_kernel_avx512(const double *x, const double *y, const double *m,
+                                int n, double xi, double yi, double *ax, double *ay) {
+    __m512d vxi = _mm512_set1_pd(xi), vyi = _mm512_set1_pd(yi);
+    __m512d sx0 = _mm512_setzero_pd(), sy0 = _mm512_setzero_pd();
+    __m512d sx1 = _mm512_setzero_pd(), sy1 = _mm512_setzero_pd();
+
+    for (int j = 0; j < n; j += 16) {
+        __m512d dx0 = _mm512_sub_pd(_mm512_load_pd(x + j), vxi);
+        __m512d dy0 = _mm512_sub_pd(_mm512_load_pd(y + j), vyi);
+        __m512d dx1 = _mm512_sub_pd(_mm512_load_pd(x + j + 8), vxi);
+        __m512d dy1 = _mm512_sub_pd(_mm512_load_pd(y + j + 8), vyi);
+        __m512d r0 = _mm512_fmadd_pd(dx0, dx0, _mm512_mul_pd(dy0, dy0));
+        __m512d r1 = _mm512_fmadd_pd(dx1, dx1, _mm512_mul_pd(dy1, dy1));
+        __m512d w0 = nbody_weight_avx512(r0, _mm512_load_pd(m + j));
+        __m512d w1 = nbody_weight_avx512(r1, _mm512_load_pd(m + j + 8));
+        sx0 = _mm512_fmadd_pd(w0, dx0, sx0); sy0 = _mm512_fmadd_pd(w0, dy0, sy0);
+        sx1 = _mm512_fmadd_pd(w1, dx1, sx1); sy1 = _mm512_fmadd_pd(w1, dy1, sy1);
+    }
+
+    *ax = _mm512_reduce_add_pd(_mm512_add_pd(sx0, sx1));
+    *ay = _mm512_reduce_add_pd(_mm512_add_pd(sy0, sy1));
+}
+#endif /* NBODY_X86 */
+
+static const nbody_kernel_t nbody_kernels[] = {
+#ifdef NBODY_X86
+    { "avx512", nbody_kernel_avx512 },
+    { "avx2",   nbody_kernel_avx2 },
+#endif
+    { "scalar", nbody_kernel_scalar },
+};
+
+static inline int nbody_kernel_supported(const char *name) {
+#ifdef NBODY_X86
+    if (strcmp(name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+    if (strcmp(name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+/*
+ * Pick a kernel. name == NULL (or "auto") selects the widest one this CPU
+ * supports; otherwise the named kernel is returned if usable, else NULL.
+ */
+static inline const nbody_kernel_t *nbody_select_kernel(const char *name) {
+    int n = (int)(sizeof(nbody_kernels) / sizeof(nbody_kernels[0]));
+    return (const nbody_kernel_t *)cpu_kernel_select(nbody_kernels, n, sizeof(nbody_kernels[0]), name,
+                                                     nbody_kernel_supported);
+}
+
+/* Kick and drift: v += G * m * a * dt, then x += v * dt (the original
+ * update "vx += ax" is dt = 1) */
+static inline void nbody_step(stars_t *s, const double *ax, const double *ay, double G, double dt) {
+    for (int i = 0; i < s->n; i++) {
+        double gm = G * s->mass[i];
+        s->vx[i] += gm * ax[i] * dt;
+        s->vy[i] += gm * ay[i] * dt;
+        s->x[i] += s->vx[i] * dt;
+        s->y[i] += s->vy[i] * dt;
+    }
+}
+
+/* Forces on a set of local stars from one block of (other) stars */
+typedef struct {
+    const stars_t *local;
+    double *ax, *ay;                 /* per local star, accumulated into */
+    const nbody_kernel_t *kernel;
+    const double *bx, *by, *bm;      /* current block */
+    int bn_pad;
+} nbody_accum_t;
+
+/* ax/ay[i] += sum over the current block, for local stars [lo, hi) */
+static inline void nbody_accum_range(nbody_accum_t *a, int lo, int hi) {
+    for (int i = lo; i < hi; i++) {
+        double ax, ay;
+        a->kernel->run(a->bx, a->by, a->bm, a->bn_pad, a->local->x[i], a->local->y[i], &ax, &ay);
+        a->ax[i] += ax;
+        a->ay[i] += ay;
+    }
+}
+
+/* Contiguous block of star indices owned by a rank (last rank takes the rest) */
+static inline void nbody_block_range(int n, int rank, int size, int *start, int *end) {
+    int per = n / size;
+    *start = rank * per;
+    *end = (rank == size - 1) ? n : *start + per;
+}
+
+#ifdef MPI_VERSION
+/*
+ * Systolic ring (include mpi.h before this header). Every rank holds only
+ * its own stars; the (x, y, mass) blocks travel around the ring, so after
+ * `size` stages each rank has seen every block once. The next block is
+ * already in flight (Isend/Irecv) while the current one is being computed,
+ * and a rank never holds more than two foreign blocks: O(N/P) memory.
+ *
+ *   nbody_ring_init(&ring, local.n, comm);
+ *   nbody_ring_pass(&ring, &local, fn, arg);   // fn(x, y, m, n_pad, arg) per block
+ */
+
+/* Called once per stage with the block held at that stage (padded with
+ * massless stars up to n_pad, a multiple of NBODY_PAD) */
+typedef void (*nbody_block_fn)(const double *x, const double *y, const double *m,
+                               int n_pad, void *arg);
+
+typedef struct {
+    MPI_Comm comm;
+    int rank, size;
+    int *counts, *displs;  /* stars per rank and first global index */
+    int max_pad;           /* largest block, padded to NBODY_PAD */
+    double *buf[2];        /* x | y | mass of a travelling block, max_pad each */
+} nbody_ring_t;
+
+static inline void nbody_ring_free(nbody_ring_t *r) {
+    free(r->counts);
+    free(r->displs);
+    free(r->buf[0]);
+    free(r->buf[1]);
+    memset(r, 0, sizeof(*r));
+}
+
+/* Collective over comm. Returns 0, or -1 on allocation failure. */
+static inline int nbody_ring_init(nbody_ring_t *r, int local_n, MPI_Comm comm) {
+    memset(r, 0, sizeof(*r));
+    r->comm = comm;
+    MPI_Comm_rank(comm, &r->rank);
+    MPI_Comm_size(comm, &r->size);
+    r->counts = (int *)malloc(r->size * sizeof(int));
+    r->displs = (int *)malloc(r->size * sizeof(int));
+    if (!r->counts || !r->displs) {
+        nbody_ring_free(r);
+        return -1;
+    }
+    MPI_Allgather(&local_n, 1, MPI_INT, r->counts, 1, MPI_INT, comm);
+
+    int max = 0;
+    for (int p = 0; p < r->size; p++) {
+        r->displs[p] = p == 0 ? 0 : r->displs[p - 1] + r->counts[p - 1];
+        if (r->counts[p] > max) max = r->counts[p];
+    }
+    r->max_pad = (max + NBODY_PAD - 1) / NBODY_PAD * NBODY_PAD;
+    if (r->max_pad == 0) r->max_pad = NBODY_PAD;
+    for (int b = 0; b < 2; b++) {
+        r->buf[b] = (double *)aligned_alloc(64, 3 * (size_t)r->max_pad * sizeof(double));
+        if (!r->buf[b]) {
+            nbody_ring_free(r);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Run fn against every rank's block, own block first. Collective. */
+static inline void nbody_ring_pass(nbody_ring_t *r, const stars_t *local,
+                            nbody_block_fn fn, void *arg) {
+    int cap = r->max_pad;
+    int next = (r->rank + 1) % r->size;
+    int prev = (r->rank - 1 + r->size) % r->size;
+    double *cur = r->buf[0], *nxt = r->buf[1];
+
+    /* Padding stays massless, so a block can be used up to its n_pad */
+    memset(cur, 0, 3 * (size_t)cap * sizeof(double));
+    memcpy(cur,           local->x,    local->n * sizeof(double));
+    memcpy(cur + cap,     local->y,    local->n * sizeof(double));
+    memcpy(cur + 2 * cap, local->mass, local->n * sizeof(double));
+
+    for (int stage = 0; stage < r->size; stage++) {
+        MPI_Request req[2];
+        int nreq = 0;
+        if (stage < r->size - 1) {
+            MPI_Irecv(nxt, 3 * cap, MPI_DOUBLE, prev, 0, r->comm, &req[nreq++]);
+            MPI_Isend(cur, 3 * cap, MPI_DOUBLE, next, 0, r->comm, &req[nreq++]);
+        }
+
+        int owner = (r->rank - stage + r->size) % r->size;
+        int n_pad = (r->counts[owner] + NBODY_PAD - 1) / NBODY_PAD * NBODY_PAD;
+        fn(cur, cur + cap, cur + 2 * cap, n_pad, arg);
+
+        MPI_Waitall(nreq, req, MPI_STATUSES_IGNORE);
+        double *t = cur; cur = nxt; nxt = t;
+    }
+}
+
+/* nbody_block_fn that runs nbody_accum_range over all local stars (arg is
+ * an nbody_accum_t) */
+static inline void nbody_accum_block(const double *x, const double *y, const double *m,
+                              int n_pad, void *arg) {
+    nbody_accum_t *a = (nbody_accum_t *)arg;
+    a->bx = x; a->by = y; a->bm = m; a->bn_pad = n_pad;
+    nbody_accum_range(a, 0, a->local->n);
+}
+
+/* Collective. Compare a faster solver's sums ax/ay for the local stars
+ * with the direct sum on up to `samples` of them, evenly spaced, sent
+ * around the ring. Returns how many stars were compared over all ranks;
+ * *max_err and *rms (relative force error) are set on rank 0. */
+static inline int nbody_check_error(nbody_ring_t *r, const stars_t *local,
+                                    const double *ax, const double *ay,
+                                    const nbody_kernel_t *k, int samples,
+                                    double *max_err, double *rms) {
+    stars_t probe;
+    int count = 0;
+
+    if (samples > local->n) samples = local->n;
+    if (samples < 0) samples = 0;
+    int *idx = (int *)malloc((samples + 1) * sizeof(int));
+    if (!idx) MPI_Abort(r->comm, 1);
+    for (int s = 0; s < samples; s++) {
+        int i = (int)((double)local->n * s / samples);
+        if (count > 0 && idx[count - 1] == i) continue;
+        idx[count++] = i;
+    }
+    if (stars_alloc(&probe, count) != 0) MPI_Abort(r->comm, 1);
+    for (int j = 0; j < count; j++) {
+        probe.x[j] = local->x[idx[j]];
+        probe.y[j] = local->y[idx[j]];
+    }
+    double *ref_x = (double *)calloc(count + 1, sizeof(double));
+    double *ref_y = (double *)calloc(count + 1, sizeof(double));
+    if (!ref_x || !ref_y) MPI_Abort(r->comm, 1);
+    nbody_accum_t accum = { &probe, ref_x, ref_y, k, NULL, NULL, NULL, 0 };
+    nbody_ring_pass(r, local, nbody_accum_block, &accum);
+
+    double worst = 0.0, sum_sq = 0.0, global_sq = 0.0;
+    int used = 0, global_used = 0;
+    for (int j = 0; j < count; j++) {
+        double dx = ax[idx[j]] - ref_x[j], dy = ay[idx[j]] - ref_y[j];
+        double ref = sqrt(ref_x[j] * ref_x[j] + ref_y[j] * ref_y[j]);
+        if (ref == 0.0) continue;
+        double err = sqrt(dx * dx + dy * dy) / ref;
+        if (err > worst) worst = err;
+        sum_sq += err * err;
+        used++;
+    }
+    stars_free(&probe);
+    free(idx);
+    free(ref_x);
+    free(ref_y);
+
+    *max_err = *rms = 0.0;
+    MPI_Reduce(&worst, max_err, 1, MPI_DOUBLE, MPI_MAX, 0, r->comm);
+    MPI_Reduce(&sum_sq, &global_sq, 1, MPI_DOUBLE, MPI_SUM, 0, r->comm);
+    MPI_Reduce(&used, &global_used, 1, MPI_INT, MPI_SUM, 0, r->comm);
+    if (global_used > 0) *rms = sqrt(global_sq / global_used);
+    return global_used;
+}
+
+/* Distribute root's full set to the ranks' blocks (as in r->counts) */
+static inline void nbody_scatter(const nbody_ring_t *r, const stars_t *all, stars_t *local, int root) {
+    const double *src[5] = { NULL, NULL, NULL, NULL, NULL };
+    double *dst[5] = { local->x, local->y, local->mass, local->vx, local->vy };
+    if (r->rank == root) {
+        src[0] = all->x; src[1] = all->y; src[2] = all->mass; src[3] = all->vx; src[4] = all->vy;
+    }
+    for (int f = 0; f < 5; f++)
+        MPI_Scatterv(src[f], r->counts, r->displs, MPI_DOUBLE,
+                     dst[f], local->n, MPI_DOUBLE, root, r->comm);
+}
+
+/* Collect every rank's block into the full set on root */
+static inline void nbody_gather(const nbody_ring_t *r, const stars_t *local, stars_t *all, int root) {
+    const double *src[5] = { local->x, local->y, local->mass, local->vx, local->vy };
+    double *dst[5] = { NULL, NULL, NULL, NULL, NULL };
+    if (r->rank == root) {
+        dst[0] = all->x; dst[1] = all->y; dst[2] = all->mass; dst[3] = all->vx; dst[4] = all->vy;
+    }
+    for (int f = 0; f < 5; f++)
+        MPI_Gatherv(src[f], local->n, MPI_DOUBLE,
+                    dst[f], r->counts, r->displs, MPI_DOUBLE, root, r->comm);
+}
+#endif /* MPI_VERSION */
+
+#endif /* NBODY_H */
@@ -0,0 +1,337 @@
+#ifndef NONCE_LEDGER_H
+#define NONCE_LEDGER_H
+
+/*
+ * Nonce ledger for the mining programs (crypto_miner, mining_demo): a
+ * shared text file on /cluster that hands every chunk its own range of
+ * nonces and records which parts of it are already hashed, so a chunk
+ * the launcher retries after a timeout or a lost node only hashes what
+ * was never committed.
+ *
+ *   R <chunk> <base> <count>                  chunk owns [base, base+count)
+ *   D <chunk> <lo> <hi> <found> <first>       [lo, hi) hashed, found hits,
+ *                                             first = lowest winning nonce
+ *
+ * Usage (all ranks):
+ *   ledger_t l;
+ *   ledger_open(&l, path, chunk, count, comm);   // reserve/reload, share plan
+ *   n = ledger_share(&l, rank, size, mine);       // this rank's open ranges
+ *   hits = ledger_mine(&l, mine, n, kernel, &job, bits, stop, &hashes, &first);
+ *   ledger_close(&l);
+ *
+ * Rank 0 reads the ledger under an fcntl() write lock, appends an R record
+ * (base = end of the highest range reserved so far) if the chunk has none,
+ * and broadcasts the chunk's not-yet-done ranges. Every rank then appends
+ * a D record, under the same lock and followed by fdatasync(), at least
+ * every LEDGER_COMMIT_SECONDS while it hashes, so a crash loses at most
+ * that much work per rank. Lines are appended whole (O_APPEND under the
+ * lock). A torn last line (a writer died mid-line) is cut off under the
+ * lock before the next read or append, so it never merges with a new line.
+ *
+ * path == NULL (or a ledger that cannot be opened, read or planned in
+ * memory) falls back to the fixed range chunk * 2^32 and nothing is saved. With a search_stop_t (see
+ * search_stop.h) ledger_mine signals its first winner, polls the flag
+ * every SEARCH_STOP_POLL nonces, and commits and returns once it is up.
+ * Start a new job with a new (or deleted) ledger file: chunk ids are only
+ * unique within one ledger.
+ *
+ * Include mpi.h and sha256.h first.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "search_stop.h"
+
+#define LEDGER_COMMIT_SECONDS 1.0
+#define LEDGER_SLICE (1 << 16)        /* nonces between clock checks */
+
+typedef struct {
+    uint64_t lo, hi;
+} ledger_range_t;
+
+typedef struct {
+    int fd;                           /* -1: no ledger, nothing is saved */
+    long chunk;
+    uint64_t base, count;             /* the chunk's nonces */
+    uint64_t salvaged, salvaged_found;/* hashed by earlier attempts */
+    uint64_t salvaged_first;          /* lowest winner among them */
+    int nopen;
+    ledger_range_t *open;             /* still to hash, ascending */
+} ledger_t;
+
+static inline int ledger_lock(int fd, short type) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &fl) != 0)
+        if (errno != EINTR) return -1;
+    return 0;
+}
+
+/* With the write lock held: cut the file after its last '\n', dropping a
+ * torn line. Returns 0, or -1 on I/O error. */
+static inline int ledger_trim(int fd) {
+    struct stat st;
+    char buf[4096];
+    if (fstat(fd, &st) != 0) return -1;
+    off_t end = st.st_size;
+    while (end > 0) {
+        size_t n = end < (off_t)sizeof(buf) ? (size_t)end : sizeof(buf);
+        ssize_t got = pread(fd, buf, n, end - (off_t)n);
+        if (got < 0 && errno == EINTR) continue;
+        if (got != (ssize_t)n) return -1;
+        size_t i = n;
+        while (i > 0 && buf[i - 1] != '\n') i--;
+        end -= (off_t)(n - i);
+        if (i > 0) break;
+    }
+    return end == st.st_size || ftruncate(fd, end) == 0 ? 0 : -1;
+}
+
+/* Append one line (under the lock) and flush it to disk */
+static inline int ledger_append(int fd, const char *line) {
+    if (ledger_lock(fd, F_WRLCK) != 0) return -1;
+    size_t len = strlen(line);
+    int rc = ledger_trim(fd) == 0 && write(fd, line, len) == (ssize_t)len && fdatasync(fd) == 0 ? 0 : -1;
+    ledger_lock(fd, F_UNLCK);
+    return rc;
+}
+
+static int ledger_cmp_range(const void *a, const void *b) {
+    const ledger_range_t *x = (const ledger_range_t *)a, *y = (const ledger_range_t *)b;
+    return x->lo < y->lo ? -1 : x->lo > y->lo;
+}
+
+/* Rank 0: find or reserve the chunk's range and collect its D records.
+ * done[] gets the hashed ranges (malloc'd). Returns 0, or -1 on I/O error.
+ * (The file is read with pread on the locked fd itself: closing any other
+ * descriptor of it would drop the process's fcntl locks.) */
+static int ledger_load(ledger_t *l, ledger_range_t **done, int *ndone) {
+    struct stat st;
+    uint64_t next_base = 0;
+    int have = 0, cap = 0, rc = 0;
+    char *buf = NULL;
+    *done = NULL;
+    *ndone = 0;
+    if (ledger_lock(l->fd, F_WRLCK) != 0) return -1;
+    if (ledger_trim(l->fd) != 0 || fstat(l->fd, &st) != 0 || !(buf = (char *)malloc((size_t)st.st_size + 1))) rc = -1;
+    for (off_t got = 0; rc == 0 && got < st.st_size;) {
+        ssize_t r = pread(l->fd, buf + got, (size_t)(st.st_size - got), got);
+        if (r <= 0) rc = -1;
+        else got += r;
+    }
+    for (char *line = buf, *nl; rc == 0 && (nl = memchr(line, '\n', buf + st.st_size - line)); line = nl + 1) {
+        unsigned long long a, b, c, d;
+        long ch;
+        *nl = '\0';
+        if (sscanf(line, "R %ld %llu %llu", &ch, &a, &b) == 3) {
+            if (a + b > next_base) next_base = a + b;
+            if (ch == l->chunk && !have) {
+                l->base = a;
+                l->count = b;
+                have = 1;
+            }
+        } else if (sscanf(line, "D %ld %llu %llu %llu %llu", &ch, &a, &b, &c, &d) == 5 && ch == l->chunk) {
+            if (*ndone == cap) {
+                int grow = cap ? 2 * cap : 64;
+                ledger_range_t *grown = (ledger_range_t *)realloc(*done, grow * sizeof(ledger_range_t));
+                if (!grown) {
+                    rc = -1;
+                    break;
+                }
+                *done = grown;
+                cap = grow;
+            }
+            (*done)[(*ndone)++] = (ledger_range_t){ a, b };
+            l->salvaged_found += c;
+            if (c > 0 && d < l->salvaged_first) l->salvaged_first = d;
+        }
+    }
+    free(buf);
+    if (rc == 0 && !have) {
+        char rec[128];
+        l->base = next_base;
+        snprintf(rec, sizeof(rec), "R %ld %llu %llu\n", l->chunk,
+                 (unsigned long long)l->base, (unsigned long long)l->count);
+        size_t len = strlen(rec);
+        rc = write(l->fd, rec, len) == (ssize_t)len && fdatasync(l->fd) == 0 ? 0 : -1;
+    }
+    ledger_lock(l->fd, F_UNLCK);
+    return rc;
+}
+
+/* [base, base + count) minus the done ranges. Returns 0, or -1 if out of
+ * memory. */
+static int ledger_subtract(ledger_t *l, ledger_range_t *done, int ndone) {
+    if (ndone > 0) qsort(done, ndone, sizeof(ledger_range_t), ledger_cmp_range);
+    free(l->open);
+    l->open = (ledger_range_t *)malloc((ndone + 1) * sizeof(ledger_range_t));
+    l->nopen = 0;
+    l->salvaged = 0;
+    if (!l->open) return -1;
+    uint64_t at = l->base, end = l->base + l->count;
+    for (int i = 0; i < ndone && at < end; i++) {
+        uint64_t lo = done[i].lo < at ? at : done[i].lo, hi = done[i].hi < end ? done[i].hi : end;
+        if (lo >= hi) continue;
+        if (lo > at) l->open[l->nopen++] = (ledger_range_t){ at, lo };
+        l->salvaged += hi - lo;
+        at = hi;
+    }
+    if (at < end) l->open[l->nopen++] = (ledger_range_t){ at, end };
+    return 0;
+}
+
+/* Collective: drop the ledger and hash the fixed range chunk * 2^32 */
+static void ledger_fallback(ledger_t *l, uint64_t count, int rank, MPI_Comm comm) {
+    if (l->fd >= 0) close(l->fd);
+    l->fd = -1;
+    l->base = (uint64_t)l->chunk << 32;
+    l->count = count;
+    l->salvaged_found = 0;
+    l->salvaged_first = UINT64_MAX;
+    if (rank == 0 && ledger_subtract(l, NULL, 0) != 0) {
+        fprintf(stderr, "Ledger: out of memory\n");
+        MPI_Abort(comm, 1);
+    }
+}
+
+/* Collective: rank 0's plan to everyone. Returns 0, or -1 (on every rank)
+ * if some rank has no memory for the open ranges. */
+static int ledger_bcast_plan(ledger_t *l, int rank, MPI_Comm comm) {
+    uint64_t hdr[6] = { l->base, l->count, l->salvaged, l->salvaged_found, l->salvaged_first,
+                        (uint64_t)l->nopen };
+    MPI_Bcast(hdr, 6, MPI_UINT64_T, 0, comm);
+    if (rank != 0) {
+        l->base = hdr[0];
+        l->count = hdr[1];
+        l->salvaged = hdr[2];
+        l->salvaged_found = hdr[3];
+        l->salvaged_first = hdr[4];
+        l->nopen = (int)hdr[5];
+        free(l->open);
+        l->open = (ledger_range_t *)malloc((l->nopen + 1) * sizeof(ledger_range_t));
+    }
+    int ok = l->open != NULL;
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, comm);
+    if (!ok) return -1;
+    MPI_Bcast(l->open, 2 * l->nopen, MPI_UINT64_T, 0, comm);
+    return 0;
+}
+
+/* Collective: reserve (or reload) the chunk and share its open ranges.
+ * Returns 0, or -1 if the ledger already holds the chunk with a different
+ * size; l->count is then the recorded size, which is what gets hashed. */
+static inline int ledger_open(ledger_t *l, const char *path, long chunk, uint64_t count, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    memset(l, 0, sizeof(*l));
+    l->chunk = chunk;
+    l->count = count;
+    l->base = (uint64_t)chunk << 32;
+    l->salvaged_first = UINT64_MAX;
+    l->fd = path ? open(path, O_RDWR | O_APPEND | O_CREAT, 0644) : -1;
+
+    ledger_range_t *done = NULL;
+    int ndone = 0, ok = l->fd >= 0;
+    if (rank == 0 && ok && (ledger_load(l, &done, &ndone) != 0 || ledger_subtract(l, done, ndone) != 0))
+        ok = 0;
+    free(done);
+    if (path && !ok) fprintf(stderr, "[Rank %d] Ledger %s unusable (%s): progress is not saved\n",
+                             rank, path, strerror(errno));
+    /* Everyone keeps the ledger only if everyone can write it */
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, comm);
+    if (!ok) ledger_fallback(l, count, rank, comm);
+    if (ledger_bcast_plan(l, rank, comm) != 0) {
+        if (l->fd < 0) MPI_Abort(comm, 1);
+        if (rank == 0) fprintf(stderr, "Ledger %s: out of memory, progress is not saved\n", path);
+        ledger_fallback(l, count, rank, comm);
+        if (ledger_bcast_plan(l, rank, comm) != 0) MPI_Abort(comm, 1);
+    }
+    return l->count != count ? -1 : 0;
+}
+
+/* This rank's even share of the open nonces, as up to nopen ranges in
+ * mine[] (room for nopen). Returns the number of ranges. */
+static inline int ledger_share(const ledger_t *l, int rank, int size, ledger_range_t *mine) {
+    uint64_t total = 0;
+    for (int i = 0; i < l->nopen; i++) total += l->open[i].hi - l->open[i].lo;
+    /* Open-nonce positions [from, to) belong to this rank */
+    uint64_t extra = total % size, r = (uint64_t)rank;
+    uint64_t from = total / size * r + (r < extra ? r : extra);
+    uint64_t to = from + total / size + (r < extra);
+    int n = 0;
+    uint64_t pos = 0;
+    for (int i = 0; i < l->nopen && pos < to; i++) {
+        uint64_t len = l->open[i].hi - l->open[i].lo;
+        uint64_t a = from > pos ? from - pos : 0, b = to - pos < len ? to - pos : len;
+        if (a < b) mine[n++] = (ledger_range_t){ l->open[i].lo + a, l->open[i].lo + b };
+        pos += len;
+    }
+    return n;
+}
+
+/* Record [lo, hi) as hashed (no-op without a ledger) */
+static inline void ledger_commit(const ledger_t *l, uint64_t lo, uint64_t hi, uint64_t found, uint64_t first) {
+    char rec[160];
+    if (l->fd < 0 || lo >= hi) return;
+    snprintf(rec, sizeof(rec), "D %ld %llu %llu %llu %llu\n", l->chunk, (unsigned long long)lo,
+             (unsigned long long)hi, (unsigned long long)found,
+             (unsigned long long)(found ? first : 0));
+    if (ledger_append(l->fd, rec) != 0) fprintf(stderr, "Ledger write failed: %s\n", strerror(errno));
+}
+
+/* Hash the ranges, committing progress every LEDGER_COMMIT_SECONDS, or
+ * until the stop flag is up (stop may be NULL: hash everything). Returns
+ * the hits; *hashes = nonces hashed, *first = lowest winner (UINT64_MAX
+ * if none). */
+static inline uint64_t ledger_mine(const ledger_t *l, const ledger_range_t *mine, int n,
+                                   const sha256_kernel_t *kernel, const sha256_job_t *job, int bits,
+                                   search_stop_t *stop, uint64_t *hashes, uint64_t *first) {
+    uint64_t hits = 0, slice = stop ? SEARCH_STOP_POLL : LEDGER_SLICE;
+    int stopped = 0;
+    *hashes = 0;
+    *first = UINT64_MAX;
+    for (int i = 0; i < n && !stopped; i++) {
+        uint64_t start = mine[i].lo, pending = 0, pending_first = UINT64_MAX, g = mine[i].lo;
+        double last = MPI_Wtime();
+        while (g < mine[i].hi && !stopped) {
+            uint64_t len = mine[i].hi - g < slice ? mine[i].hi - g : slice, w = 0;
+            uint64_t h = kernel->scan(job, g, len, bits, &w);
+            if (h && w < pending_first) pending_first = w;
+            pending += h;
+            g += len;
+            if (stop) {
+                if (h) search_stop_signal(stop, w);
+                stopped = search_stop_poll(stop);
+            }
+            if (stopped || g == mine[i].hi || MPI_Wtime() - last >= LEDGER_COMMIT_SECONDS) {
+                ledger_commit(l, start, g, pending, pending_first);
+                hits += pending;
+                if (pending_first < *first) *first = pending_first;
+                start = g;
+                pending = 0;
+                pending_first = UINT64_MAX;
+                last = MPI_Wtime();
+            }
+        }
+        *hashes += g - mine[i].lo;
+    }
+    return hits;
+}
+
+static inline void ledger_close(ledger_t *l) {
+    if (l->fd >= 0) close(l->fd);
+    free(l->open);
+    memset(l, 0, sizeof(*l));
+    l->fd = -1;
+}
+
+#endif /* NONCE_LEDGER_H */
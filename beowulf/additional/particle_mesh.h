@@ -0,0 +1,358 @@
+#ifndef PARTICLE_MESH_H
+#define PARTICLE_MESH_H
+
+/*
+ * Particle-mesh gravity for the galaxy programs: O(N + M^2 log M) per step
+ * on an M x M mesh, for large and fairly uniform star sets. Include mpi.h
+ * before this header.
+ *
+ * Per step (all collective):
+ *   1. cloud-in-cell deposit of the local stars' mass onto the mesh; the
+ *      ranks' meshes are summed with MPI_Reduce_scatter straight into the
+ *      row slabs of the FFT grid
+ *   2. potential = mass (*) Green's function, by FFT on a 2M x 2M grid
+ *      (zero padding, so the box is isolated, not periodic). The 2D FFT is
+ *      slab-decomposed: row FFTs, an Alltoallv transpose, row FFTs again.
+ *      The transform of the Green's function is kept until the box changes.
+ *   3. the potential rows are all-gathered, and each star gets minus the
+ *      gradient (central differences), interpolated back with CIC weights
+ *
+ * The Green's function is g(r) = -1 / max(r, 1), the free-space 3D Poisson
+ * solution restricted to the plane, so the force law is the one of the
+ * direct sum (1/r^2, clamped below r = 1) apart from mesh smoothing at
+ * separations of a few cells. There is no short-range (P3M) correction:
+ * forces from neighbours within ~2 cells are smoothed away, so per-star
+ * errors against the direct sum are large when close pairs dominate (e.g.
+ * dense random sets); the long-range field is accurate to well under 1%.
+ * pm_accel returns, like the other solvers,
+ * sum_j m_j * d / max(|d|, 1)^3 per local star; the caller applies G * m_i.
+ *
+ * The FFT is a self-contained iterative radix-2 transform (M must be a
+ * power of two); row transforms run on the thread pool.
+ *
+ * pm->wait accumulates the seconds spent in the collectives, so a caller
+ * can tell this rank's own work (deposit, FFT rows, interpolation) from
+ * waiting for the others.
+ */
+
+#include <complex.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nbody.h"
+#include "thread_pool.h"
+
+typedef double complex pm_cplx;
+
+typedef struct {
+    MPI_Comm comm;
+    int rank, size;
+    int m, n2;              /* mesh size, padded FFT size (2m) */
+    int *row0, *rows;       /* FFT-grid row (= column) slab of every rank */
+    int *rho_counts;        /* doubles of the m x m mesh in each slab */
+    int *phi_counts, *phi_displs;
+
+    pm_cplx *work, *tmp;    /* my slab, rows[rank] x n2 */
+    pm_cplx *green;         /* transformed Green's function, transposed slab */
+    pm_cplx *sendbuf, *recvbuf;
+    int *a2a_counts, *a2a_displs;
+    pm_cplx *twiddle;       /* n2 / 2 roots of unity */
+
+    double *rho, *phi;      /* full m x m meshes */
+
+    double x0, y0, h;       /* cell (i, j) is centred at x0 + (j + 0.5) h, y0 + (i + 0.5) h */
+    int have_box;
+    double wait;            /* seconds in collectives so far */
+} pm_t;
+
+static void pm_free(pm_t *pm) {
+    free(pm->row0); free(pm->rows); free(pm->rho_counts);
+    free(pm->phi_counts); free(pm->phi_displs);
+    free(pm->work); free(pm->tmp); free(pm->green);
+    free(pm->sendbuf); free(pm->recvbuf);
+    free(pm->a2a_counts); free(pm->a2a_displs);
+    free(pm->twiddle);
+    free(pm->rho); free(pm->phi);
+    memset(pm, 0, sizeof(*pm));
+}
+
+/* Collective. mesh must be a power of two >= 8. Returns 0, or -1. */
+static int pm_init(pm_t *pm, int mesh, MPI_Comm comm) {
+    memset(pm, 0, sizeof(*pm));
+    if (mesh < 8 || (mesh & (mesh - 1)) != 0) return -1;
+    pm->comm = comm;
+    MPI_Comm_rank(comm, &pm->rank);
+    MPI_Comm_size(comm, &pm->size);
+    pm->m = mesh;
+    pm->n2 = 2 * mesh;
+
+    int P = pm->size, n2 = pm->n2;
+    pm->row0 = (int *)malloc(P * sizeof(int));
+    pm->rows = (int *)malloc(P * sizeof(int));
+    pm->rho_counts = (int *)malloc(P * sizeof(int));
+    pm->phi_counts = (int *)malloc(P * sizeof(int));
+    pm->phi_displs = (int *)malloc(P * sizeof(int));
+    pm->a2a_counts = (int *)malloc(P * sizeof(int));
+    pm->a2a_displs = (int *)malloc(P * sizeof(int));
+    if (!pm->row0 || !pm->rows || !pm->rho_counts || !pm->phi_counts ||
+        !pm->phi_displs || !pm->a2a_counts || !pm->a2a_displs) {
+        pm_free(pm);
+        return -1;
+    }
+    for (int p = 0; p < P; p++) {
+        pm->row0[p] = (int)((long)n2 * p / P);
+        pm->rows[p] = (int)((long)n2 * (p + 1) / P) - pm->row0[p];
+        /* Only rows < m of the padded grid hold mesh data */
+        int lo = pm->row0[p] < mesh ? pm->row0[p] : mesh;
+        int hi = pm->row0[p] + pm->rows[p] < mesh ? pm->row0[p] + pm->rows[p] : mesh;
+        pm->rho_counts[p] = (hi - lo) * mesh;
+        pm->phi_counts[p] = pm->rho_counts[p];
+        pm->phi_displs[p] = lo * mesh;
+    }
+
+    size_t slab = (size_t)(pm->rows[pm->rank] ? pm->rows[pm->rank] : 1) * n2;
+    pm->work    = (pm_cplx *)malloc(slab * sizeof(pm_cplx));
+    pm->tmp     = (pm_cplx *)malloc(slab * sizeof(pm_cplx));
+    pm->green   = (pm_cplx *)malloc(slab * sizeof(pm_cplx));
+    pm->sendbuf = (pm_cplx *)malloc(slab * sizeof(pm_cplx));
+    pm->recvbuf = (pm_cplx *)malloc(slab * sizeof(pm_cplx));
+    pm->twiddle = (pm_cplx *)malloc((n2 / 2) * sizeof(pm_cplx));
+    pm->rho     = (double *)malloc((size_t)mesh * mesh * sizeof(double));
+    pm->phi     = (double *)malloc((size_t)mesh * mesh * sizeof(double));
+    if (!pm->work || !pm->tmp || !pm->green || !pm->sendbuf || !pm->recvbuf ||
+        !pm->twiddle || !pm->rho || !pm->phi) {
+        pm_free(pm);
+        return -1;
+    }
+    for (int k = 0; k < n2 / 2; k++)
+        pm->twiddle[k] = cexp(-2.0 * M_PI * I * k / n2);
+    return 0;
+}
+
+/* ---------------- FFT ---------------- */
+
+/* In-place radix-2 FFT of length n (power of two). tw[k] = exp(-2 pi i k / n).
+ * inverse = 1 uses conjugate twiddles and does not scale. */
+static void pm_fft(pm_cplx *a, int n, const pm_cplx *tw, int inverse) {
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) { pm_cplx t = a[i]; a[i] = a[j]; a[j] = t; }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        int half = len >> 1, step = n / len;
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < half; k++) {
+                pm_cplx w = inverse ? conj(tw[k * step]) : tw[k * step];
+                pm_cplx u = a[i + k], v = a[i + k + half] * w;
+                a[i + k] = u + v;
+                a[i + k + half] = u - v;
+            }
+        }
+    }
+}
+
+typedef struct {
+    pm_t *pm;
+    pm_cplx *data;
+    int inverse;
+} pm_rows_job_t;
+
+static void pm_rows_task(long lo, long hi, int tid, void *arg) {
+    pm_rows_job_t *job = (pm_rows_job_t *)arg;
+    (void)tid;
+    for (long r = lo; r < hi; r++)
+        pm_fft(job->data + r * job->pm->n2, job->pm->n2, job->pm->twiddle, job->inverse);
+}
+
+/* Transpose the distributed n2 x n2 grid: out (my rows of A^T) from in (my rows of A) */
+static void pm_transpose(pm_t *pm, const pm_cplx *in, pm_cplx *out) {
+    int me = pm->rank, n2 = pm->n2, my_rows = pm->rows[me];
+    int off = 0;
+    for (int q = 0; q < pm->size; q++) {
+        pm->a2a_counts[q] = my_rows * pm->rows[q];
+        pm->a2a_displs[q] = off;
+        for (int r = 0; r < my_rows; r++)
+            for (int c = 0; c < pm->rows[q]; c++)
+                pm->sendbuf[off++] = in[(size_t)r * n2 + pm->row0[q] + c];
+    }
+    /* Square grid, same partition for rows and columns: symmetric counts */
+    double t0 = MPI_Wtime();
+    MPI_Alltoallv(pm->sendbuf, pm->a2a_counts, pm->a2a_displs, MPI_C_DOUBLE_COMPLEX,
+                  pm->recvbuf, pm->a2a_counts, pm->a2a_displs, MPI_C_DOUBLE_COMPLEX, pm->comm);
+    pm->wait += MPI_Wtime() - t0;
+    for (int q = 0; q < pm->size; q++) {
+        const pm_cplx *blk = pm->recvbuf + pm->a2a_displs[q];
+        /* blk is q's rows x my columns; out[my column][q's row] */
+        for (int r = 0; r < pm->rows[q]; r++)
+            for (int c = 0; c < my_rows; c++)
+                out[(size_t)c * n2 + pm->row0[q] + r] = blk[(size_t)r * my_rows + c];
+    }
+}
+
+/* Forward 2D FFT of pm->work; result in pm->work, transposed layout */
+static void pm_fft2d_forward(pm_t *pm, thread_pool_t *tp) {
+    pm_rows_job_t job = { pm, pm->work, 0 };
+    tp_parallel_for(tp, 0, pm->rows[pm->rank], 1, pm_rows_task, &job);
+    pm_transpose(pm, pm->work, pm->tmp);
+    job.data = pm->tmp;
+    tp_parallel_for(tp, 0, pm->rows[pm->rank], 1, pm_rows_task, &job);
+    pm_cplx *t = pm->work; pm->work = pm->tmp; pm->tmp = t;
+}
+
+/* Inverse of pm_fft2d_forward (unscaled) */
+static void pm_fft2d_inverse(pm_t *pm, thread_pool_t *tp) {
+    pm_rows_job_t job = { pm, pm->work, 1 };
+    tp_parallel_for(tp, 0, pm->rows[pm->rank], 1, pm_rows_task, &job);
+    pm_transpose(pm, pm->work, pm->tmp);
+    job.data = pm->tmp;
+    tp_parallel_for(tp, 0, pm->rows[pm->rank], 1, pm_rows_task, &job);
+    pm_cplx *t = pm->work; pm->work = pm->tmp; pm->tmp = t;
+}
+
+/* ---------------- solver ---------------- */
+
+/* Transform of g(r) = -1/max(r, 1) on the padded grid (negative offsets wrap) */
+static void pm_setup_green(pm_t *pm, thread_pool_t *tp) {
+    int me = pm->rank, n2 = pm->n2;
+    for (int r = 0; r < pm->rows[me]; r++) {
+        int di = pm->row0[me] + r;
+        if (di >= pm->m) di -= n2;
+        for (int c = 0; c < n2; c++) {
+            int dj = c < pm->m ? c : c - n2;
+            double dist = pm->h * sqrt((double)di * di + (double)dj * dj);
+            pm->work[(size_t)r * n2 + c] = -1.0 / (dist < 1.0 ? 1.0 : dist);
+        }
+    }
+    pm_fft2d_forward(pm, tp);
+    memcpy(pm->green, pm->work, (size_t)pm->rows[me] * n2 * sizeof(pm_cplx));
+}
+
+/* CIC cell and weights: cells (i0, j0) .. (i0 + 1, j0 + 1) */
+static void pm_cic(const pm_t *pm, double x, double y, int *i0, int *j0, double *fy, double *fx) {
+    double gx = (x - pm->x0) / pm->h - 0.5;
+    double gy = (y - pm->y0) / pm->h - 0.5;
+    *j0 = (int)floor(gx);
+    *i0 = (int)floor(gy);
+    *fx = gx - *j0;
+    *fy = gy - *i0;
+}
+
+/* Pick the mesh box from the global bounds; keeps the old one (and its
+ * transformed Green's function) while every star is still inside */
+static int pm_update_box(pm_t *pm, const stars_t *local) {
+    double lo[2] = { HUGE_VAL, HUGE_VAL }, hi[2] = { -HUGE_VAL, -HUGE_VAL };
+    for (int i = 0; i < local->n; i++) {
+        if (local->x[i] < lo[0]) lo[0] = local->x[i];
+        if (local->y[i] < lo[1]) lo[1] = local->y[i];
+        if (local->x[i] > hi[0]) hi[0] = local->x[i];
+        if (local->y[i] > hi[1]) hi[1] = local->y[i];
+    }
+    double glo[2], ghi[2], t0 = MPI_Wtime();
+    MPI_Allreduce(lo, glo, 2, MPI_DOUBLE, MPI_MIN, pm->comm);
+    MPI_Allreduce(hi, ghi, 2, MPI_DOUBLE, MPI_MAX, pm->comm);
+    pm->wait += MPI_Wtime() - t0;
+
+    /* Usable cell centres run from 1 to m - 2, so CIC neighbours stay inside */
+    double ext = ghi[0] - glo[0] > ghi[1] - glo[1] ? ghi[0] - glo[0] : ghi[1] - glo[1];
+    if (pm->have_box) {
+        double span = (pm->m - 3) * pm->h;
+        int inside = glo[0] >= pm->x0 + pm->h && glo[1] >= pm->y0 + pm->h &&
+                     ghi[0] <= pm->x0 + pm->h + span && ghi[1] <= pm->y0 + pm->h + span;
+        /* Also rebuild if the stars now use less than half the box */
+        if (inside && ext > 0.5 * span) return 0;
+    }
+    /* 10% margin so slowly spreading stars don't force a rebuild every step */
+    double margin = 0.05 * (ext > 0 ? ext : 1.0);
+    pm->h = (ext + 2 * margin) / (pm->m - 3);
+    pm->x0 = glo[0] - margin - pm->h;
+    pm->y0 = glo[1] - margin - pm->h;
+    pm->have_box = 1;
+    return 1;
+}
+
+typedef struct {
+    const pm_t *pm;
+    const stars_t *local;
+    double *ax, *ay;
+} pm_interp_job_t;
+
+/* Minus the potential gradient at the CIC cells of stars [lo, hi) */
+static void pm_interp_task(long lo, long hi, int tid, void *arg) {
+    pm_interp_job_t *job = (pm_interp_job_t *)arg;
+    const pm_t *pm = job->pm;
+    int m = pm->m;
+    const double *phi = pm->phi;
+    (void)tid;
+
+    for (long s = lo; s < hi; s++) {
+        int i0, j0;
+        double fy, fx, gx = 0.0, gy = 0.0;
+        pm_cic(pm, job->local->x[s], job->local->y[s], &i0, &j0, &fy, &fx);
+        for (int di = 0; di < 2; di++) {
+            for (int dj = 0; dj < 2; dj++) {
+                int i = i0 + di, j = j0 + dj;
+                double w = (di ? fy : 1.0 - fy) * (dj ? fx : 1.0 - fx);
+                /* Central differences, one-sided at the mesh edge */
+                int jl = j > 0 ? j - 1 : j, jr = j < m - 1 ? j + 1 : j;
+                int il = i > 0 ? i - 1 : i, ir = i < m - 1 ? i + 1 : i;
+                gx += w * (phi[(size_t)i * m + jr] - phi[(size_t)i * m + jl]) / ((jr - jl) * pm->h);
+                gy += w * (phi[(size_t)ir * m + j] - phi[(size_t)il * m + j]) / ((ir - il) * pm->h);
+            }
+        }
+        job->ax[s] = -gx;
+        job->ay[s] = -gy;
+    }
+}
+
+/* Collective: ax/ay[i] = sum_j m_j * d / max(|d|, 1)^3 on the mesh, local stars */
+static void pm_accel(pm_t *pm, const stars_t *local, double *ax, double *ay, thread_pool_t *tp) {
+    int m = pm->m, n2 = pm->n2, me = pm->rank;
+    if (pm_update_box(pm, local)) pm_setup_green(pm, tp);
+
+    /* 1. CIC deposit on the full mesh, then sum into the FFT row slabs */
+    memset(pm->rho, 0, (size_t)m * m * sizeof(double));
+    for (int s = 0; s < local->n; s++) {
+        int i0, j0;
+        double fy, fx, mass = local->mass[s];
+        pm_cic(pm, local->x[s], local->y[s], &i0, &j0, &fy, &fx);
+        pm->rho[(size_t)i0 * m + j0]           += mass * (1 - fy) * (1 - fx);
+        pm->rho[(size_t)i0 * m + j0 + 1]       += mass * (1 - fy) * fx;
+        pm->rho[(size_t)(i0 + 1) * m + j0]     += mass * fy * (1 - fx);
+        pm->rho[(size_t)(i0 + 1) * m + j0 + 1] += mass * fy * fx;
+    }
+    double *mine = pm->phi;   /* scratch: my rows of the summed mesh */
+    double t0 = MPI_Wtime();
+    MPI_Reduce_scatter(pm->rho, mine, pm->rho_counts, MPI_DOUBLE, MPI_SUM, pm->comm);
+    pm->wait += MPI_Wtime() - t0;
+
+    int mesh_rows = pm->rho_counts[me] / m;
+    for (int r = 0; r < pm->rows[me]; r++) {
+        pm_cplx *row = pm->work + (size_t)r * n2;
+        for (int c = 0; c < n2; c++) row[c] = 0.0;
+        if (r < mesh_rows)
+            for (int c = 0; c < m; c++) row[c] = mine[(size_t)r * m + c];
+    }
+
+    /* 2. potential = IFFT(FFT(rho) * FFT(g)) */
+    pm_fft2d_forward(pm, tp);
+    for (size_t k = 0; k < (size_t)pm->rows[me] * n2; k++) pm->work[k] *= pm->green[k];
+    pm_fft2d_inverse(pm, tp);
+
+    /* 3. gather the potential mesh everywhere and interpolate */
+    double scale = 1.0 / ((double)n2 * n2);
+    for (int r = 0; r < mesh_rows; r++)
+        for (int c = 0; c < m; c++)
+            pm->rho[(size_t)r * m + c] = creal(pm->work[(size_t)r * n2 + c]) * scale;
+    t0 = MPI_Wtime();
+    MPI_Allgatherv(pm->rho, pm->rho_counts[me], MPI_DOUBLE,
+                   pm->phi, pm->phi_counts, pm->phi_displs, MPI_DOUBLE, pm->comm);
+    pm->wait += MPI_Wtime() - t0;
+
+    pm_interp_job_t job = { pm, local, ax, ay };
+    tp_parallel_for(tp, 0, local->n, 256, pm_interp_task, &job);
+}
+
+#endif /* PARTICLE_MESH_H */
@@ -1,14 +1,26 @@
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <unistd.h>
 
+#include "mc_engine.h"
+
+// Estimates pi from the share of random points in the unit square that land
+// inside the quarter circle. Sampling, the adaptive --target-error mode and
+// the CHUNK_RESULT line are in mc_engine.h (shared with area_mpi); points
+// come from a counter-based stream keyed by (seed, chunk, rank), see rng.h,
+// so re-running a chunk (run_chunk.sh passes --chunk-id) reproduces its
+// result exactly. --regions circle,island,... estimates more shapes from
+// the same points.
+//
+// Usage: pi_mpi <iterations> [--seed S] [--chunk-id C] [--regions R,...]
+//        pi_mpi [max_iterations] --target-error E
+// Output: CHUNK_RESULT=SAMPLES=INSIDE=ESTIMATE=STDERR
+
 int main(int argc, char *argv[]) {
-    int rank, size, i;
-    long long total_iters, my_iters;
-    long long my_inside = 0, total_inside = 0;
-    double x, y;
+    int rank, size;
+    long long my_iters, my_inside[MC_MAX_REGIONS];
+    mc_options_t opts;
     char hostname[MPI_MAX_PROCESSOR_NAME];
     int len;
 
@@ -18,31 +30,14 @@ int main(int argc, char *argv[]) {
     MPI_Get_processor_name(hostname, &len);
 
     // 1. Get Iterations from Command Line (Passed by the Script)
-    if (argc != 2) {
-        if (rank == 0) printf("Usage: %s <iterations>\n", argv[0]);
+    if (mc_parse_args(argc, argv, "circle", &opts) != 0) {
+        if (rank == 0) mc_usage(argv[0]);
         MPI_Finalize();
         return 1;
     }
-    
-    // Convert string argument to long long
-    total_iters = atoll(argv[1]);
-    
-    // Distribute work
-    my_iters = total_iters / size;
-
-    // Seed random number generator uniquely for each rank
-    unsigned int seed = time(NULL) + rank;
 
     // 2. Monte Carlo Simulation
-    for (i = 0; i < my_iters; i++) {
-        // Generate random X and Y between 0 and 1
-        x = (double)rand_r(&seed) / RAND_MAX;
-        y = (double)rand_r(&seed) / RAND_MAX;
-
-        if ((x * x + y * y) <= 1.0) {
-            my_inside++;
-        }
-    }
+    my_iters = mc_run(&opts, rank, size, my_inside);
 
     // 3. VISUAL LOGGING (For the Script to grep)
     // We create a temp file per rank so outputs don't get jumbled, 
@@ -51,14 +46,8 @@ int main(int argc, char *argv[]) {
     usleep(rank * 1000); 
     printf("[Node: %s | Rank %d] Processed %lld iterations\n", hostname, rank, my_iters);
 
-    // 4. Gather Results
-    MPI_Reduce(&my_inside, &total_inside, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
-
-    // 5. Final Output (Formatted for the Script)
-    if (rank == 0) {
-        // Output format: CHUNK_RESULT=ITERS=INSIDE
-        printf("CHUNK_RESULT=%lld=%lld\n", total_iters, total_inside);
-    }
+    // 4. Gather Results and 5. Final Output (Formatted for the Script)
+    mc_report(&opts, my_iters, my_inside, rank);
 
     MPI_Finalize();
     return 0;
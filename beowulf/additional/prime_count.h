@@ -0,0 +1,242 @@
+#ifndef PRIME_COUNT_H
+#define PRIME_COUNT_H
+
+/*
+ * pi(x) without enumerating primes: the Lagarias-Miller-Odlyzko form of
+ * the Meissel-Lehmer method, O(x^(2/3) log x) time, for prime_demo.
+ *
+ * With y in [x^(1/3), x^(1/2)] and a = pi(y):
+ *
+ *   pi(x) = phi(x, a) + a - 1 - P2,
+ *   P2    = sum over primes y < p_k <= sqrt(x) of  pi(x / p_k) - k + 1,
+ *   phi(x, a) = S1 + S2,
+ *   S1    = sum over m <= y of  mu(m) * floor(x / m),
+ *   S2    = sum over primes p_b <= y, squarefree y/p_b < m <= y with
+ *           lpf(m) > p_b  of  -mu(m) * phi(x / (p_b m), b - 1)
+ *
+ * (phi(v, b) counts 1..v not divisible by any of the first b primes.)
+ * S1 is O(y). Every phi() argument of S2 and every pi() argument of P2 is
+ * at most z = x / (y + 1), so both come from one sieve of [1, z]: in each
+ * segment the leaves of p_b are answered just before p_b is crossed off,
+ * with a Fenwick tree over the segment's words for the counts, and after
+ * the last p_a only 1 and the primes > y are left for P2.
+ *
+ * The counts are prefix counts from 1, so an interval [lo, hi) of the
+ * sieve is computed with counts relative to lo (carried from segment to
+ * segment in count[]) and records, per b, how many numbers it kept
+ * (count[b]) and the total leaf weight that needs the count before lo
+ * (weight[b]). lmo_merge() joins neighbouring intervals, so threads and
+ * ranks each take a piece of [1, z] and the pieces are combined in order
+ * (MPI_Exscan + MPI_Reduce in prime_demo).
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LMO_SEGMENT (1 << 18)   /* numbers per sieve segment (32 KiB of bits) */
+
+typedef struct {
+    uint64_t x, y, z;
+    int a;                      /* pi(y) */
+    int nprimes;                /* pi(sqrt(x)) */
+    const uint32_t *primes;     /* 2, 3, 5, ... <= sqrt(x) */
+    int8_t *mu;                 /* mu(m), m <= y */
+    uint32_t *lpf;              /* least prime factor of m <= y (lpf[1] = max) */
+} lmo_t;
+
+/* Partial sums of one interval of [1, z], counts relative to its start */
+typedef struct {
+    int64_t s2, p2;
+    int64_t queries;            /* P2 terms answered in the interval */
+    int64_t *count;             /* [b], 1 <= b <= a + 1: numbers left before p_b is sieved */
+    int64_t *weight;            /* [b], 1 <= b <= a: sum of -mu(m) over p_b's leaves */
+} lmo_part_t;
+
+/* Per-thread sieve scratch */
+typedef struct {
+    uint64_t *bits;
+    uint32_t *tree;             /* Fenwick tree of popcounts, 1-based by word */
+} lmo_scratch_t;
+
+static inline uint64_t lmo_icbrt(uint64_t n) {
+    uint64_t r = (uint64_t)cbrtl((long double)n);
+    while (r > 0 && r * r * r > n) r--;
+    while ((r + 1) * (r + 1) * (r + 1) <= n) r++;
+    return r;
+}
+
+static inline void lmo_free(lmo_t *l) {
+    free(l->mu);
+    free(l->lpf);
+    memset(l, 0, sizeof(*l));
+}
+
+/* primes: 2, 3, 5, ... up to at least sqrt(x) (only the first nprimes
+ * <= sqrt(x) are used). alpha >= 1 scales y = alpha x^(1/3): larger y
+ * means a shorter sieve but more leaves. Returns 0, or -1 on allocation
+ * failure. */
+static inline int lmo_init(lmo_t *l, uint64_t x, const uint32_t *primes, int nprimes, double alpha) {
+    memset(l, 0, sizeof(*l));
+    uint64_t c = lmo_icbrt(x), r = (uint64_t)sqrtl((long double)x);
+    while (r * r > x) r--;
+    while ((r + 1) * (r + 1) <= x) r++;
+    uint64_t y = (uint64_t)(alpha * (double)c);
+    if (y < c) y = c;
+    if (y > r) y = r;
+    if (y < 1) y = 1;
+
+    l->x = x;
+    l->y = y;
+    l->z = x / (y + 1);
+    l->primes = primes;
+    while (l->nprimes < nprimes && primes[l->nprimes] <= r) l->nprimes++;
+    while (l->a < l->nprimes && primes[l->a] <= y) l->a++;
+
+    l->mu = (int8_t *)malloc(y + 1);
+    l->lpf = (uint32_t *)malloc((y + 1) * sizeof(uint32_t));
+    if (!l->mu || !l->lpf) {
+        lmo_free(l);
+        return -1;
+    }
+    for (uint64_t m = 0; m <= y; m++) { l->mu[m] = 1; l->lpf[m] = UINT32_MAX; }
+    for (uint64_t p = 2; p <= y; p++) {
+        if (l->lpf[p] != UINT32_MAX) continue;          /* composite */
+        for (uint64_t m = p; m <= y; m += p) {
+            if (l->lpf[m] == UINT32_MAX) l->lpf[m] = (uint32_t)p;
+            l->mu[m] = (int8_t)-l->mu[m];
+        }
+        for (uint64_t m = p * p; m <= y; m += p * p) l->mu[m] = 0;
+    }
+    return 0;
+}
+
+/* S1 = sum over m <= y of mu(m) floor(x / m) */
+static inline int64_t lmo_s1(const lmo_t *l) {
+    int64_t s = 0;
+    for (uint64_t m = 1; m <= l->y; m++)
+        if (l->mu[m]) s += l->mu[m] * (int64_t)(l->x / m);
+    return s;
+}
+
+static inline int lmo_part_alloc(const lmo_t *l, lmo_part_t *p) {
+    memset(p, 0, sizeof(*p));
+    p->count = (int64_t *)calloc(l->a + 2, sizeof(int64_t));
+    p->weight = (int64_t *)calloc(l->a + 2, sizeof(int64_t));
+    return (p->count && p->weight) ? 0 : -1;
+}
+
+static inline void lmo_part_free(lmo_part_t *p) {
+    free(p->count);
+    free(p->weight);
+    memset(p, 0, sizeof(*p));
+}
+
+static inline int lmo_scratch_alloc(lmo_scratch_t *s) {
+    s->bits = (uint64_t *)malloc((LMO_SEGMENT / 64) * sizeof(uint64_t));
+    s->tree = (uint32_t *)malloc((LMO_SEGMENT / 64 + 1) * sizeof(uint32_t));
+    return (s->bits && s->tree) ? 0 : -1;
+}
+
+static inline void lmo_scratch_free(lmo_scratch_t *s) {
+    free(s->bits);
+    free(s->tree);
+}
+
+/* Numbers still unsieved at offsets [0, j] of the segment */
+static inline int64_t lmo_prefix(const lmo_scratch_t *s, uint64_t j) {
+    uint64_t w = j >> 6;
+    int64_t c = __builtin_popcountll(s->bits[w] & (~0ull >> (63 - (j & 63))));
+    for (uint64_t i = w; i > 0; i &= i - 1) c += s->tree[i];
+    return c;
+}
+
+/* Sieve [lo, hi) (1 <= lo < hi <= z + 1) into part (zeroed by the caller) */
+static inline void lmo_interval(const lmo_t *l, uint64_t lo, uint64_t hi,
+                                lmo_part_t *part, lmo_scratch_t *s) {
+    const uint64_t x = l->x, y = l->y;
+    const uint32_t *pr = l->primes;
+
+    for (uint64_t seg_lo = lo; seg_lo < hi; seg_lo += LMO_SEGMENT) {
+        uint64_t seg_hi = seg_lo + LMO_SEGMENT < hi ? seg_lo + LMO_SEGMENT : hi;
+        uint64_t n = seg_hi - seg_lo, words = (n + 63) / 64;
+
+        memset(s->bits, 0xFF, words * sizeof(uint64_t));
+        if (n & 63) s->bits[words - 1] = (1ull << (n & 63)) - 1;
+        /* Linear Fenwick build over the words' popcounts */
+        for (uint64_t i = 1; i <= words; i++) s->tree[i] = (uint32_t)__builtin_popcountll(s->bits[i - 1]);
+        for (uint64_t i = 1; i <= words; i++) {
+            uint64_t up = i + (i & (0 - i));
+            if (up <= words) s->tree[up] += s->tree[i];
+        }
+        int64_t left = (int64_t)n;
+
+        for (int b = 1; b <= l->a; b++) {
+            uint64_t p = pr[b - 1];
+
+            /* Special leaves of p with x / (p m) in this segment, in
+             * increasing order of the argument (decreasing m) */
+            uint64_t m_lo = x / (p * seg_hi), m_hi = x / (p * seg_lo);
+            if (m_lo < y / p) m_lo = y / p;
+            if (m_hi > y) m_hi = y;
+            for (uint64_t m = m_hi; m > m_lo; m--) {
+                if (l->mu[m] == 0 || l->lpf[m] <= p) continue;
+                uint64_t v = x / (p * m);
+                part->s2 -= l->mu[m] * (part->count[b] + lmo_prefix(s, v - seg_lo));
+                part->weight[b] -= l->mu[m];
+            }
+            part->count[b] += left;
+
+            /* Cross off p and its multiples */
+            uint64_t first = (seg_lo + p - 1) / p * p;
+            for (uint64_t j = first - seg_lo; j < n; j += p) {
+                uint64_t bit = 1ull << (j & 63);
+                if (s->bits[j >> 6] & bit) {
+                    s->bits[j >> 6] &= ~bit;
+                    for (uint64_t i = (j >> 6) + 1; i <= words; i += i & (0 - i)) s->tree[i]--;
+                    left--;
+                }
+            }
+        }
+        /* P2: pi(v) = a - 1 + (numbers left in [1, v]) for v = x / p_k,
+         * y < p_k <= sqrt(x); the term is pi(v) - k + 1 */
+        uint64_t p_min = x / seg_hi, p_max = x / seg_lo;   /* p_min < p_k <= p_max */
+        if (p_min < y) p_min = y;
+        int k0 = l->a, k1 = l->nprimes;
+        while (k0 < k1) { int mid = (k0 + k1) / 2; if (pr[mid] <= p_min) k0 = mid + 1; else k1 = mid; }
+        for (int k = k0; k < l->nprimes && pr[k] <= p_max; k++) {
+            uint64_t v = x / pr[k];
+            part->p2 += (int64_t)l->a - (k + 1) + part->count[l->a + 1] + lmo_prefix(s, v - seg_lo);
+            part->queries++;
+        }
+        part->count[l->a + 1] += left;
+    }
+}
+
+/* Add the numbers kept before an interval (prefix[b], as in count[]) to its
+ * partial sums, making them relative to an earlier start */
+static inline void lmo_shift(const lmo_t *l, lmo_part_t *p, const int64_t *prefix) {
+    for (int b = 1; b <= l->a; b++) p->s2 += p->weight[b] * prefix[b];
+    p->p2 += p->queries * prefix[l->a + 1];
+}
+
+/* dst covers [lo, mid), src covers [mid, hi): afterwards dst covers [lo, hi) */
+static inline void lmo_merge(const lmo_t *l, lmo_part_t *dst, lmo_part_t *src) {
+    lmo_shift(l, src, dst->count);
+    dst->s2 += src->s2;
+    dst->p2 += src->p2;
+    dst->queries += src->queries;
+    for (int b = 1; b <= l->a + 1; b++) {
+        dst->count[b] += src->count[b];
+        dst->weight[b] += src->weight[b];
+    }
+}
+
+/* pi(x) from S1 and the merged interval [1, z] */
+static inline int64_t lmo_pi(const lmo_t *l, int64_t s1, int64_t s2, int64_t p2) {
+    if (l->x < 2) return 0;                     /* phi(0, 0) = 0 breaks the formula */
+    return s1 + s2 + l->a - 1 - p2;
+}
+
+#endif /* PRIME_COUNT_H */
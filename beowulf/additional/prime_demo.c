@@ -1,81 +1,388 @@
 #include <mpi.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
+#include <string.h>
 
-#define LIMIT 10000000000  // Checking up to 10 Million
+#include "thread_pool.h"
+#include "prime_sieve.h"
+#include "prime_count.h"
 
-int isPrime(int n) {
-    if (n <= 1) return 0;
-    if (n <= 3) return 1;
-    if (n % 2 == 0 || n % 3 == 0) return 0;
-    for (int i = 5; i * i <= n; i = i + 6)
-        if (n % i == 0 || n % (i + 2) == 0)
-            return 0;
-    return 1;
+#define LIMIT 10000000000ULL  // Count primes up to 10 Billion
+
+// HYBRID MODE: run one rank per node and use the node's cores as threads
+//   mpirun --hostfile hosts --map-by ppr:1:node ./prime_demo --threads hosts
+// --threads takes N, auto, or a hostfile with threads=N (see thread_pool.h).
+// Build: mpicc -O3 -pthread -o prime_demo prime_demo.c -lm
+//
+// The count comes from a segmented, odd-only, bit-packed sieve of
+// Eratosthenes (see prime_sieve.h), not trial division. --limit N sets the
+// upper bound (up to 64 bits, default LIMIT); --segment KB overrides the
+// segment size (default: half the L2 cache).
+//
+// --method lmo only counts: pi(LIMIT) by the Lagarias-Miller-Odlyzko
+// (Meissel-Lehmer) formula in prime_count.h, O(LIMIT^(2/3)) instead of
+// O(LIMIT), e.g. 10^13 in seconds. Its sieve of [1, LIMIT^(2/3)] is split
+// over ranks and threads, and the pieces' partial sums are combined with
+// MPI_Exscan and MPI_Reduce. --check also runs the sieve and compares.
+//
+// SCHEDULING (sieve): --schedule static (default) gives every rank one equal
+// block. --schedule dynamic|guided lets ranks claim runs of segments from a
+// shared counter instead, an MPI RMA window on rank 0 bumped with
+// MPI_Fetch_and_op, so there is no master: a rank
+// with more threads (master slots=2 in hosts) or a faster CPU simply comes
+// back for more. dynamic claims --block segments at a time (default 4);
+// guided claims remaining / (2 * ranks), but at least --block (default 1),
+// so the last claims are small and everyone finishes together.
+
+// Per-thread prime counts, one cache line each
+typedef struct {
+    uint64_t count;
+    char pad[56];
+} ThreadCount;
+
+typedef struct {
+    const sieve_t *sieve;
+    uint64_t first_bit, end_bit;   // this rank's odd numbers, as sieve bits
+    uint64_t *bits;                // seg_words of scratch per thread
+    ThreadCount *counts;
+} SieveJob;
+
+// Sieve segments [lo, hi) of this rank's range (one thread-pool task)
+static void count_primes(long lo, long hi, int tid, void *arg) {
+    SieveJob *job = (SieveJob *)arg;
+    uint64_t seg_bits = 64 * job->sieve->seg_words;
+    uint64_t *bits = job->bits + (size_t)tid * job->sieve->seg_words;
+    uint64_t found = 0;
+    for (long s = lo; s < hi; s++) {
+        uint64_t b0 = job->first_bit + (uint64_t)s * seg_bits;
+        uint64_t b1 = b0 + seg_bits < job->end_bit ? b0 + seg_bits : job->end_bit;
+        found += sieve_count(job->sieve, b0, b1, bits);
+    }
+    job->counts[tid].count += found;
 }
 
-int main(int argc, char *argv[]) {
+enum { SCHED_STATIC, SCHED_DYNAMIC, SCHED_GUIDED };
+
+// Claims are numbered tickets taken from a shared counter (an RMA window on
+// rank 0, one MPI_Fetch_and_op each), and ticket t covers a run of
+// segments every rank can work out for itself: dynamic runs are all
+// `block` long; guided run t is max(block, remaining / (2 * ranks)) of what
+// runs 0..t-1 left over. So there is no compare-and-swap and no retry loop.
+typedef struct {
+    int schedule;
+    int64_t block, total, size;
+    int64_t ticket, first;     // the last run worked out locally
+} Claims;
+
+// Next run [*first, *first + n) for this rank; returns n, or 0 once all
+// segments are taken
+static int64_t claim_segments(Claims *c, MPI_Win win, int64_t *first) {
+    const int64_t one = 1;
+    int64_t t;
+    MPI_Fetch_and_op(&one, &t, MPI_INT64_T, 0, 0, MPI_SUM, win);
+    MPI_Win_flush(0, win);
+    if (c->schedule == SCHED_DYNAMIC) {
+        if (t >= (c->total + c->block - 1) / c->block) return 0;
+        *first = t * c->block;
+    } else {
+        // Tickets only grow, so carry on from the last one worked out
+        while (c->ticket < t && c->first < c->total) {
+            int64_t n = (c->total - c->first) / (2 * c->size);
+            c->first += n > c->block ? n : c->block;
+            c->ticket++;
+        }
+        if (c->first >= c->total) return 0;
+        *first = c->first;
+    }
+    int64_t n = c->block;
+    if (c->schedule == SCHED_GUIDED && (c->total - *first) / (2 * c->size) > n)
+        n = (c->total - *first) / (2 * c->size);
+    return *first + n <= c->total ? n : c->total - *first;
+}
+
+// Sieve mode: every rank counts the primes in its share of 1..limit.
+// Returns the total on rank 0; prints each rank's share if verbose.
+static uint64_t sieve_pi(uint64_t limit, const uint32_t *primes, int nprimes, uint64_t seg_bytes,
+                         int schedule, int64_t block, thread_pool_t *pool, int verbose) {
     int rank, size;
-    int local_count = 0;
-    int global_count = 0;
+    char hostname[MPI_MAX_PROCESSOR_NAME];
+    int name_len;
+    uint64_t local_count = 0, global_count = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Get_processor_name(hostname, &name_len);
+
+    sieve_t sieve;
+    sieve_init(&sieve, primes, nprimes, seg_bytes);
+
+    // --- BLOCK DISTRIBUTION LOGIC ---
+    // Odd number 2b + 1 is bit b; bits [0, total_bits) cover 1..LIMIT.
+    // Each rank gets an equal run of whole 64-bit words.
+    uint64_t total_bits = (limit + 1) / 2;
+    uint64_t total_words = (total_bits + 63) / 64;
+    uint64_t first_bit = 64 * (total_words * rank / size);
+    uint64_t end_bit = 64 * (total_words * (rank + 1) / size);
+    if (end_bit > total_bits) end_bit = total_bits;
+    if (first_bit > end_bit) first_bit = end_bit;
+
+    uint64_t seg_bits = 64 * sieve.seg_words;
+    ThreadCount *counts = (ThreadCount *)calloc(tp_size(pool), sizeof(ThreadCount));
+    SieveJob job = { &sieve, first_bit, end_bit,
+                     (uint64_t *)malloc((size_t)tp_size(pool) * sieve.seg_words * sizeof(uint64_t)),
+                     counts };
+    if (!counts || !job.bits) MPI_Abort(MPI_COMM_WORLD, 1);
+    int64_t claims = 0, claimed = 0;
+    double busy = 0.0;
+
+    if (schedule == SCHED_STATIC) {
+        // Every rank sieves its own distinct RANGE of numbers,
+        // one segment per thread-pool task
+        long segments = (long)((end_bit - first_bit + seg_bits - 1) / seg_bits);
+        double t0 = MPI_Wtime();
+        tp_parallel_for(pool, 0, segments, 1, count_primes, &job);
+        busy = MPI_Wtime() - t0;
+        claims = 1;
+        claimed = segments;
+    } else {
+        // Self-scheduling: claim runs of global segments until none are left
+        int64_t total = (int64_t)((total_bits + seg_bits - 1) / seg_bits), first, n;
+        Claims c = { schedule, block, total, size, 0, 0 };
+        int64_t *next = NULL;
+        MPI_Win win;
+        MPI_Win_allocate(rank == 0 ? sizeof(int64_t) : 0, sizeof(int64_t), MPI_INFO_NULL,
+                         MPI_COMM_WORLD, &next, &win);
+        if (rank == 0) *next = 0;
+        MPI_Barrier(MPI_COMM_WORLD);   // counter is zero before anyone claims
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+        while ((n = claim_segments(&c, win, &first)) > 0) {
+            job.first_bit = (uint64_t)first * seg_bits;
+            job.end_bit = (uint64_t)(first + n) * seg_bits < total_bits ? (uint64_t)(first + n) * seg_bits
+                                                                       : total_bits;
+            double t0 = MPI_Wtime();
+            tp_parallel_for(pool, 0, n, 1, count_primes, &job);
+            busy += MPI_Wtime() - t0;
+            claims++;
+            claimed += n;
+        }
+        MPI_Win_unlock_all(win);
+        MPI_Win_free(&win);
+    }
+    for (int t = 0; t < tp_size(pool); t++) {
+        local_count += counts[t].count;
+    }
+    if (rank == 0 && limit >= 2) local_count++;   // 2, the only even prime
+    free(job.bits);
+    free(counts);
+
+    // Gather results
+    MPI_Reduce(&local_count, &global_count, 1, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // Print individual results
+    if (verbose && schedule != SCHED_STATIC) {
+        printf("  [Node %s | Rank %d | %d threads] Claimed %lld segments in %lld runs | "
+               "Found %llu primes | busy %.3f s\n",
+               hostname, rank, tp_size(pool), (long long)claimed, (long long)claims,
+               (unsigned long long)local_count, busy);
+    } else if (verbose) {
+        unsigned long long start_num = 2 * first_bit + 1;
+        unsigned long long end_num = end_bit > first_bit ? 2 * end_bit : start_num;
+        if (end_num > limit) end_num = limit;
+        printf("  [Node %s | Rank %d | %d threads] Range: %llu to %llu | Found %llu primes | busy %.3f s\n",
+               hostname, rank, tp_size(pool), start_num, end_num, (unsigned long long)local_count, busy);
+    }
+    return global_count;
+}
+
+typedef struct {
+    const lmo_t *lmo;
+    uint64_t lo, hi;               // this rank's piece of [1, z]
+    long pieces;
+    lmo_part_t *parts;             // one per piece
+    lmo_scratch_t *scratch;        // one per thread
+} LmoJob;
+
+// Partial sums of pieces [lo, hi) of this rank's interval (one thread-pool task)
+static void lmo_pieces(long lo, long hi, int tid, void *arg) {
+    LmoJob *job = (LmoJob *)arg;
+    uint64_t len = job->hi - job->lo;
+    for (long k = lo; k < hi; k++) {
+        uint64_t a = job->lo + len * k / job->pieces, b = job->lo + len * (k + 1) / job->pieces;
+        lmo_interval(job->lmo, a, b, &job->parts[k], &job->scratch[tid]);
+    }
+}
+
+// LMO mode: pi(limit) on rank 0. The sieve of [1, z] is cut into one
+// interval per rank and a few pieces per thread; pieces merge in order on
+// each rank, then every rank adds the counts of the ranks before it
+// (Exscan) and the sums meet on rank 0.
+static uint64_t lmo_pi_mpi(uint64_t limit, const uint32_t *primes, int nprimes,
+                           thread_pool_t *pool) {
+    int rank, size;
+    char hostname[MPI_MAX_PROCESSOR_NAME];
+    int name_len;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Get_processor_name(hostname, &name_len);
+
+    // The formula needs 2 as well as the odd base primes
+    uint32_t *all = (uint32_t *)malloc((nprimes + 1) * sizeof(uint32_t));
+    if (!all) MPI_Abort(MPI_COMM_WORLD, 1);
+    all[0] = 2;
+    memcpy(all + 1, primes, nprimes * sizeof(uint32_t));
+
+    // y = alpha x^(1/3): a larger y shortens the sieve but adds leaves
+    double alpha = limit > 1000000 ? log10((double)limit) / 4.5 : 1.0;
+    lmo_t lmo;
+    if (lmo_init(&lmo, limit, all, nprimes + 1, alpha) != 0) MPI_Abort(MPI_COMM_WORLD, 1);
+
+    uint64_t lo = 1 + lmo.z * rank / size, hi = 1 + lmo.z * (rank + 1) / size;
+    long pieces = 4 * tp_size(pool);
+    if ((uint64_t)pieces > (hi - lo) / LMO_SEGMENT + 1) pieces = (long)((hi - lo) / LMO_SEGMENT + 1);
+    LmoJob job = { &lmo, lo, hi, pieces,
+                   (lmo_part_t *)calloc(pieces, sizeof(lmo_part_t)),
+                   (lmo_scratch_t *)calloc(tp_size(pool), sizeof(lmo_scratch_t)) };
+    if (!job.parts || !job.scratch) MPI_Abort(MPI_COMM_WORLD, 1);
+    for (long k = 0; k < pieces; k++)
+        if (lmo_part_alloc(&lmo, &job.parts[k]) != 0) MPI_Abort(MPI_COMM_WORLD, 1);
+    for (int t = 0; t < tp_size(pool); t++)
+        if (lmo_scratch_alloc(&job.scratch[t]) != 0) MPI_Abort(MPI_COMM_WORLD, 1);
+
+    tp_parallel_for(pool, 0, pieces, 1, lmo_pieces, &job);
+    lmo_part_t *mine = &job.parts[0];
+    for (long k = 1; k < pieces; k++) lmo_merge(&lmo, mine, &job.parts[k]);
+
+    // Numbers kept by the ranks before this one
+    int64_t *before = (int64_t *)calloc(lmo.a + 2, sizeof(int64_t));
+    if (!before) MPI_Abort(MPI_COMM_WORLD, 1);
+    MPI_Exscan(mine->count, before, lmo.a + 2, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) memset(before, 0, (lmo.a + 2) * sizeof(int64_t));   // Exscan leaves it undefined
+    lmo_shift(&lmo, mine, before);
+
+    int64_t local[2] = { mine->s2, mine->p2 }, total[2] = { 0, 0 };
+    MPI_Reduce(local, total, 2, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    printf("  [Node %s | Rank %d | %d threads] Sieved %llu to %llu of [1, %llu] (y = %llu)\n",
+           hostname, rank, tp_size(pool), (unsigned long long)lo,
+           (unsigned long long)(hi > lo ? hi - 1 : lo), (unsigned long long)lmo.z,
+           (unsigned long long)lmo.y);
+
+    uint64_t pi = rank == 0 ? (uint64_t)lmo_pi(&lmo, lmo_s1(&lmo), total[0], total[1]) : 0;
+    for (long k = 0; k < pieces; k++) lmo_part_free(&job.parts[k]);
+    for (int t = 0; t < tp_size(pool); t++) lmo_scratch_free(&job.scratch[t]);
+    free(job.parts);
+    free(job.scratch);
+    free(before);
+    lmo_free(&lmo);
+    free(all);
+    return pi;
+}
+
+int main(int argc, char *argv[]) {
+    int rank, size, provided;
+    uint64_t global_count = 0;
     double start_time, end_time;
     char hostname[MPI_MAX_PROCESSOR_NAME];
     int name_len;
 
-    MPI_Init(&argc, &argv);
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
     MPI_Get_processor_name(hostname, &name_len);
 
+    const char *threads_spec = NULL;
+    uint64_t limit = LIMIT;
+    uint64_t seg_bytes = sieve_default_segment();
+    int use_lmo = 0, check = 0;
+    int schedule = SCHED_STATIC;
+    int64_t block = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads_spec = argv[++i];
+        else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc) limit = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--segment") == 0 && i + 1 < argc) seg_bytes = 1024 * strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--check") == 0) check = 1;
+        else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc) block = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--schedule") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "static") == 0) schedule = SCHED_STATIC;
+            else if (strcmp(argv[i], "dynamic") == 0) schedule = SCHED_DYNAMIC;
+            else if (strcmp(argv[i], "guided") == 0) schedule = SCHED_GUIDED;
+            else {
+                if (rank == 0) fprintf(stderr, "Unknown schedule '%s' (use static, dynamic or guided)\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--method") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "sieve") == 0) use_lmo = 0;
+            else if (strcmp(argv[i], "lmo") == 0) use_lmo = 1;
+            else {
+                if (rank == 0) fprintf(stderr, "Unknown method '%s' (use sieve or lmo)\n", argv[i]);
+                MPI_Finalize();
+                return 1;
+            }
+        }
+    }
+    if (block == 0) block = schedule == SCHED_DYNAMIC ? 4 : 1;
+    if (seg_bytes < 1024 || block < 1) {
+        if (rank == 0) fprintf(stderr, "--segment and --block must be at least 1\n");
+        MPI_Finalize();
+        return 1;
+    }
+    int nthreads = tp_resolve_threads(threads_spec, hostname, tp_ranks_on_node(MPI_COMM_WORLD));
+    thread_pool_t *pool = tp_create(tp_mpi_threads(nthreads, provided));
+    if (!pool) MPI_Abort(MPI_COMM_WORLD, 1);
+
     // Master starts timer
     MPI_Barrier(MPI_COMM_WORLD);
     if (rank == 0) {
         printf("\n=== PRIME NUMBER HUNT (Block Distribution) ===\n");
-        printf("Searching for primes up to %d on %d processors...\n", LIMIT, size);
+        printf("%s primes up to %llu on %d processors (%s)...\n",
+               use_lmo ? "Counting" : "Searching for", (unsigned long long)limit, size,
+               use_lmo ? "Lagarias-Miller-Odlyzko" : "segmented sieve");
         start_time = MPI_Wtime();
     }
 
-    // --- BLOCK DISTRIBUTION LOGIC ---
-    // Calculate the range for each process
-    int items_per_proc = LIMIT / size;
-    int remainder = LIMIT % size;
-    
-    int start_num, end_num;
-
-    // Distribute the remainder so no one gets left out
-    if (rank < remainder) {
-        start_num = rank * (items_per_proc + 1) + 1;
-        end_num = start_num + items_per_proc;
-    } else {
-        start_num = rank * items_per_proc + remainder + 1;
-        end_num = start_num + (items_per_proc - 1);
-    }
-
-    // Every rank checks its own distinct RANGE of numbers
-    for (int i = start_num; i <= end_num; i++) {
-        if (isPrime(i)) {
-            local_count++;
-        }
-    }
+    // --- BASE PRIMES ---
+    // The odd primes up to sqrt(LIMIT) cross off everything else; the
+    // master finds them once and shares them
+    uint32_t *primes = NULL;
+    int nprimes = 0;
+    if (rank == 0 && sieve_base_primes(limit, &primes, &nprimes) != 0) MPI_Abort(MPI_COMM_WORLD, 1);
+    MPI_Bcast(&nprimes, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank != 0) primes = (uint32_t *)malloc((nprimes + 1) * sizeof(uint32_t));
+    if (!primes) MPI_Abort(MPI_COMM_WORLD, 1);
+    MPI_Bcast(primes, nprimes, MPI_UINT32_T, 0, MPI_COMM_WORLD);
 
-    // Gather results
-    MPI_Reduce(&local_count, &global_count, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (use_lmo) global_count = lmo_pi_mpi(limit, primes, nprimes, pool);
+    else global_count = sieve_pi(limit, primes, nprimes, seg_bytes, schedule, block, pool, 1);
 
     MPI_Barrier(MPI_COMM_WORLD);
     end_time = MPI_Wtime();
 
-    // Print individual results (Now everyone should have ~100k)
-    printf("  [Node %s | Rank %d] Range: %d to %d | Found %d primes.\n", 
-           hostname, rank, start_num, end_num, local_count);
-    
+    // Same count the other way (not timed)
+    uint64_t check_count = 0;
+    if (check) {
+        if (use_lmo) check_count = sieve_pi(limit, primes, nprimes, seg_bytes, schedule, block, pool, 0);
+        else check_count = lmo_pi_mpi(limit, primes, nprimes, pool);
+    }
+
     MPI_Barrier(MPI_COMM_WORLD);
     if (rank == 0) {
         printf("\n--- SUMMARY ---\n");
-        printf("Total Primes Found: %d\n", global_count);
+        printf("Total Primes Found: %llu\n", (unsigned long long)global_count);
         printf("Time Taken        : %.4f seconds\n", end_time - start_time);
+        if (check) {
+            printf("Check (%s)  : %llu, %s\n", use_lmo ? "sieve" : "lmo  ",
+                   (unsigned long long)check_count, check_count == global_count ? "OK" : "MISMATCH");
+        }
         printf("=======================\n");
     }
 
+    tp_destroy(pool);
+    free(primes);
     MPI_Finalize();
-    return 0;
+    return check && rank == 0 && check_count != global_count ? 1 : 0;
 }
@@ -0,0 +1,148 @@
+#ifndef PRIME_SIEVE_H
+#define PRIME_SIEVE_H
+
+/*
+ * Segmented sieve of Eratosthenes over 64-bit ranges, for prime_demo.
+ *
+ *   sieve_base_primes(limit, &primes, &n);      // odd primes <= sqrt(limit)
+ *   sieve_t s;
+ *   sieve_init(&s, primes, n, seg_bytes);
+ *   count = sieve_count(&s, b0, b1, bits);      // bits: seg_words words
+ *
+ * Only odd numbers are stored, one bit each: bit b stands for 2b + 1, so a
+ * 64-bit word covers 128 numbers. The range is cut into segments of
+ * seg_bytes (sized to L2, see sieve_default_segment), each sieved on its
+ * own with every base prime p <= sqrt(hi) crossed off from max(p^2, lo).
+ *
+ * Wheel: 2 is gone with the odd-only layout. 3, 5 and 7 are never crossed
+ * off at all: their multiples repeat every 105 bits, so a 105-word
+ * (64 * 105 bits) pre-sieved pattern is copied into each segment instead,
+ * which removes the three most expensive primes (~54% of the candidate
+ * bits) for the cost of a memcpy. Segments start on word boundaries so the
+ * pattern lines up with a simple word rotation.
+ *
+ * Counts are popcounts. sieve_count fixes up 1, 3, 5 and 7 itself; the
+ * caller adds the prime 2.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIEVE_WHEEL_WORDS 105   /* 3 * 5 * 7 bits of period, in 64-bit words */
+
+typedef struct {
+    const uint32_t *primes;     /* odd base primes 3, 5, 7, 11, ... */
+    int nprimes;
+    uint64_t seg_words;         /* words per segment */
+    uint64_t wheel[SIEVE_WHEEL_WORDS];
+} sieve_t;
+
+/* floor(sqrt(n)) for any 64-bit n */
+static inline uint64_t sieve_isqrt(uint64_t n) {
+    uint64_t r = (uint64_t)sqrtl((long double)n);
+    while (r > 0 && r * r > n) r--;
+    while ((r + 1) * (r + 1) <= n) r++;
+    return r;
+}
+
+/* Odd primes <= sqrt(limit) by a plain odd-only sieve. Returns 0, or -1 on
+ * allocation failure. *primes is malloc'd (at least one entry). */
+static inline int sieve_base_primes(uint64_t limit, uint32_t **primes, int *n) {
+    uint64_t r = sieve_isqrt(limit);
+    uint64_t half = r / 2 + 1;              /* flag i stands for 2i + 1 */
+    unsigned char *comp = (unsigned char *)calloc(half, 1);
+    /* pi(r) < 1.26 r / ln r */
+    *primes = (uint32_t *)malloc(((size_t)(1.26 * r / log((double)r + 2)) + 16) * sizeof(uint32_t));
+    *n = 0;
+    if (!comp || !*primes) {
+        free(comp);
+        free(*primes);
+        *primes = NULL;
+        return -1;
+    }
+    for (uint64_t i = 1; i < half; i++) {
+        if (comp[i]) continue;
+        uint64_t p = 2 * i + 1;
+        if (p > r) break;
+        (*primes)[(*n)++] = (uint32_t)p;
+        for (uint64_t j = (p * p) / 2; j < half; j += p) comp[j] = 1;
+    }
+    free(comp);
+    return 0;
+}
+
+/* Segment size in bytes: half of L2 (the other half is for everything
+ * else a thread touches), clamped to [32 KiB, 1 MiB] */
+static inline uint64_t sieve_default_segment(void) {
+    long l2 = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    uint64_t bytes = l2 > 0 ? (uint64_t)l2 / 2 : 128 * 1024;
+    if (bytes < 32 * 1024) bytes = 32 * 1024;
+    if (bytes > 1024 * 1024) bytes = 1024 * 1024;
+    return bytes;
+}
+
+static inline void sieve_init(sieve_t *s, const uint32_t *primes, int nprimes, uint64_t seg_bytes) {
+    s->primes = primes;
+    s->nprimes = nprimes;
+    s->seg_words = seg_bytes / 8 > 0 ? seg_bytes / 8 : 1;
+    /* Bit k of the pattern is odd number 2k + 1: clear multiples of 3, 5, 7 */
+    for (int w = 0; w < SIEVE_WHEEL_WORDS; w++) {
+        uint64_t word = 0;
+        for (int b = 0; b < 64; b++) {
+            uint64_t v = 2 * (64 * (uint64_t)w + b) + 1;
+            if (v % 3 != 0 && v % 5 != 0 && v % 7 != 0) word |= 1ull << b;
+        }
+        s->wheel[w] = word;
+    }
+}
+
+/* Number of primes among the odd numbers of bits [b0, b1), i.e. in
+ * [2 b0 + 1, 2 b1 - 1]. b0 must be a multiple of 64 and b1 - b0 at most
+ * 64 * seg_words. bits is scratch of seg_words words. */
+static inline uint64_t sieve_count(const sieve_t *s, uint64_t b0, uint64_t b1, uint64_t *bits) {
+    if (b1 <= b0) return 0;
+    uint64_t len = b1 - b0;
+    uint64_t words = (len + 63) / 64;
+
+    /* Pre-sieved 3 * 5 * 7 wheel, rotated to this segment's phase */
+    uint64_t phase = (b0 / 64) % SIEVE_WHEEL_WORDS;
+    for (uint64_t w = 0; w < words;) {
+        uint64_t chunk = SIEVE_WHEEL_WORDS - phase;
+        if (chunk > words - w) chunk = words - w;
+        memcpy(bits + w, s->wheel + phase, chunk * sizeof(uint64_t));
+        w += chunk;
+        phase = 0;
+    }
+
+    uint64_t lo = 2 * b0 + 1, hi = 2 * (b1 - 1) + 1;
+    for (int k = 3; k < s->nprimes; k++) {       /* primes[0..2] = 3, 5, 7 */
+        uint64_t p = s->primes[k];
+        uint64_t m = p * p;
+        if (m > hi) break;
+        if (m < lo) {
+            m = (lo + p - 1) / p * p;
+            if ((m & 1) == 0) m += p;                /* odd multiples only */
+        }
+        for (uint64_t j = (m - 1) / 2 - b0; j < len; j += p)
+            bits[j >> 6] &= ~(1ull << (j & 63));
+    }
+
+    if (len & 63) bits[words - 1] &= (1ull << (len & 63)) - 1;
+    uint64_t count = 0;
+    for (uint64_t w = 0; w < words; w++) count += (uint64_t)__builtin_popcountll(bits[w]);
+
+    /* The wheel marks 1 as a candidate and 3, 5, 7 as composite */
+    if (b0 == 0) {
+        count -= 1;
+        for (uint64_t b = 1; b <= 3 && b < b1; b++) count++;
+    }
+    return count;
+}
+
+#endif /* PRIME_SIEVE_H */
@@ -0,0 +1,229 @@
+#ifndef RNG_H
+#define RNG_H
+
+/*
+ * Counter-based random numbers (Philox4x32-10, Salmon et al., SC'11) for
+ * the Monte Carlo programs (pi_mpi, area_mpi, via mc_engine.h).
+ *
+ *   rng_t r;
+ *   rng_init(&r, seed, chunk, rank);
+ *   rng_uniform(&r, u, n);                  // n doubles in [0, 1)
+ *
+ * Philox is a keyed bijection on 128-bit counters: block i of a stream is
+ * philox(key = seed, counter = (i, rank, chunk)), four 32-bit words that
+ * make two doubles. There is no state to carry from one number to the
+ * next, so
+ *   - a stream is fixed by (seed, chunk, rank): a chunk that a launcher
+ *     retries comes back with the same numbers, bit for bit;
+ *   - number k of a stream does not depend on how it was drawn (batch
+ *     sizes, kernel), so rng_skip() can jump anywhere in O(1);
+ *   - blocks are independent, so the SIMD kernels run 4 (AVX2) or 8
+ *     (AVX-512) of them side by side with 32x32->64 bit multiplies.
+ * All kernels give identical output; rng_select_kernel() picks the widest
+ * one this CPU supports (see cpu_kernel.h).
+ *
+ * A double is (w_hi:w_lo) >> 12 placed in the mantissa of [1, 2), minus 1:
+ * 52 random bits, exact and the same on every kernel.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RNG_X86 1
+#endif
+
+#define RNG_M0 0xD2511F53u   /* Philox4x32 multipliers */
+#define RNG_M1 0xCD9E8D57u
+#define RNG_W0 0x9E3779B9u   /* Weyl key increments */
+#define RNG_W1 0xBB67AE85u
+#define RNG_ROUNDS 10
+
+/* Writes 2 * nblocks doubles for blocks first, first + 1, ... of a stream */
+typedef void (*rng_kernel_fn)(const uint32_t key[2], uint32_t rank, uint32_t chunk,
+                              uint64_t first, size_t nblocks, double *out);
+
+typedef struct {
+    const char *name;
+    rng_kernel_fn run;
+} rng_kernel_t;
+
+typedef struct {
+    uint32_t key[2];
+    uint32_t rank, chunk;
+    uint64_t pos;                   /* next double of the stream */
+    const rng_kernel_t *kernel;
+} rng_t;
+
+/* The bare block function: ctr and key in, 4 words out */
+static inline void rng_philox(const uint32_t ctr_in[4], const uint32_t key_in[2], uint32_t out[4]) {
+    uint32_t c0 = ctr_in[0], c1 = ctr_in[1], c2 = ctr_in[2], c3 = ctr_in[3];
+    uint32_t k0 = key_in[0], k1 = key_in[1];
+    for (int r = 0; r < RNG_ROUNDS; r++) {
+        uint64_t p0 = (uint64_t)RNG_M0 * c0, p1 = (uint64_t)RNG_M1 * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0, n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        c0 = n0;
+        c2 = n2;
+        k0 += RNG_W0;
+        k1 += RNG_W1;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+static inline double rng_to_double(uint32_t hi, uint32_t lo) {
+    uint64_t bits = ((((uint64_t)hi << 32) | lo) >> 12) | 0x3FF0000000000000ull;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d - 1.0;
+}
+
+static void rng_kernel_scalar(const uint32_t key[2], uint32_t rank, uint32_t chunk,
+                              uint64_t first, size_t nblocks, double *out) {
+    for (size_t i = 0; i < nblocks; i++) {
+        uint64_t b = first + i;
+        uint32_t ctr[4] = { (uint32_t)b, (uint32_t)(b >> 32), rank, chunk }, w[4];
+        rng_philox(ctr, key, w);
+        out[2 * i] = rng_to_double(w[0], w[1]);
+        out[2 * i + 1] = rng_to_double(w[2], w[3]);
+    }
+}
+
+#ifdef RNG_X86
+/* Lanes are 64-bit, each holding one 32-bit word of one block, so
+ * _mm*_mul_epu32 gives the full 64-bit Philox product per lane. */
+
+__attribute__((target("avx2")))
+static void rng_kernel_avx2(const uint32_t key[2], uint32_t rank, uint32_t chunk,
+                            uint64_t first, size_t nblocks, double *out) {
+    const __m256i lo32 = _mm256_set1_epi64x(0xFFFFFFFFll);
+    const __m256i m0 = _mm256_set1_epi64x(RNG_M0), m1 = _mm256_set1_epi64x(RNG_M1);
+    const __m256i one = _mm256_castpd_si256(_mm256_set1_pd(1.0));
+    size_t i = 0;
+    for (; i + 4 <= nblocks; i += 4) {
+        __m256i b = _mm256_add_epi64(_mm256_set1_epi64x((long long)(first + i)),
+                                     _mm256_setr_epi64x(0, 1, 2, 3));
+        __m256i c0 = _mm256_and_si256(b, lo32), c1 = _mm256_srli_epi64(b, 32);
+        __m256i c2 = _mm256_set1_epi64x(rank), c3 = _mm256_set1_epi64x(chunk);
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int r = 0; r < RNG_ROUNDS; r++) {
+            __m256i p0 = _mm256_mul_epu32(c0, m0), p1 = _mm256_mul_epu32(c2, m1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p1, 32), c1), _mm256_set1_epi64x(k0));
+            c2 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p0, 32), c3), _mm256_set1_epi64x(k1));
+            c1 = _mm256_and_si256(p1, lo32);
+            c3 = _mm256_and_si256(p0, lo32);
+            k0 += RNG_W0;
+            k1 += RNG_W1;
+        }
+        __m256i u0 = _mm256_srli_epi64(_mm256_or_si256(_mm256_slli_epi64(c0, 32), c1), 12);
+        __m256i u1 = _mm256_srli_epi64(_mm256_or_si256(_mm256_slli_epi64(c2, 32), c3), 12);
+        __m256d d0 = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(u0, one)), _mm256_set1_pd(1.0));
+        __m256d d1 = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(u1, one)), _mm256_set1_pd(1.0));
+        /* Interleave to block order: d0[0] d1[0] d0[1] d1[1] ... */
+        __m256d lo = _mm256_unpacklo_pd(d0, d1), hi = _mm256_unpackhi_pd(d0, d1);
+        _mm256_storeu_pd(out + 2 * i, _mm256_permute2f128_pd(lo, hi, 0x20));
+        _mm256_storeu_pd(out + 2 * i + 4, _mm256_permute2f128_pd(lo, hi, 0x31));
+    }
+    rng_kernel_scalar(key, rank, chunk, first + i, nblocks - i, out + 2 * i);
+}
+
+__attribute__((target("avx512f")))
+static void rng_kernel_avx512(const uint32_t key[2], uint32_t rank, uint32_t chunk,
+                              uint64_t first, size_t nblocks, double *out) {
+    const __m512i lo32 = _mm512_set1_epi64(0xFFFFFFFFll);
+    const __m512i m0 = _mm512_set1_epi64(RNG_M0), m1 = _mm512_set1_epi64(RNG_M1);
+    const __m512i one = _mm512_castpd_si512(_mm512_set1_pd(1.0));
+    const __m512i ilo = _mm512_setr_epi64(0, 8, 1, 9, 2, 10, 3, 11);
+    const __m512i ihi = _mm512_setr_epi64(4, 12, 5, 13, 6, 14, 7, 15);
+    size_t i = 0;
+    for (; i + 8 <= nblocks; i += 8) {
+        __m512i b = _mm512_add_epi64(_mm512_set1_epi64((long long)(first + i)),
+                                     _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7));
+        __m512i c0 = _mm512_and_si512(b, lo32), c1 = _mm512_srli_epi64(b, 32);
+        __m512i c2 = _mm512_set1_epi64(rank), c3 = _mm512_set1_epi64(chunk);
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int r = 0; r < RNG_ROUNDS; r++) {
+            __m512i p0 = _mm512_mul_epu32(c0, m0), p1 = _mm512_mul_epu32(c2, m1);
+            /* 0x96 = a ^ b ^ c */
+            c0 = _mm512_ternarylogic_epi64(_mm512_srli_epi64(p1, 32), c1, _mm512_set1_epi64(k0), 0x96);
+            c2 = _mm512_ternarylogic_epi64(_mm512_srli_epi64(p0, 32), c3, _mm512_set1_epi64(k1), 0x96);
+            c1 = _mm512_and_si512(p1, lo32);
+            c3 = _mm512_and_si512(p0, lo32);
+            k0 += RNG_W0;
+            k1 += RNG_W1;
+        }
+        __m512i u0 = _mm512_srli_epi64(_mm512_or_si512(_mm512_slli_epi64(c0, 32), c1), 12);
+        __m512i u1 = _mm512_srli_epi64(_mm512_or_si512(_mm512_slli_epi64(c2, 32), c3), 12);
+        __m512d d0 = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(u0, one)), _mm512_set1_pd(1.0));
+        __m512d d1 = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(u1, one)), _mm512_set1_pd(1.0));
+        _mm512_storeu_pd(out + 2 * i, _mm512_permutex2var_pd(d0, ilo, d1));
+        _mm512_storeu_pd(out + 2 * i + 8, _mm512_permutex2var_pd(d0, ihi, d1));
+    }
+    rng_kernel_scalar(key, rank, chunk, first + i, nblocks - i, out + 2 * i);
+}
+#endif /* RNG_X86 */
+
+static const rng_kernel_t rng_kernels[] = {
+#ifdef RNG_X86
+    { "avx512", rng_kernel_avx512 },
+    { "avx2",   rng_kernel_avx2 },
+#endif
+    { "scalar", rng_kernel_scalar },
+};
+
+static inline int rng_kernel_supported(const char *name) {
+#ifdef RNG_X86
+    if (strcmp(name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+    if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+/* Pick a kernel by name, or the widest usable one (see cpu_kernel.h) */
+static inline const rng_kernel_t *rng_select_kernel(const char *name) {
+    int n = (int)(sizeof(rng_kernels) / sizeof(rng_kernels[0]));
+    return (const rng_kernel_t *)cpu_kernel_select(rng_kernels, n, sizeof(rng_kernels[0]), name,
+                                                   rng_kernel_supported);
+}
+
+/* Stream (seed, chunk, rank), positioned at its first number */
+static inline void rng_init(rng_t *r, uint64_t seed, uint32_t chunk, uint32_t rank) {
+    r->key[0] = (uint32_t)seed;
+    r->key[1] = (uint32_t)(seed >> 32);
+    r->rank = rank;
+    r->chunk = chunk;
+    r->pos = 0;
+    r->kernel = rng_select_kernel(NULL);
+}
+
+/* Jump n numbers ahead */
+static inline void rng_skip(rng_t *r, uint64_t n) {
+    r->pos += n;
+}
+
+/* Next n uniform doubles in [0, 1) */
+static inline void rng_uniform(rng_t *r, double *out, size_t n) {
+    if (n == 0) return;
+    if (r->pos & 1) {               /* second half of a block drawn before */
+        double pair[2];
+        rng_kernel_scalar(r->key, r->rank, r->chunk, r->pos / 2, 1, pair);
+        *out++ = pair[1];
+        r->pos++;
+        n--;
+    }
+    r->kernel->run(r->key, r->rank, r->chunk, r->pos / 2, n / 2, out);
+    r->pos += n & ~(size_t)1;
+    if (n & 1) {
+        double pair[2];
+        rng_kernel_scalar(r->key, r->rank, r->chunk, r->pos / 2, 1, pair);
+        out[n - 1] = pair[0];
+        r->pos++;
+    }
+}
+
+#endif /* RNG_H */
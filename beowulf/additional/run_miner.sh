@@ -8,6 +8,7 @@
 TOTAL_ITERS=10000000          # Total Hashes to mine (10 Million)
 CHUNK_ITERS=2000000           # Hashes per chunk (2 Million)
 EXEC=./crypto_miner           # The compiled C executable
+LEDGER=/cluster/nonce_ledger.txt  # Shared nonce ledger (see nonce_ledger.h)
 
 # List your nodes here (ensure these are in /etc/hosts)
 NODES=("master" "worker1" "worker2") 
@@ -22,6 +23,7 @@ final_gold_count=0
 final_total_hashes=0
 completed=0
 chunk_id=1
+rm -f "$LEDGER"               # New job, new nonce space
 
 echo "=== Resilient MPI Mining Farm ==="
 echo "Target: $TOTAL_ITERS Hashes"
@@ -77,7 +79,7 @@ while [ $completed -lt $TOTAL_ITERS ]; do
         --mca orte_base_help_aggregate 0 \
         -np "$total_procs" \
         --hostfile "$HOSTFILE" \
-        "$EXEC" "$this_chunk_iters" > "$LOGFILE" 2>&1
+        "$EXEC" "$this_chunk_iters" --chunk-id "$chunk_id" --ledger "$LEDGER" > "$LOGFILE" 2>&1
 
     rc=$?
 
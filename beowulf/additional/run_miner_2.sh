@@ -15,6 +15,7 @@ NC='\033[0m' # No Color
 TOTAL_ITERS=10000000          # Total Hashes
 CHUNK_ITERS=2000000           # Hashes per chunk
 EXEC=./crypto_miner           # C program
+LEDGER=/cluster/nonce_ledger.txt  # Shared nonce ledger
 
 NODES=("master" "worker1" "worker2") 
 SLOTS_PER_NODE=4
@@ -28,6 +29,7 @@ final_gold_count=0
 final_total_hashes=0
 completed=0
 chunk_id=1
+rm -f "$LEDGER"
 
 clear
 echo -e "${CYAN}===============================================${NC}"
@@ -92,7 +94,7 @@ while [ $completed -lt $TOTAL_ITERS ]; do
         --mca orte_base_help_aggregate 0 \
         -np "$total_procs" \
         --hostfile "$HOSTFILE" \
-        "$EXEC" "$this_chunk_iters" > "$LOGFILE" 2>&1
+        "$EXEC" "$this_chunk_iters" --chunk-id "$chunk_id" --ledger "$LEDGER" > "$LOGFILE" 2>&1
 
     rc=$?
 
@@ -110,7 +112,7 @@ while [ $completed -lt $TOTAL_ITERS ]; do
              echo "   Analysis: A process was killed or segmentation fault."
         fi
         
-        echo -e "${CYAN}   Action: Discarding partial work and rescheduling...${NC}"
+        echo -e "${CYAN}   Action: Keeping committed work (ledger), rescheduling the rest...${NC}"
         sleep 2
         continue 
     fi
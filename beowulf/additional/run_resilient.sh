@@ -7,7 +7,7 @@ SLOTS=2
 HOSTFILE="/tmp/hostfile_active"
 
 # Clean log only on fresh start (Optional: remove this if you want persistence across runs)
-rm -f /cluster/task_log.txt
+rm -f /cluster/task_log.txt /cluster/task_journal.bin
 
 # Colors
 RED='\033[0;31m'
@@ -0,0 +1,100 @@
+#ifndef SEARCH_STOP_H
+#define SEARCH_STOP_H
+
+/*
+ * Stop-on-first-solution flag for the nonce searches (crypto_miner and
+ * mining_demo --first): as soon as one rank finds a winner, every rank
+ * stops hashing instead of finishing its share.
+ *
+ *   search_stop_t s;
+ *   search_stop_open(&s, comm);                   // collective, starts clock
+ *   for each slice of at most SEARCH_STOP_POLL nonces:
+ *       hash it; if it had a winner: search_stop_signal(&s, nonce);
+ *       if (search_stop_poll(&s)) break;
+ *   search_stop_close(&s, &nonce, &seconds, &lag); // collective
+ *
+ * The flag is one uint64_t in an RMA window on rank 0 holding the lowest
+ * winning nonce signalled so far (UINT64_MAX: none yet). A finder stores
+ * its nonce with MPI_Fetch_and_op(MPI_MIN); the others read it with
+ * MPI_Fetch_and_op(MPI_NO_OP) between slices. Like the sieve claims in
+ * prime_demo this is passive target, so there is no master and no helper
+ * thread. A poll is one small get (microseconds) per SEARCH_STOP_POLL
+ * nonces (about 1 ms of hashing per rank), so every rank stops within
+ * about one slice of the solve.
+ *
+ * The reported nonce depends on timing: ranks that hit a winner before
+ * they see the flag all signal, and the lowest one is kept. Times are
+ * seconds since the barrier in search_stop_open.
+ */
+
+#include <float.h>
+#include <stdint.h>
+
+#define SEARCH_STOP_POLL (1 << 14)     /* nonces between polls */
+
+typedef struct {
+    MPI_Comm comm;
+    MPI_Win win;
+    uint64_t *flag;                    /* rank 0 only: lowest winner */
+    double t0;
+    double solved;                     /* when this rank signalled, or -1 */
+    double stopped;                    /* when it saw the flag, or -1 */
+    int done;
+} search_stop_t;
+
+static inline void search_stop_open(search_stop_t *s, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    s->comm = comm;
+    s->flag = NULL;
+    MPI_Win_allocate(rank == 0 ? sizeof(uint64_t) : 0, sizeof(uint64_t), MPI_INFO_NULL, comm, &s->flag,
+                     &s->win);
+    if (rank == 0) *s->flag = UINT64_MAX;
+    MPI_Barrier(comm);                 /* flag is clear before anyone polls */
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, s->win);
+    s->solved = s->stopped = -1.0;
+    s->done = 0;
+    s->t0 = MPI_Wtime();
+}
+
+/* This rank found winning nonce w: raise the flag */
+static inline void search_stop_signal(search_stop_t *s, uint64_t w) {
+    uint64_t old;
+    MPI_Fetch_and_op(&w, &old, MPI_UINT64_T, 0, 0, MPI_MIN, s->win);
+    MPI_Win_flush(0, s->win);
+    if (s->solved < 0) s->solved = s->stopped = MPI_Wtime() - s->t0;
+    s->done = 1;
+}
+
+/* 1 once any rank has signalled */
+static inline int search_stop_poll(search_stop_t *s) {
+    uint64_t w;
+    if (s->done) return 1;
+    MPI_Fetch_and_op(NULL, &w, MPI_UINT64_T, 0, 0, MPI_NO_OP, s->win);
+    MPI_Win_flush(0, s->win);
+    if (w != UINT64_MAX) {
+        s->stopped = MPI_Wtime() - s->t0;
+        s->done = 1;
+    }
+    return s->done;
+}
+
+/* Collective. *nonce = lowest signalled winner (UINT64_MAX if none),
+ * *seconds = time to the first signal, *lag = from then until the last
+ * rank saw the flag (both 0 if nobody solved). */
+static inline void search_stop_close(search_stop_t *s, uint64_t *nonce, double *seconds, double *lag) {
+    int rank;
+    double solved = s->solved < 0 ? DBL_MAX : s->solved, first, last;
+    MPI_Comm_rank(s->comm, &rank);
+    MPI_Win_unlock_all(s->win);
+    MPI_Barrier(s->comm);              /* all signals have landed */
+    *nonce = rank == 0 ? *s->flag : 0;
+    MPI_Bcast(nonce, 1, MPI_UINT64_T, 0, s->comm);
+    MPI_Allreduce(&solved, &first, 1, MPI_DOUBLE, MPI_MIN, s->comm);
+    MPI_Allreduce(&s->stopped, &last, 1, MPI_DOUBLE, MPI_MAX, s->comm);
+    MPI_Win_free(&s->win);
+    *seconds = *nonce != UINT64_MAX ? first : 0.0;
+    *lag = *nonce != UINT64_MAX && last > first ? last - first : 0.0;
+}
+
+#endif /* SEARCH_STOP_H */
@@ -0,0 +1,359 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+/*
+ * SHA-256d proof-of-work search for crypto_miner and mining_demo.
+ *
+ *   sha256_job_t job;
+ *   sha256_job_init(&job, header);                 // 80-byte block header
+ *   const sha256_kernel_t *k = sha256_select_kernel(NULL);
+ *   hits = k->scan(&job, first, count, bits, &found);
+ *
+ * A hash is SHA-256(SHA-256(header)) of the 80-byte header with the nonce
+ * in bytes 76..79, read as a little-endian 256-bit number like Bitcoin
+ * does; it "wins" if its top `bits` bits are zero (difficulty, 0..64).
+ *
+ * Nonces are 64-bit indices g: the low 32 bits go in the header nonce, the
+ * high 32 bits are XORed into the last word of the merkle root (an
+ * extranonce), so the nonce space does not run out at 2^32. Both sit in
+ * the header's second 64-byte block, so the first block is hashed once per
+ * job (the midstate) and each try costs two compressions.
+ *
+ * Kernels hash 1 (scalar), 8 (AVX2) or 16 (AVX-512) nonces side by side,
+ * one per 32-bit lane (multi-buffer SHA-256). They only compute the last
+ * two digest words the difficulty test needs; sha256d() gives the full
+ * hash of a winner. sha256_select_kernel() picks as in cpu_kernel.h.
+ *
+ * When mpi.h is included first, sha256_report_rate() is available too.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA256_X86 1
+#endif
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+typedef struct {
+    uint32_t midstate[8];       /* state after header bytes 0..63 */
+    uint32_t tail[3];           /* header bytes 64..75 as big-endian words */
+} sha256_job_t;
+
+/* Hits among nonces [first, first + count); *found = first winning nonce,
+ * left alone if none */
+typedef uint64_t (*sha256_scan_fn)(const sha256_job_t *job, uint64_t first, uint64_t count,
+                                   int bits, uint64_t *found);
+
+typedef struct {
+    const char *name;
+    int lanes;
+    sha256_scan_fn scan;
+} sha256_kernel_t;
+
+static inline uint32_t sha256_rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static inline uint32_t sha256_be32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void sha256_compress(uint32_t state[8], const uint32_t block[16]) {
+    uint32_t w[64], s[8];
+    memcpy(w, block, 16 * sizeof(uint32_t));
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = sha256_rotr(w[i - 15], 7) ^ sha256_rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = sha256_rotr(w[i - 2], 17) ^ sha256_rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    memcpy(s, state, sizeof(s));
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = s[7] + (sha256_rotr(s[4], 6) ^ sha256_rotr(s[4], 11) ^ sha256_rotr(s[4], 25)) +
+                      ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+        uint32_t t2 = (sha256_rotr(s[0], 2) ^ sha256_rotr(s[0], 13) ^ sha256_rotr(s[0], 22)) +
+                      ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        memmove(s + 1, s, 7 * sizeof(uint32_t));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++) state[i] += s[i];
+}
+
+static inline void sha256_job_init(sha256_job_t *job, const unsigned char header[80]) {
+    uint32_t block[16];
+    for (int i = 0; i < 16; i++) block[i] = sha256_be32(header + 4 * i);
+    memcpy(job->midstate, sha256_iv, sizeof(sha256_iv));
+    sha256_compress(job->midstate, block);
+    for (int i = 0; i < 3; i++) job->tail[i] = sha256_be32(header + 64 + 4 * i);
+}
+
+/* Second header block for nonce g, padded to 80 bytes */
+static inline void sha256_block2(const sha256_job_t *job, uint64_t g, uint32_t w[16]) {
+    memset(w, 0, 16 * sizeof(uint32_t));
+    w[0] = job->tail[0] ^ (uint32_t)(g >> 32);
+    w[1] = job->tail[1];
+    w[2] = job->tail[2];
+    w[3] = __builtin_bswap32((uint32_t)g);      /* nonce is stored little-endian */
+    w[4] = 0x80000000;
+    w[15] = 80 * 8;
+}
+
+/* Full SHA-256d of the header with nonce g; digest[] in byte order */
+static inline void sha256d(const sha256_job_t *job, uint64_t g, unsigned char digest[32]) {
+    uint32_t w[16], st[8];
+    sha256_block2(job, g, w);
+    memcpy(st, job->midstate, sizeof(st));
+    sha256_compress(st, w);
+    memset(w, 0, sizeof(w));
+    memcpy(w, st, sizeof(st));
+    w[8] = 0x80000000;
+    w[15] = 32 * 8;
+    memcpy(st, sha256_iv, sizeof(st));
+    sha256_compress(st, w);
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = (unsigned char)(st[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(st[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(st[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)st[i];
+    }
+}
+
+/* Does the hash whose last two state words are h6, h7 meet `bits`? As a
+ * little-endian number its top 64 bits are bswap(h7):bswap(h6). */
+static inline int sha256_meets(uint32_t h6, uint32_t h7, int bits) {
+    uint64_t top = (uint64_t)__builtin_bswap32(h7) << 32 | __builtin_bswap32(h6);
+    return bits <= 0 || (bits < 64 ? (top >> (64 - bits)) == 0 : top == 0);
+}
+
+static uint64_t sha256_scan_scalar(const sha256_job_t *job, uint64_t first, uint64_t count,
+                                   int bits, uint64_t *found) {
+    uint64_t hits = 0;
+    for (uint64_t g = first; g < first + count; g++) {
+        unsigned char d[32];
+        sha256d(job, g, d);
+        if (sha256_meets(sha256_be32(d + 24), sha256_be32(d + 28), bits)) {
+            if (hits++ == 0) *found = g;
+        }
+    }
+    return hits;
+}
+
+#ifdef SHA256_X86
+/*
+ * Multi-buffer rounds, written once for any vector type V through these
+ * per-ISA macros: ADD, XOR, AND, ANDN(a, b) = ~a & b, ROTR, SHR, SET1.
+ */
+#define SHA256_MB_COMPRESS(V, st, w)                                                   \
+    do {                                                                               \
+        V a = st[0], b = st[1], c = st[2], d = st[3], e = st[4], f = st[5], g = st[6], \
+          h = st[7];                                                                   \
+        for (int i = 0; i < 64; i++) {                                                 \
+            if (i >= 16) {                                                             \
+                V x = w[(i - 15) & 15], y = w[(i - 2) & 15];                           \
+                V s0 = XOR(XOR(ROTR(x, 7), ROTR(x, 18)), SHR(x, 3));                   \
+                V s1 = XOR(XOR(ROTR(y, 17), ROTR(y, 19)), SHR(y, 10));                 \
+                w[i & 15] = ADD(ADD(w[i & 15], s0), ADD(w[(i - 7) & 15], s1));         \
+            }                                                                          \
+            V t1 = ADD(ADD(h, XOR(XOR(ROTR(e, 6), ROTR(e, 11)), ROTR(e, 25))),         \
+                       ADD(XOR(AND(e, f), ANDN(e, g)),                                 \
+                           ADD(SET1(sha256_k[i]), w[i & 15])));                        \
+            V t2 = ADD(XOR(XOR(ROTR(a, 2), ROTR(a, 13)), ROTR(a, 22)),                 \
+                       XOR(XOR(AND(a, b), AND(a, c)), AND(b, c)));                     \
+            h = g; g = f; f = e; e = ADD(d, t1);                                       \
+            d = c; c = b; b = a; a = ADD(t1, t2);                                      \
+        }                                                                              \
+        st[0] = ADD(st[0], a); st[1] = ADD(st[1], b); st[2] = ADD(st[2], c);           \
+        st[3] = ADD(st[3], d); st[4] = ADD(st[4], e); st[5] = ADD(st[5], f);           \
+        st[6] = ADD(st[6], g); st[7] = ADD(st[7], h);                                  \
+    } while (0)
+
+/* Hash LANES nonces from g (all with the same high word) and test them */
+#define SHA256_MB_SCAN(V, LANES, NONCES)                                               \
+    do {                                                                               \
+        for (; n + LANES <= end; n += LANES) {                                         \
+            V w[16], st[8];                                                            \
+            for (int i = 0; i < 8; i++) st[i] = SET1(job->midstate[i]);                \
+            w[0] = SET1(job->tail[0] ^ (uint32_t)(n >> 32));                           \
+            w[1] = SET1(job->tail[1]);                                                 \
+            w[2] = SET1(job->tail[2]);                                                 \
+            w[3] = NONCES((uint32_t)n);                                                \
+            w[4] = SET1(0x80000000u);                                                  \
+            for (int i = 5; i < 15; i++) w[i] = SET1(0);                               \
+            w[15] = SET1(80 * 8);                                                      \
+            SHA256_MB_COMPRESS(V, st, w);                                              \
+            for (int i = 0; i < 8; i++) w[i] = st[i];                                  \
+            w[8] = SET1(0x80000000u);                                                  \
+            for (int i = 9; i < 15; i++) w[i] = SET1(0);                               \
+            w[15] = SET1(32 * 8);                                                      \
+            for (int i = 0; i < 8; i++) st[i] = SET1(sha256_iv[i]);                    \
+            SHA256_MB_COMPRESS(V, st, w);                                              \
+            uint32_t h6[LANES], h7[LANES];                                             \
+            memcpy(h6, &st[6], sizeof(h6));                                            \
+            memcpy(h7, &st[7], sizeof(h7));                                            \
+            for (int l = 0; l < LANES; l++)                                            \
+                if (sha256_meets(h6[l], h7[l], bits) && hits++ == 0) *found = n + l;   \
+        }                                                                              \
+    } while (0)
+
+/* Nonces g..g+7 byte-swapped into lanes */
+__attribute__((target("avx2")))
+static inline __m256i sha256_nonces_avx2(uint32_t g) {
+    __m256i v = _mm256_add_epi32(_mm256_set1_epi32((int)g), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    return _mm256_shuffle_epi8(v, swap);
+}
+
+__attribute__((target("avx2")))
+static uint64_t sha256_scan_avx2(const sha256_job_t *job, uint64_t first, uint64_t count,
+                                 int bits, uint64_t *found) {
+#define ADD(a, b) _mm256_add_epi32(a, b)
+#define XOR(a, b) _mm256_xor_si256(a, b)
+#define AND(a, b) _mm256_and_si256(a, b)
+#define ANDN(a, b) _mm256_andnot_si256(a, b)
+#define SHR(a, n) _mm256_srli_epi32(a, n)
+#define ROTR(a, n) _mm256_or_si256(_mm256_srli_epi32(a, n), _mm256_slli_epi32(a, 32 - (n)))
+#define SET1(x) _mm256_set1_epi32((int)(x))
+    uint64_t hits = 0, n = first, stop = first + count;
+    while (n < stop) {
+        /* Keep each batch within one extranonce (high word) */
+        uint64_t end = ((n >> 32) + 1) << 32;
+        if (end > stop || end == 0) end = stop;
+        SHA256_MB_SCAN(__m256i, 8, sha256_nonces_avx2);
+        if (n < end) {                          /* tail: fewer than LANES nonces */
+            uint64_t g = 0, h = sha256_scan_scalar(job, n, end - n, bits, &g);
+            if (h && hits == 0) *found = g;
+            hits += h;
+            n = end;
+        }
+    }
+    return hits;
+#undef ADD
+#undef XOR
+#undef AND
+#undef ANDN
+#undef SHR
+#undef ROTR
+#undef SET1
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i sha256_nonces_avx512(uint32_t g) {
+    __m512i v = _mm512_add_epi32(_mm512_set1_epi32((int)g),
+                                 _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    const __m512i swap = _mm512_broadcast_i32x4(_mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8,
+                                                              15, 14, 13, 12));
+    return _mm512_shuffle_epi8(v, swap);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t sha256_scan_avx512(const sha256_job_t *job, uint64_t first, uint64_t count,
+                                   int bits, uint64_t *found) {
+#define ADD(a, b) _mm512_add_epi32(a, b)
+#define XOR(a, b) _mm512_xor_si512(a, b)
+#define AND(a, b) _mm512_and_si512(a, b)
+#define ANDN(a, b) _mm512_andnot_si512(a, b)
+#define SHR(a, n) _mm512_srli_epi32(a, n)
+#define ROTR(a, n) _mm512_ror_epi32(a, n)
+#define SET1(x) _mm512_set1_epi32((int)(x))
+    uint64_t hits = 0, n = first, stop = first + count;
+    while (n < stop) {
+        uint64_t end = ((n >> 32) + 1) << 32;
+        if (end > stop || end == 0) end = stop;
+        SHA256_MB_SCAN(__m512i, 16, sha256_nonces_avx512);
+        if (n < end) {                          /* tail: fewer than LANES nonces */
+            uint64_t g = 0, h = sha256_scan_scalar(job, n, end - n, bits, &g);
+            if (h && hits == 0) *found = g;
+            hits += h;
+            n = end;
+        }
+    }
+    return hits;
+#undef ADD
+#undef XOR
+#undef AND
+#undef ANDN
+#undef SHR
+#undef ROTR
+#undef SET1
+}
+#endif /* SHA256_X86 */
+
+static const sha256_kernel_t sha256_kernels[] = {
+#ifdef SHA256_X86
+    { "avx512", 16, sha256_scan_avx512 },
+    { "avx2",   8,  sha256_scan_avx2 },
+#endif
+    { "scalar", 1,  sha256_scan_scalar },
+};
+
+static inline int sha256_kernel_supported(const char *name) {
+#ifdef SHA256_X86
+    if (strcmp(name, "avx512") == 0)
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+    return strcmp(name, "scalar") == 0;
+}
+
+/* Pick a kernel by name, or the widest usable one (see cpu_kernel.h) */
+static inline const sha256_kernel_t *sha256_select_kernel(const char *name) {
+    int n = (int)(sizeof(sha256_kernels) / sizeof(sha256_kernels[0]));
+    return (const sha256_kernel_t *)cpu_kernel_select(sha256_kernels, n, sizeof(sha256_kernels[0]), name,
+                                                      sha256_kernel_supported);
+}
+
+/* Demo block template: the Bitcoin genesis block header (version 1, zero
+ * previous hash, its merkle root, time, bits). Its real nonce is
+ * 2083236893, a 32-bit winner. */
+static inline void sha256_demo_header(unsigned char header[80]) {
+    static const unsigned char merkle[32] = {
+        0x3b, 0xa3, 0xed, 0xfd, 0x7a, 0x7b, 0x12, 0xb2, 0x7a, 0xc7, 0x2c, 0x3e, 0x67, 0x76, 0x8f, 0x61,
+        0x7f, 0xc8, 0x1b, 0xc3, 0x88, 0x8a, 0x51, 0x32, 0x3a, 0x9f, 0xb8, 0xaa, 0x4b, 0x1e, 0x5e, 0x4a,
+    };
+    memset(header, 0, 80);
+    header[0] = 1;                               /* version, little-endian */
+    memcpy(header + 36, merkle, 32);
+    const uint32_t time = 1231006505, nbits = 0x1d00ffff;
+    for (int i = 0; i < 4; i++) {
+        header[68 + i] = (unsigned char)(time >> (8 * i));
+        header[72 + i] = (unsigned char)(nbits >> (8 * i));
+    }
+}
+
+#ifdef MPI_VERSION
+/* One "[Node: ...]" line per node with the hash rates of its ranks summed
+ * (printed by its lowest rank). Collective over comm. */
+static inline void sha256_report_rate(MPI_Comm comm, const char *hostname, int rank,
+                                      uint64_t hashes, double seconds) {
+    MPI_Comm node;
+    int node_rank, node_size;
+    double rate = seconds > 0 ? hashes / seconds : 0.0, node_rate = 0.0;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &node_rank);
+    MPI_Comm_size(node, &node_size);
+    MPI_Reduce(&rate, &node_rate, 1, MPI_DOUBLE, MPI_SUM, 0, node);
+    if (node_rank == 0)
+        printf("[Node: %s] %d rank(s) | %.2f MH/s\n", hostname, node_size, node_rate / 1e6);
+    MPI_Comm_free(&node);
+}
+#endif
+
+#endif /* SHA256_H */
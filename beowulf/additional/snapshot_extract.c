@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot_file.h"
+
+// Reads the trajectory files written by `galaxy_visible --snapshot FILE`
+// (format in snapshot_file.h). The file is mmap'd, so only the pages of the
+// requested frames and stars are read, however long the run was.
+//
+// Build: gcc -O2 -o snapshot_extract snapshot_extract.c
+// Usage:
+//   ./snapshot_extract run.snap                     list the frames
+//   ./snapshot_extract run.snap 3                   frame 3 as text
+//   ./snapshot_extract run.snap 0:20 --stride 100   frames 0..20, every 100th star
+//   ./snapshot_extract run.snap -1 --stars 0:500    last frame, stars 0..499
+// Output lines are "frame step star x y vx vy", ready for gnuplot or numpy.
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s FILE [FRAME|FIRST:LAST] [--stride S] [--stars A:B]\n", prog);
+}
+
+// "k" or "a:b"; negative numbers count from the end
+static int parse_range(const char *arg, long long n, long long *lo, long long *hi) {
+    char *end;
+    *lo = strtoll(arg, &end, 10);
+    if (end == arg) return -1;
+    *hi = *lo;
+    if (*end == ':') {
+        const char *rest = end + 1;
+        *hi = strtoll(rest, &end, 10);
+        if (end == rest) return -1;
+    }
+    if (*end != '\0') return -1;
+    if (*lo < 0) *lo += n;
+    if (*hi < 0) *hi += n;
+    return (*lo < 0 || *hi >= n || *lo > *hi) ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *range = NULL, *stars = NULL;
+    long long stride = 1;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--stride") == 0 && i + 1 < argc) stride = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--stars") == 0 && i + 1 < argc) stars = argv[++i];
+        else if (!range) range = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    snapf_map_t m;
+    if (snapf_map(argv[1], &m) != 0) {
+        fprintf(stderr, "%s is not a readable snapshot file\n", argv[1]);
+        return 1;
+    }
+    long long n = (long long)m.hdr.num_stars;
+
+    if (!range) {
+        printf("# %s: %llu stars, dt %g, %llu frames%s\n", argv[1],
+               (unsigned long long)n, m.hdr.dt, (unsigned long long)m.frames,
+               m.index ? "" : " (no index: file was not closed)");
+        printf("# frame step time\n");
+        for (uint64_t k = 0; k < m.frames; k++) {
+            const snapf_frame_t *f = snapf_frame(&m, k);
+            if (f) printf("%llu %lld %g\n", (unsigned long long)k, (long long)f->step, f->time);
+            else printf("%llu damaged\n", (unsigned long long)k);
+        }
+        snapf_unmap(&m);
+        return 0;
+    }
+
+    long long f0, f1, s0 = 0, s1 = n - 1;
+    if (parse_range(range, (long long)m.frames, &f0, &f1) != 0 ||
+        (stars && parse_range(stars, n, &s0, &s1) != 0) || stride < 1) {
+        fprintf(stderr, "Bad frame/star range or stride (%llu frames, %lld stars)\n",
+                (unsigned long long)m.frames, n);
+        snapf_unmap(&m);
+        return 1;
+    }
+
+    int rc = 0;
+    printf("# frame step star x y vx vy\n");
+    for (long long k = f0; k <= f1; k++) {
+        const snapf_frame_t *f = snapf_frame(&m, (uint64_t)k);
+        if (!f) {
+            fprintf(stderr, "Frame %lld is damaged\n", k);
+            rc = 1;
+            continue;
+        }
+        const double *x = (const double *)(f + 1);
+        const double *y = x + n, *vx = y + n, *vy = vx + n;
+        for (long long i = s0; i <= s1; i += stride)
+            printf("%lld %lld %lld %.17g %.17g %.17g %.17g\n",
+                   k, (long long)f->step, i, x[i], y[i], vx[i], vy[i]);
+    }
+    snapf_unmap(&m);
+    return rc;
+}
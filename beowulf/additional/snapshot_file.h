@@ -0,0 +1,194 @@
+#ifndef SNAPSHOT_FILE_H
+#define SNAPSHOT_FILE_H
+
+/*
+ * Binary trajectory format written by `galaxy_visible --snapshot FILE`.
+ *
+ *   [ 64-byte header ][ frame 0 ][ frame 1 ] ... [ frame index ]
+ *
+ * Every frame is one 64-byte frame header followed by x[n], y[n], vx[n],
+ * vy[n] (doubles, native endianness, star order), so all frames have the
+ * same size, header.frame_bytes. The index at the end holds one
+ * (offset, step) entry per frame, and header.index_offset points at it,
+ * so a reader finds frame k in O(1) without touching the frames before.
+ *
+ * The index and the final header are written when the run closes the
+ * file. If it never did (a crash), index_offset is 0; readers then count
+ * whole frames from the file size instead, and every frame still carries
+ * its own magic, number and step.
+ *
+ * snapf_map() maps a file read-only for tools such as snapshot_extract.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPF_MAGIC        "BWSNAPSH"   /* 8 bytes, no terminator stored */
+#define SNAPF_FRAME_MAGIC  "BWFRAME_"
+#define SNAPF_VERSION      1
+#define SNAPF_FIELDS       4            /* x, y, vx, vy */
+#define SNAPF_HEADER_SIZE  64
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t fields;        /* SNAPF_FIELDS */
+    uint64_t num_stars;
+    uint64_t frame_bytes;   /* frame header + fields * num_stars doubles */
+    uint64_t num_frames;    /* entries in the index (0 until closed) */
+    uint64_t index_offset;  /* byte offset of the index, 0 until closed */
+    double   dt;            /* simulated time per step */
+    uint8_t  reserved[8];
+} snapf_header_t;
+
+typedef struct {
+    char     magic[8];      /* SNAPF_FRAME_MAGIC */
+    uint64_t frame;         /* position in the file, from 0 */
+    int64_t  step;
+    double   time;          /* step * dt */
+    uint8_t  reserved[32];
+} snapf_frame_t;
+
+typedef struct {
+    uint64_t offset;        /* byte offset of the frame header */
+    int64_t  step;
+} snapf_index_t;
+
+_Static_assert(sizeof(snapf_header_t) == SNAPF_HEADER_SIZE, "snapshot header must be 64 bytes");
+_Static_assert(sizeof(snapf_frame_t) == 64, "frame header must be 64 bytes");
+
+static inline void snapf_header_init(snapf_header_t *h, uint64_t num_stars, double dt) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, SNAPF_MAGIC, sizeof(h->magic));
+    h->version     = SNAPF_VERSION;
+    h->fields      = SNAPF_FIELDS;
+    h->num_stars   = num_stars;
+    h->frame_bytes = sizeof(snapf_frame_t) + SNAPF_FIELDS * num_stars * sizeof(double);
+    h->dt          = dt;
+}
+
+/* Returns 0 if the header describes a file this code can read */
+static inline int snapf_header_check(const snapf_header_t *h) {
+    if (memcmp(h->magic, SNAPF_MAGIC, sizeof(h->magic)) != 0) return -1;
+    if (h->version != SNAPF_VERSION || h->fields != SNAPF_FIELDS) return -1;
+    if (h->frame_bytes != sizeof(snapf_frame_t) + SNAPF_FIELDS * h->num_stars * sizeof(double))
+        return -1;
+    return 0;
+}
+
+/* Byte offset of frame k while writing: frames are appended in order */
+static inline uint64_t snapf_frame_offset(const snapf_header_t *h, uint64_t k) {
+    return SNAPF_HEADER_SIZE + k * h->frame_bytes;
+}
+
+/* ---------------- writer ---------------- */
+
+/* Write all of buf at off. Returns 0, or -1 on an I/O error. */
+static inline int snapf_pwrite(int fd, const void *buf, size_t len, uint64_t off) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t w = pwrite(fd, p, len, (off_t)off);
+        if (w <= 0) return -1;
+        p += w;
+        len -= (size_t)w;
+        off += (uint64_t)w;
+    }
+    return 0;
+}
+
+/* Append frame k (data = x | y | vx | vy, num_stars each) */
+static inline int snapf_write_frame(int fd, const snapf_header_t *h, uint64_t k,
+                                    int64_t step, const double *data) {
+    snapf_frame_t f;
+    memset(&f, 0, sizeof(f));
+    memcpy(f.magic, SNAPF_FRAME_MAGIC, sizeof(f.magic));
+    f.frame = k;
+    f.step  = step;
+    f.time  = step * h->dt;
+    uint64_t off = snapf_frame_offset(h, k);
+    if (snapf_pwrite(fd, &f, sizeof(f), off) != 0) return -1;
+    return snapf_pwrite(fd, data, h->frame_bytes - sizeof(f), off + sizeof(f));
+}
+
+/* Write the index after the last frame, then the header that points at it */
+static inline int snapf_finish(int fd, snapf_header_t *h, const snapf_index_t *index, uint64_t frames) {
+    h->num_frames   = frames;
+    h->index_offset = snapf_frame_offset(h, frames);
+    if (snapf_pwrite(fd, index, frames * sizeof(snapf_index_t), h->index_offset) != 0) return -1;
+    if (fsync(fd) != 0) return -1;
+    if (snapf_pwrite(fd, h, sizeof(*h), 0) != 0) return -1;
+    return fsync(fd);
+}
+
+/* ---------------- mmap reader ---------------- */
+
+typedef struct {
+    int fd;
+    void *base;
+    size_t length;
+    snapf_header_t hdr;
+    uint64_t frames;             /* readable frames */
+    const snapf_index_t *index;  /* NULL if the file was never closed */
+} snapf_map_t;
+
+static inline void snapf_unmap(snapf_map_t *m) {
+    if (m->base) munmap(m->base, m->length);
+    if (m->fd >= 0) close(m->fd);
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+}
+
+/* Map a snapshot file read-only. Returns 0 on success, -1 on any error. */
+static inline int snapf_map(const char *path, snapf_map_t *m) {
+    struct stat st;
+    memset(m, 0, sizeof(*m));
+    m->fd = open(path, O_RDONLY);
+    if (m->fd < 0) return -1;
+    if (fstat(m->fd, &st) != 0 || st.st_size < SNAPF_HEADER_SIZE) goto fail;
+
+    m->length = (size_t)st.st_size;
+    m->base = mmap(NULL, m->length, PROT_READ, MAP_SHARED, m->fd, 0);
+    if (m->base == MAP_FAILED) {
+        m->base = NULL;
+        goto fail;
+    }
+
+    memcpy(&m->hdr, m->base, sizeof(m->hdr));
+    if (snapf_header_check(&m->hdr) != 0) goto fail;
+    if (m->hdr.index_offset != 0) {
+        if (m->hdr.index_offset + m->hdr.num_frames * sizeof(snapf_index_t) > m->length) goto fail;
+        m->index = (const snapf_index_t *)((const char *)m->base + m->hdr.index_offset);
+        m->frames = m->hdr.num_frames;
+    } else {
+        /* Unclosed file: every complete frame is readable */
+        m->frames = (m->length - SNAPF_HEADER_SIZE) / m->hdr.frame_bytes;
+    }
+    madvise(m->base, m->length, MADV_RANDOM);
+    return 0;
+
+fail:
+    if (m->base) munmap(m->base, m->length);
+    close(m->fd);
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+    return -1;
+}
+
+/* Header of frame k (k < m->frames), or NULL if it is damaged. Its data
+ * follows: x = (const double *)(f + 1), then y, vx, vy at num_stars
+ * strides. */
+static inline const snapf_frame_t *snapf_frame(const snapf_map_t *m, uint64_t k) {
+    if (k >= m->frames) return NULL;
+    uint64_t off = m->index ? m->index[k].offset : snapf_frame_offset(&m->hdr, k);
+    if (off + m->hdr.frame_bytes > m->length) return NULL;
+    const snapf_frame_t *f = (const snapf_frame_t *)((const char *)m->base + off);
+    if (memcmp(f->magic, SNAPF_FRAME_MAGIC, sizeof(f->magic)) != 0 || f->frame != k) return NULL;
+    return f;
+}
+
+#endif /* SNAPSHOT_FILE_H */
@@ -0,0 +1,164 @@
+#ifndef TASK_JOURNAL_H
+#define TASK_JOURNAL_H
+
+/*
+ * Completion journal for dynamic_manager: which task ids are done, kept
+ * as a bitmap in memory and as an append-only binary file on /cluster so
+ * a restarted job skips them.
+ *
+ *   journal_t j;
+ *   journal_open(&j, path, ntasks);     // replay: O(file), returns tasks done or -1
+ *   t = journal_next(&j, t);            // first task >= t not done yet
+ *   journal_mark(&j, t);                // O(1), durable at the next commit
+ *   journal_close(&j);                  // commits what is pending
+ *
+ * The file is a sequence of 8-byte records { task, task ^ JOURNAL_MAGIC }.
+ * Replay reads it in large blocks and stops at the first record that is
+ * short or does not check out (a write torn by a crash, or a tail of
+ * zeroes), then truncates the file there so new records stay aligned.
+ *
+ * Group commit: journal_mark only sets the bit and queues the record. The
+ * queue is written with one write() and one fdatasync() when it holds
+ * JOURNAL_BATCH records or the oldest one has waited JOURNAL_SYNC_SECONDS
+ * (checked as each task is marked), so a crash re-runs at most that much
+ * finished work and never skips any.
+ *
+ * The journal has one writer (the manager) and needs no lock. Delete the
+ * file to start a job from scratch.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC 0x4a524e4cu     /* "JRNL" */
+#define JOURNAL_BATCH 4096            /* records per commit, at most */
+#define JOURNAL_SYNC_SECONDS 0.5      /* oldest queued record waits at most */
+
+typedef struct {
+    uint32_t task, check;
+} journal_rec_t;
+
+typedef struct {
+    int fd;                           /* -1: in memory only */
+    long ntasks, ndone;
+    uint64_t *bits;                   /* 1 = done */
+    journal_rec_t *queue;             /* marked, not yet committed */
+    int nqueued;
+    double queued_at;                 /* when queue[0] was marked */
+} journal_t;
+
+static inline double journal_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline int journal_is_done(const journal_t *j, long t) {
+    return (j->bits[t >> 6] >> (t & 63)) & 1;
+}
+
+static inline void journal_set(journal_t *j, long t) {
+    if (!journal_is_done(j, t)) {
+        j->bits[t >> 6] |= 1ULL << (t & 63);
+        j->ndone++;
+    }
+}
+
+/* Write and sync the queued records */
+static inline void journal_commit(journal_t *j) {
+    if (j->nqueued == 0) return;
+    if (j->fd >= 0) {
+        size_t len = (size_t)j->nqueued * sizeof(journal_rec_t), off = 0;
+        while (off < len) {
+            ssize_t w = write(j->fd, (const char *)j->queue + off, len - off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) break;
+            off += (size_t)w;
+        }
+        if (off < len || fdatasync(j->fd) != 0)
+            fprintf(stderr, "Journal write failed: %s\n", strerror(errno));
+    }
+    j->nqueued = 0;
+}
+
+/* Commit what is pending and release the journal */
+static inline void journal_close(journal_t *j) {
+    journal_commit(j);
+    if (j->fd >= 0) close(j->fd);
+    free(j->bits);
+    free(j->queue);
+    memset(j, 0, sizeof(*j));
+    j->fd = -1;
+}
+
+/* Load (or create) the journal at path for tasks [0, ntasks). Returns the
+ * number already done, or -1 if the bitmap cannot be allocated; path ==
+ * NULL or an unusable file keeps the bitmap in memory only. */
+static inline long journal_open(journal_t *j, const char *path, long ntasks) {
+    memset(j, 0, sizeof(*j));
+    j->fd = -1;
+    j->ntasks = ntasks;
+    j->bits = (uint64_t *)calloc((size_t)(ntasks + 63) / 64 + 1, sizeof(uint64_t));
+    j->queue = (journal_rec_t *)malloc(JOURNAL_BATCH * sizeof(journal_rec_t));
+    if (!j->bits || !j->queue) {
+        journal_close(j);
+        return -1;
+    }
+    if (!path) return 0;
+    j->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (j->fd < 0) {
+        fprintf(stderr, "Cannot open journal %s: %s (progress will not be saved)\n", path, strerror(errno));
+        return 0;
+    }
+
+    journal_rec_t buf[JOURNAL_BATCH];
+    off_t good = 0;
+    for (;;) {
+        ssize_t got = pread(j->fd, buf, sizeof(buf), good);
+        if (got < 0 && errno == EINTR) continue;
+        int n = got > 0 ? (int)(got / (ssize_t)sizeof(journal_rec_t)) : 0, i;
+        for (i = 0; i < n && (buf[i].task ^ JOURNAL_MAGIC) == buf[i].check; i++)
+            if ((long)buf[i].task < ntasks) journal_set(j, buf[i].task);
+        good += (off_t)i * (off_t)sizeof(journal_rec_t);
+        if (i < n || got < (ssize_t)sizeof(buf)) break;
+    }
+    struct stat st;
+    if (fstat(j->fd, &st) == 0 && st.st_size > good) {
+        fprintf(stderr, "Journal %s: dropping %lld bytes of torn tail\n", path,
+                (long long)(st.st_size - good));
+        if (ftruncate(j->fd, good) != 0) fprintf(stderr, "Journal truncate failed: %s\n", strerror(errno));
+    }
+    return j->ndone;
+}
+
+/* First task >= t that is not done (ntasks if none) */
+static inline long journal_next(const journal_t *j, long t) {
+    while (t < j->ntasks) {
+        uint64_t w = ~j->bits[t >> 6] >> (t & 63);
+        if (w) {
+            t += __builtin_ctzll(w);
+            return t < j->ntasks ? t : j->ntasks;
+        }
+        t = (t | 63) + 1;
+    }
+    return j->ntasks;
+}
+
+/* Mark t done; committed with the next batch */
+static inline void journal_mark(journal_t *j, long t) {
+    if (t < 0 || t >= j->ntasks || journal_is_done(j, t)) return;
+    journal_set(j, t);
+    if (j->nqueued == 0) j->queued_at = journal_now();
+    j->queue[j->nqueued++] = (journal_rec_t){ (uint32_t)t, (uint32_t)t ^ JOURNAL_MAGIC };
+    if (j->nqueued == JOURNAL_BATCH || journal_now() - j->queued_at >= JOURNAL_SYNC_SECONDS)
+        journal_commit(j);
+}
+
+#endif /* TASK_JOURNAL_H */
@@ -0,0 +1,313 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/*
+ * Small pthreads pool for the hybrid (MPI + threads) mode of the compute
+ * programs: run ONE rank per node and let this pool use the node's cores,
+ * instead of one single-threaded rank per slot with its own copy of the data.
+ *
+ *   thread_pool_t *tp = tp_create(nthreads);
+ *   tp_parallel_for(tp, begin, end, grain, fn, arg);   // fn(lo, hi, tid, arg)
+ *   tp_destroy(tp);
+ *
+ * tp_parallel_for splits [begin, end) evenly over the threads. Each thread
+ * eats its own range from the front, `grain` items at a time; a thread that
+ * runs dry steals the back half of another thread's remaining range. So
+ * ranges with uneven per-item cost (big numbers in prime_demo, clustered
+ * stars in galaxy) still finish together. The calling thread is worker 0.
+ *
+ * Thread count (see tp_resolve_threads):
+ *   --threads N       fixed count
+ *   --threads auto    online cores / ranks on this node
+ *   --threads FILE    per-host lookup on the line of this node: "threads=N",
+ *                     else "slots=N". So `--threads hosts` gives each node
+ *                     as many threads as it has slots in the cluster's hosts
+ *                     file. Put threads= in a separate file, since mpirun
+ *                     rejects unknown keys in its hostfile:
+ *                         master  threads=2
+ *                         worker1 threads=4
+ *   BW_THREADS=...    same values, used when --threads is not given
+ * Default is 1 thread (plain MPI, as before).
+ *
+ * Build with -pthread.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef void (*tp_range_fn)(long lo, long hi, int tid, void *arg);
+
+/* One per thread, padded so neighbouring slots don't share a cache line */
+typedef struct {
+    pthread_mutex_t lock;
+    long lo, hi;
+    char pad[64];
+} tp_slot_t;
+
+typedef struct {
+    int nthreads;
+    pthread_t *threads;
+    tp_slot_t *slots;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start_cv;
+    pthread_cond_t done_cv;
+    unsigned long generation;
+    int pending;
+    int shutdown;
+
+    tp_range_fn fn;
+    void *arg;
+    long grain;
+} thread_pool_t;
+
+typedef struct {
+    thread_pool_t *tp;
+    int tid;
+} tp_worker_arg_t;
+
+/* Take up to `grain` items from the front of our own range */
+static int tp_take_own(thread_pool_t *tp, int tid, long *lo, long *hi) {
+    tp_slot_t *s = &tp->slots[tid];
+    int got = 0;
+    pthread_mutex_lock(&s->lock);
+    if (s->lo < s->hi) {
+        *lo = s->lo;
+        *hi = (s->hi - s->lo > tp->grain) ? s->lo + tp->grain : s->hi;
+        s->lo = *hi;
+        got = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return got;
+}
+
+/* Steal the back half of some other thread's range into our own slot */
+static int tp_steal(thread_pool_t *tp, int tid) {
+    for (int k = 1; k < tp->nthreads; k++) {
+        tp_slot_t *v = &tp->slots[(tid + k) % tp->nthreads];
+        long lo = 0, hi = 0;
+
+        pthread_mutex_lock(&v->lock);
+        long rem = v->hi - v->lo;
+        if (rem > 0) {
+            long take = (rem > tp->grain) ? rem / 2 : rem;
+            hi = v->hi;
+            lo = v->hi - take;
+            v->hi = lo;
+        }
+        pthread_mutex_unlock(&v->lock);
+
+        if (hi > lo) {
+            tp_slot_t *s = &tp->slots[tid];
+            pthread_mutex_lock(&s->lock);
+            s->lo = lo;
+            s->hi = hi;
+            pthread_mutex_unlock(&s->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Work loop of one thread for the current job. Work is never added while a
+ * job runs, so once every slot is empty there is nothing left to claim. */
+static void tp_run(thread_pool_t *tp, int tid) {
+    long lo, hi;
+    for (;;) {
+        if (tp_take_own(tp, tid, &lo, &hi)) {
+            tp->fn(lo, hi, tid, tp->arg);
+        } else if (!tp_steal(tp, tid)) {
+            return;
+        }
+    }
+}
+
+static void *tp_worker(void *p) {
+    tp_worker_arg_t *wa = (tp_worker_arg_t *)p;
+    thread_pool_t *tp = wa->tp;
+    int tid = wa->tid;
+    free(wa);
+
+    unsigned long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&tp->lock);
+        while (!tp->shutdown && tp->generation == seen)
+            pthread_cond_wait(&tp->start_cv, &tp->lock);
+        if (tp->shutdown) {
+            pthread_mutex_unlock(&tp->lock);
+            return NULL;
+        }
+        seen = tp->generation;
+        pthread_mutex_unlock(&tp->lock);
+
+        tp_run(tp, tid);
+
+        pthread_mutex_lock(&tp->lock);
+        if (--tp->pending == 0) pthread_cond_signal(&tp->done_cv);
+        pthread_mutex_unlock(&tp->lock);
+    }
+}
+
+/* Create a pool with nthreads workers (including the caller). NULL on error. */
+static thread_pool_t *tp_create(int nthreads) {
+    if (nthreads < 1) nthreads = 1;
+    thread_pool_t *tp = (thread_pool_t *)calloc(1, sizeof(thread_pool_t));
+    if (!tp) return NULL;
+    tp->nthreads = nthreads;
+    tp->slots = (tp_slot_t *)calloc(nthreads, sizeof(tp_slot_t));
+    tp->threads = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    if (!tp->slots || !tp->threads) {
+        free(tp->slots);
+        free(tp->threads);
+        free(tp);
+        return NULL;
+    }
+    pthread_mutex_init(&tp->lock, NULL);
+    pthread_cond_init(&tp->start_cv, NULL);
+    pthread_cond_init(&tp->done_cv, NULL);
+    for (int t = 0; t < nthreads; t++) pthread_mutex_init(&tp->slots[t].lock, NULL);
+
+    for (int t = 1; t < nthreads; t++) {
+        tp_worker_arg_t *wa = (tp_worker_arg_t *)malloc(sizeof(tp_worker_arg_t));
+        if (wa) {
+            wa->tp = tp;
+            wa->tid = t;
+        }
+        if (!wa || pthread_create(&tp->threads[t], NULL, tp_worker, wa) != 0) {
+            /* Run with the threads we managed to start */
+            free(wa);
+            tp->nthreads = t;
+            break;
+        }
+    }
+    return tp;
+}
+
+/* Run fn over [begin, end) on all threads and wait for completion */
+static void tp_parallel_for(thread_pool_t *tp, long begin, long end, long grain,
+                            tp_range_fn fn, void *arg) {
+    if (end <= begin) return;
+    if (grain < 1) grain = 1;
+    if (tp->nthreads == 1) {
+        fn(begin, end, 0, arg);
+        return;
+    }
+
+    long n = end - begin;
+    for (int t = 0; t < tp->nthreads; t++) {
+        tp->slots[t].lo = begin + (n * t) / tp->nthreads;
+        tp->slots[t].hi = begin + (n * (t + 1)) / tp->nthreads;
+    }
+
+    pthread_mutex_lock(&tp->lock);
+    tp->fn = fn;
+    tp->arg = arg;
+    tp->grain = grain;
+    tp->pending = tp->nthreads - 1;
+    tp->generation++;
+    pthread_cond_broadcast(&tp->start_cv);
+    pthread_mutex_unlock(&tp->lock);
+
+    tp_run(tp, 0);
+
+    pthread_mutex_lock(&tp->lock);
+    while (tp->pending > 0) pthread_cond_wait(&tp->done_cv, &tp->lock);
+    pthread_mutex_unlock(&tp->lock);
+}
+
+static int tp_size(const thread_pool_t *tp) {
+    return tp->nthreads;
+}
+
+static void tp_destroy(thread_pool_t *tp) {
+    if (!tp) return;
+    pthread_mutex_lock(&tp->lock);
+    tp->shutdown = 1;
+    pthread_cond_broadcast(&tp->start_cv);
+    pthread_mutex_unlock(&tp->lock);
+    for (int t = 1; t < tp->nthreads; t++) pthread_join(tp->threads[t], NULL);
+
+    for (int t = 0; t < tp->nthreads; t++) pthread_mutex_destroy(&tp->slots[t].lock);
+    pthread_mutex_destroy(&tp->lock);
+    pthread_cond_destroy(&tp->start_cv);
+    pthread_cond_destroy(&tp->done_cv);
+    free(tp->slots);
+    free(tp->threads);
+    free(tp);
+}
+
+/* "threads=N" (preferred) or "slots=N" from this host's line of a hostfile */
+static int tp_threads_from_hostfile(const char *path, const char *hostname) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+
+    char line[512];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), f)) {
+        char host[256];
+        if (line[0] == '#' || sscanf(line, "%255s", host) != 1) continue;
+        /* Match "worker1" against "worker1" or "worker1.cluster.local" */
+        size_t hl = strlen(host);
+        if (strncmp(hostname, host, hl) != 0 || (hostname[hl] != '\0' && hostname[hl] != '.'))
+            continue;
+
+        char *p;
+        if ((p = strstr(line, "threads=")) != NULL) found = atoi(p + 8);
+        else if ((p = strstr(line, " slots=")) != NULL) found = atoi(p + 7);
+    }
+    fclose(f);
+    return found > 0 ? found : 0;
+}
+
+/*
+ * Resolve a thread-count spec (see top of file). spec == NULL falls back to
+ * $BW_THREADS and then to 1. ranks_on_node is used by "auto" to share the
+ * node's cores between ranks that were placed on the same host.
+ */
+static int tp_resolve_threads(const char *spec, const char *hostname, int ranks_on_node) {
+    if (!spec || !*spec) spec = getenv("BW_THREADS");
+    if (!spec || !*spec) return 1;
+
+    char *end;
+    long n = strtol(spec, &end, 10);
+    if (*end == '\0' && n > 0) return (int)n;
+
+    if (strcmp(spec, "auto") != 0) {
+        int t = tp_threads_from_hostfile(spec, hostname);
+        if (t > 0) return t;
+        /* Host not listed: fall through to auto */
+    }
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ranks_on_node < 1) ranks_on_node = 1;
+    n = (ncpu > 0 ? ncpu : 1) / ranks_on_node;
+    return n > 0 ? (int)n : 1;
+}
+
+#ifdef MPI_VERSION
+/* Number of ranks sharing this node (include mpi.h before this header) */
+static int tp_ranks_on_node(MPI_Comm comm) {
+    MPI_Comm node;
+    int n;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    MPI_Comm_size(node, &n);
+    MPI_Comm_free(&node);
+    return n;
+}
+
+/* The pool runs beside the thread that calls MPI, which needs
+ * MPI_THREAD_FUNNELED. If MPI_Init_thread `provided` less, use one thread
+ * (rank 0 says so). */
+static int tp_mpi_threads(int nthreads, int provided) {
+    int rank;
+    if (nthreads <= 1 || provided >= MPI_THREAD_FUNNELED) return nthreads;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0) fprintf(stderr, "MPI does not support MPI_THREAD_FUNNELED; using 1 thread per rank\n");
+    return 1;
+}
+#endif
+
+#endif /* THREAD_POOL_H */